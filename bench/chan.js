@@ -0,0 +1,39 @@
+// Messages per second between two coroutines over a channel, for a few
+// channel capacities. A spawned producer sends MESSAGES integers and closes
+// the channel; the main coroutine receives until it's closed. Run with
+// 'build/corona bench/chan.js'.
+var MESSAGES = 1000000;
+var CAPACITIES = [0, 1, 16, 1024];
+
+CAPACITIES.forEach(function(capacity) {
+    var ch = sys.channel(capacity);
+    var start = Date.now();
+
+    var producer = sys.spawn(function() {
+        for (var i = 0; i < MESSAGES; i++) {
+            if (ch.send(i) < 0) {
+                throw new Error('send');
+            }
+        }
+
+        ch.close();
+    });
+
+    var received = 0;
+    while (ch.recv() !== undefined) {
+        received++;
+    }
+
+    producer.join();
+
+    var secs = (Date.now() - start) / 1000;
+    if (received != MESSAGES) {
+        throw new Error('received ' + received + ' of ' + MESSAGES);
+    }
+
+    console.log(
+        'capacity ' + capacity + ': ' + received + ' messages in ' +
+            secs.toFixed(2) + 's, ' + Math.round(received / secs) +
+            ' msgs/sec'
+    );
+});
@@ -0,0 +1,100 @@
+// Microbenchmark for coroutine context switches.
+//
+// Ping-pongs between main() and a single coroutine using coro_transfer(),
+// which is what Thread::Start() boils down to on every Yield(). Build this
+// once per backend (the Makefile produces build/coroswitch-sjlj and
+// build/coroswitch-asm) and compare the ns/switch figures.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "coro.h"
+
+#if CORO_ASM
+static const char *kBackend = "asm";
+#elif CORO_SJLJ
+static const char *kBackend = "sjlj";
+#elif CORO_UCONTEXT
+static const char *kBackend = "ucontext";
+#else
+static const char *kBackend = "other";
+#endif
+
+static const size_t kStackSize = 128 * 1024;
+
+static size_t numSwitches = 10000000;
+static coro_context mainCtx;
+static coro_context pongCtx;
+static volatile size_t pongs = 0;
+
+static double
+now(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+pong(void *arg) {
+    while (true) {
+        pongs++;
+        coro_transfer(&pongCtx, &mainCtx);
+    }
+}
+
+static void
+usage(FILE *fp, const char *name) {
+    fprintf(fp, "usage: %s [-n <switches>]\n\n", name);
+    fprintf(fp, "Measure the cost of a coroutine context switch.\n\n");
+    fprintf(fp, "Options:\n");
+    fprintf(fp, "  -h                help\n");
+    fprintf(fp,
+"  -n <switches>     round trips to perform (default: %lu)\n",
+        (unsigned long) numSwitches);
+}
+
+int
+main(int argc, char **argv) {
+    int c;
+
+    while ((c = getopt(argc, argv, "n:h")) != -1) {
+        switch (c) {
+        case 'n':
+            numSwitches = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    void *stack = malloc(kStackSize);
+    coro_create(&pongCtx, pong, NULL, stack, kStackSize);
+
+    double start = now();
+    for (size_t i = 0; i < numSwitches; i++) {
+        coro_transfer(&mainCtx, &pongCtx);
+    }
+    double elapsed = now() - start;
+
+    if (pongs != numSwitches) {
+        fprintf(stderr, "%s: lost a switch somewhere\n", argv[0]);
+        return 1;
+    }
+
+    // Each round trip is two switches
+    printf(
+        "%-8s %lu round trips in %.3f s: %6.2f ns/switch\n",
+            kBackend, (unsigned long) numSwitches, elapsed,
+            (elapsed * 1e9) / (2 * numSwitches)
+    );
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+// A client to measure request/response round trips against an echo server.
+//
+// Opens a fixed number of connections at once, and on each of them sends a
+// message and waits for all of it to come back, a given number of times in
+// a row. Reports round trips per second across all connections and
+// percentiles of how long each one took.
+
+#include <stdio.h>
+#include <errno.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ev.h>
+
+typedef struct conn_s {
+    struct ev_io c_ev_io;
+    size_t c_msgs;
+    size_t c_off;
+    int c_writing;
+    ev_tstamp c_start;
+} conn_t;
+
+struct sockaddr_in addr;
+size_t numConns = 100;
+size_t numMsgs = 1000;
+size_t msgSize = 16;
+char *msg;
+char *readBuf;
+size_t open_cnt = 0;
+
+// stats
+double *latencies;
+size_t done_cnt = 0;
+size_t failed_cnt = 0;
+
+static void
+conn_close(struct ev_loop *el, conn_t *c, int failed) {
+    if (failed) {
+        failed_cnt++;
+    }
+
+    ev_io_stop(el, &c->c_ev_io);
+    close(c->c_ev_io.fd);
+    free(c);
+
+    if (--open_cnt == 0) {
+        ev_unloop(el, EVUNLOOP_ALL);
+    }
+}
+
+// Start sending the next message, or close the connection if that was
+// the last one
+static void
+conn_next(struct ev_loop *el, conn_t *c) {
+    if (c->c_msgs++ == numMsgs) {
+        conn_close(el, c, 0);
+        return;
+    }
+
+    c->c_off = 0;
+    c->c_writing = 1;
+    c->c_start = ev_time();
+
+    ev_io_stop(el, &c->c_ev_io);
+    ev_io_set(&c->c_ev_io, c->c_ev_io.fd, EV_WRITE);
+    ev_io_start(el, &c->c_ev_io);
+}
+
+static void
+conn_watcher_cb(struct ev_loop *el, ev_io *ew, int revents) {
+    conn_t *c = (conn_t*) ew;
+    ssize_t nbytes;
+
+    if (c->c_writing) {
+        nbytes = write(ew->fd, msg + c->c_off, msgSize - c->c_off);
+        if (nbytes < 0) {
+            if (errno != EAGAIN) {
+                conn_close(el, c, 1);
+            }
+
+            return;
+        }
+
+        if ((c->c_off += nbytes) < msgSize) {
+            return;
+        }
+
+        c->c_off = 0;
+        c->c_writing = 0;
+
+        ev_io_stop(el, ew);
+        ev_io_set(ew, ew->fd, EV_READ);
+        ev_io_start(el, ew);
+        return;
+    }
+
+    nbytes = read(ew->fd, readBuf, msgSize - c->c_off);
+    if (nbytes < 0 && errno == EAGAIN) {
+        return;
+    }
+
+    if (nbytes <= 0) {
+        conn_close(el, c, 1);
+        return;
+    }
+
+    if ((c->c_off += nbytes) < msgSize) {
+        return;
+    }
+
+    latencies[done_cnt++] = ev_time() - c->c_start;
+    conn_next(el, c);
+}
+
+static int
+spawn_connection(struct ev_loop *el) {
+    conn_t *c;
+    int sock;
+    int one = 1;
+
+    if ((sock = socket(PF_INET, SOCK_STREAM, 6 /* TCP */)) < 0) {
+        return -1;
+    }
+
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0 ||
+        (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0 &&
+         errno != EINPROGRESS)) {
+        close(sock);
+        return -1;
+    }
+
+    c = (conn_t*) malloc(sizeof(*c));
+    c->c_msgs = 0;
+    ev_io_init(&c->c_ev_io, conn_watcher_cb, sock, EV_WRITE);
+    open_cnt++;
+    conn_next(el, c);
+
+    return 0;
+}
+
+static int
+cmp_double(const void *a, const void *b) {
+    double da = *(const double*) a;
+    double db = *(const double*) b;
+
+    return (da < db) ? -1 : (da > db);
+}
+
+static double
+percentile(double p) {
+    size_t i = (size_t) (p * done_cnt);
+
+    return latencies[(i < done_cnt) ? i : done_cnt - 1] * 1000;
+}
+
+void
+usage(FILE *fp, char *name) {
+    fprintf(fp,
+"usage: %s [options] <host> <port>\n\n", name);
+    fprintf(fp,
+"Measure request/response round trips against an echo server.\n\n");
+    fprintf(fp,
+"Options:\n");
+    fprintf(fp,
+"  -h                help\n");
+    fprintf(fp,
+"  -c <conns>        connections to open at once (default: %lu)\n",
+numConns);
+    fprintf(fp,
+"  -m <msgs>         messages to send on each connection (default: %lu)\n",
+numMsgs);
+    fprintf(fp,
+"  -s <bytes>        size of each message (default: %lu)\n", msgSize);
+}
+
+int
+main(int argc, char **argv) {
+    struct ev_loop *el;
+    struct hostent *hent;
+    ev_tstamp start;
+    ev_tstamp secs;
+    size_t i;
+    int c;
+
+    while ((c = getopt(argc, argv, "c:m:s:h")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+
+        case 'c':
+            numConns = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'm':
+            numMsgs = strtoul(optarg, NULL, 10);
+            break;
+
+        case 's':
+            msgSize = strtoul(optarg, NULL, 10);
+            break;
+
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    if ((argc - optind) != 2 || numConns == 0 || numMsgs == 0 ||
+        msgSize == 0) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    if (!(hent = gethostbyname(argv[optind]))) {
+        fprintf(stderr, "%s: unable to resolve %s\n", argv[0], argv[optind]);
+        return 1;
+    }
+
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(strtoul(argv[optind + 1], NULL, 10));
+    memcpy(&addr.sin_addr, hent->h_addr_list[0], sizeof(addr.sin_addr));
+
+    msg = (char*) malloc(msgSize);
+    memset(msg, 'x', msgSize);
+    readBuf = (char*) malloc(msgSize);
+    latencies = (double*) malloc(numConns * numMsgs * sizeof(*latencies));
+
+    el = ev_default_loop(EVFLAG_AUTO);
+    start = ev_time();
+
+    for (i = 0; i < numConns; i++) {
+        if (spawn_connection(el) < 0) {
+            failed_cnt++;
+        }
+    }
+
+    if (open_cnt > 0) {
+        ev_loop(el, 0);
+    }
+
+    secs = ev_time() - start;
+    qsort(latencies, done_cnt, sizeof(*latencies), cmp_double);
+
+    printf(
+        "%lu round trips of %lu bytes in %.2fs, %.0f/sec; "
+        "%lu of %lu connections failed\n",
+            (unsigned long) done_cnt, (unsigned long) msgSize, secs,
+            done_cnt / secs, (unsigned long) failed_cnt,
+            (unsigned long) numConns
+    );
+
+    if (done_cnt > 0) {
+        printf(
+            "latency (ms): p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  "
+            "max %.2f\n",
+                percentile(0.5), percentile(0.9), percentile(0.99),
+                percentile(0.999), latencies[done_cnt - 1] * 1000
+        );
+    }
+
+    return failed_cnt > 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/env bash
+
+# Measure request/response throughput and latency against an echo server
+# (see echod.js) for a few message sizes.
+
+DIR=$(dirname $0)
+
+$DIR/../build/corona $DIR/echod.js &
+serverPid=$!
+sleep 1
+
+for size in 16 512 4000; do
+    echo "Messages of $size bytes ..."
+    $DIR/../build/echo -c 100 -m 1000 -s $size localhost 4000 || \
+        echo "echo exit status $?"
+    echo
+done
+
+kill $serverPid
+wait $serverPid 2>/dev/null
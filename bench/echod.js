@@ -0,0 +1,38 @@
+// An echo server: each connection writes back whatever it reads, until the
+// client closes it. See echo.sh.
+var fd = sys.socket(sys.AF_INET, sys.SOCK_STREAM, sys.PROTO_TCP);
+if (fd < 0) {
+    throw new Error('socket');
+}
+
+var err = sys.setsockopt(fd, sys.SOL_SOCKET, sys.SO_REUSEPORT, 1);
+if (err < 0) {
+    throw new Error('setsockopt');
+}
+
+err = sys.bind(fd, 4000);
+if (err < 0) {
+    throw new Error('bind');
+}
+
+err = sys.listen(fd, 1024);
+if (err < 0) {
+    throw new Error('listen');
+}
+
+err = sys.fcntl(fd, sys.F_SETFL, sys.O_NONBLOCK);
+if (err < 0) {
+    throw new Error('fcntl');
+}
+
+var err = sys.accept(fd, function(fd2) {
+    var data;
+
+    while ((data = sys.read(fd2, 4096)) !== -1 && data.length > 0) {
+        if (sys.write(fd2, data) < 0) {
+            break;
+        }
+    }
+
+    sys.close(fd2);
+});
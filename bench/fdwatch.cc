@@ -0,0 +1,255 @@
+// Count system calls made by an accept loop under two watcher strategies.
+//
+// "start/stop" re-initializes and restarts the listening fd's ev_io before
+// every wait and stops it after waking up, as CoronaThread::YieldIO() used
+// to. "persistent" leaves the watcher armed across waits, as the per-fd
+// watcher table in src/sched.cc does. In both cases, each wakeup accepts
+// until EAGAIN and closes the new connections, like bench/tcpd.js.
+//
+// libev is compiled into this program (see libev.c) so that we can
+// count the epoll_ctl(2) and epoll_wait(2) calls that it makes on our
+// behalf. Each mode runs in its own child process against its own client.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ev.h"
+
+// Maintained by libev.c
+extern "C" {
+    extern size_t numEpollCtl;
+    extern size_t numEpollWait;
+}
+
+enum WatchMode {
+    WATCH_START_STOP,
+    WATCH_PERSISTENT
+};
+
+static size_t numConns = 10000;
+static WatchMode mode;
+static size_t numAccepted = 0;
+static size_t numAccept = 0;
+static size_t numClose = 0;
+static size_t numWakeups = 0;
+static ev_io acceptWatcher;
+static ev_io clientWatcher;
+static pid_t clientPid = -1;
+
+static void
+accept_cb(struct ev_loop *el, ev_io *w, int revents) {
+    numWakeups++;
+
+    if (mode == WATCH_START_STOP) {
+        ev_io_stop(el, w);
+    }
+
+    while (true) {
+        int fd;
+
+        numAccept++;
+        if ((fd = accept(w->fd, NULL, NULL)) < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("accept");
+                exit(1);
+            }
+
+            break;
+        }
+
+        numClose++;
+        close(fd);
+        numAccepted++;
+    }
+
+    if (numAccepted >= numConns) {
+        ev_unloop(el, EVUNLOOP_ALL);
+        return;
+    }
+
+    if (mode == WATCH_START_STOP) {
+        ev_io_init(w, accept_cb, w->fd, EV_READ);
+        ev_io_start(el, w);
+    }
+}
+
+// The client has exited; stop if it didn't manage to connect numConns
+// times (e.g. it ran out of ephemeral ports), as we'd wait forever
+static void
+client_cb(struct ev_loop *el, ev_io *w, int revents) {
+    int status;
+
+    ev_io_stop(el, w);
+
+    waitpid(clientPid, &status, 0);
+    clientPid = -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        ev_unloop(el, EVUNLOOP_ALL);
+    }
+}
+
+// Connect to the given port numConns times, closing each connection
+static void
+client(int port) {
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (size_t i = 0; i < numConns; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (fd < 0 || connect(fd, (struct sockaddr*) &sin, sizeof(sin))) {
+            perror("connect");
+            exit(1);
+        }
+
+        close(fd);
+    }
+
+    exit(0);
+}
+
+static int
+run(WatchMode m) {
+    struct sockaddr_in sin;
+    socklen_t sin_len = sizeof(sin);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int pfds[2];
+
+    mode = m;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (fd < 0 ||
+        bind(fd, (struct sockaddr*) &sin, sizeof(sin)) ||
+        listen(fd, 128) ||
+        getsockname(fd, (struct sockaddr*) &sin, &sin_len) ||
+        fcntl(fd, F_SETFL, O_NONBLOCK)) {
+        perror("listen");
+        return 1;
+    }
+
+    struct ev_loop *el = ev_loop_new(EVBACKEND_EPOLL | EVBACKEND_SELECT);
+    ev_io *w = &acceptWatcher;
+
+    ev_io_init(w, accept_cb, fd, EV_READ);
+    ev_io_start(el, w);
+
+    // The read end of this pipe sees EOF when the client exits
+    if (pipe(pfds)) {
+        perror("pipe");
+        return 1;
+    }
+
+    if ((clientPid = fork()) == 0) {
+        close(pfds[0]);
+        client(ntohs(sin.sin_port));
+    }
+
+    close(pfds[1]);
+    w = &clientWatcher;
+    ev_io_init(w, client_cb, pfds[0], EV_READ);
+    ev_io_start(el, w);
+
+    ev_loop(el, 0);
+    if (clientPid > 0) {
+        waitpid(clientPid, NULL, 0);
+    }
+
+    if (numAccepted < numConns) {
+        fprintf(
+            stderr, "client gave up after %lu connections\n",
+                (unsigned long) numAccepted
+        );
+        return 1;
+    }
+
+    double wakeups = (double) numWakeups;
+#ifdef __linux__
+    size_t total = numAccept + numClose + numEpollCtl + numEpollWait;
+    printf(
+        "%-10s %lu conns, %lu wakeups: per wakeup %.2f accept, %.2f close, "
+        "%.2f epoll_ctl, %.2f epoll_wait = %.2f syscalls\n",
+            (m == WATCH_START_STOP) ? "start/stop" : "persistent",
+            (unsigned long) numAccepted, (unsigned long) numWakeups,
+            numAccept / wakeups, numClose / wakeups,
+            numEpollCtl / wakeups, numEpollWait / wakeups, total / wakeups
+    );
+#else
+    printf(
+        "%-10s %lu conns, %lu wakeups: per wakeup %.2f accept, %.2f close "
+        "(backend calls not counted on this platform)\n",
+            (m == WATCH_START_STOP) ? "start/stop" : "persistent",
+            (unsigned long) numAccepted, (unsigned long) numWakeups,
+            numAccept / wakeups, numClose / wakeups
+    );
+#endif
+
+    return 0;
+}
+
+static void
+usage(FILE *fp, const char *name) {
+    fprintf(fp, "usage: %s [-n <conns>]\n\n", name);
+    fprintf(fp, "Count syscalls made by an accept loop per event loop wakeup.\n\n");
+    fprintf(fp, "Options:\n");
+    fprintf(fp, "  -h                help\n");
+    fprintf(fp,
+"  -n <conns>        connections to accept (default: %lu)\n",
+        (unsigned long) numConns);
+}
+
+int
+main(int argc, char **argv) {
+    static const WatchMode kModes[] = { WATCH_START_STOP, WATCH_PERSISTENT };
+    int c;
+
+    while ((c = getopt(argc, argv, "n:h")) != -1) {
+        switch (c) {
+        case 'n':
+            numConns = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    for (size_t m = 0; m < sizeof(kModes) / sizeof(kModes[0]); m++) {
+        pid_t pid;
+        int status;
+
+        fflush(stdout);
+        if ((pid = fork()) == 0) {
+            exit(run(kModes[m]));
+        }
+
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            printf("mode %lu failed\n", (unsigned long) m);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,233 @@
+// A client to measure connection latency against our event loop servers.
+//
+// Opens connections at a fixed rate and times each one from connect(2) until
+// the server closes it, then reports percentiles of those times. Unlike the
+// tcp client this doesn't care about throughput; it's for seeing how long
+// well-behaved requests wait when something else in the server misbehaves.
+
+#include <stdio.h>
+#include <errno.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ev.h>
+
+#define MAX_TICK_FREQUENCY                          500
+
+typedef struct conn_s {
+    struct ev_io c_ev_io;
+    ev_tstamp c_start;
+} conn_t;
+
+struct sockaddr_in addr;
+size_t connRate = 1000;
+size_t numConns = 10000;
+ev_tstamp drainTimeout = 10;
+size_t conns_cnt = 0;
+
+// stats
+double *latencies;
+size_t done_cnt = 0;
+size_t failed_cnt = 0;
+
+static void
+conn_watcher_cb(struct ev_loop *el, ev_io *ew, int revents) {
+    conn_t *c = (conn_t*) ew;
+    char buf[512];
+    int nbytes;
+
+    // Drain whatever the server sent; we're done once it closes
+    while ((nbytes = read(ew->fd, buf, sizeof(buf))) > 0)
+        ;
+
+    if (nbytes < 0 && errno == EAGAIN) {
+        return;
+    }
+
+    if (nbytes < 0 && errno != ECONNRESET) {
+        failed_cnt++;
+    } else {
+        latencies[done_cnt++] = ev_time() - c->c_start;
+    }
+
+    ev_io_stop(el, ew);
+    close(ew->fd);
+    free(c);
+}
+
+static void
+spawn_connection(struct ev_loop *el) {
+    conn_t *c;
+    int sock;
+    ev_tstamp start = ev_time();
+
+    if ((sock = socket(PF_INET, SOCK_STREAM, 6 /* TCP */)) < 0) {
+        failed_cnt++;
+        return;
+    }
+
+    if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0 ||
+        (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0 &&
+         errno != EINPROGRESS)) {
+        failed_cnt++;
+        close(sock);
+        return;
+    }
+
+    c = (conn_t*) malloc(sizeof(*c));
+    c->c_start = start;
+    ev_io_init(&c->c_ev_io, conn_watcher_cb, sock, EV_READ);
+    ev_io_start(el, &c->c_ev_io);
+}
+
+static void
+drain_timer_cb(struct ev_loop *el, struct ev_timer *et, int revents) {
+    ev_unloop(el, EVUNLOOP_ALL);
+}
+
+static void
+periodic_watcher_cb(struct ev_loop *el, struct ev_periodic *ep, int revents) {
+    static float conns_per_tick = 0.0f;
+    static float conns_remainder = 0.0f;
+    static struct ev_timer drain_timer;
+
+    if (conns_per_tick == 0) {
+        conns_per_tick = (connRate <= MAX_TICK_FREQUENCY) ?
+            1.0f :
+            ((float) connRate / MAX_TICK_FREQUENCY);
+    }
+
+    for (conns_remainder += conns_per_tick;
+         conns_remainder >= 1.0f && numConns > conns_cnt;
+         conns_remainder--, conns_cnt++) {
+        spawn_connection(el);
+    }
+
+    // Give stragglers a while to finish, but don't wait forever on
+    // connections that the server will never close
+    if (numConns <= conns_cnt) {
+        ev_periodic_stop(el, ep);
+
+        ev_timer_init(&drain_timer, drain_timer_cb, drainTimeout, 0);
+        ev_timer_start(el, &drain_timer);
+        ev_unref(el);
+    }
+}
+
+static int
+cmp_double(const void *a, const void *b) {
+    double da = *(const double*) a;
+    double db = *(const double*) b;
+
+    return (da < db) ? -1 : (da > db);
+}
+
+static double
+percentile(double p) {
+    size_t i = (size_t) (p * done_cnt);
+
+    return latencies[(i < done_cnt) ? i : done_cnt - 1] * 1000;
+}
+
+void
+usage(FILE *fp, char *name) {
+    fprintf(fp,
+"usage: %s [options] <host> <port>\n\n", name);
+    fprintf(fp,
+"Measure how long a server takes to close connections.\n\n");
+    fprintf(fp,
+"Options:\n");
+    fprintf(fp,
+"  -h                help\n");
+    fprintf(fp,
+"  -n <conns>        total connections to open (default: %lu)\n", numConns);
+    fprintf(fp,
+"  -r <conns>        connections to open per second (default: %lu)\n",
+connRate);
+    fprintf(fp,
+"  -t <secs>         how long to wait for connections to finish once all\n"
+"                    have been opened (default: %.0f)\n", drainTimeout);
+}
+
+int
+main(int argc, char **argv) {
+    struct ev_loop *el;
+    struct ev_periodic ep;
+    struct hostent *hent;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:r:t:h")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+
+        case 'n':
+            numConns = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            connRate = strtoul(optarg, NULL, 10);
+            break;
+
+        case 't':
+            drainTimeout = strtod(optarg, NULL);
+            break;
+
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    if ((argc - optind) != 2 || connRate == 0 || numConns == 0) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    if (!(hent = gethostbyname(argv[optind]))) {
+        fprintf(stderr, "%s: unable to resolve %s\n", argv[0], argv[optind]);
+        return 1;
+    }
+
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(strtoul(argv[optind + 1], NULL, 10));
+    memcpy(&addr.sin_addr, hent->h_addr_list[0], sizeof(addr.sin_addr));
+
+    latencies = (double*) malloc(numConns * sizeof(*latencies));
+
+    el = ev_default_loop(EVFLAG_AUTO);
+    ev_periodic_init(
+        &ep, periodic_watcher_cb, 0,
+        1.0f / MIN(connRate, MAX_TICK_FREQUENCY), NULL
+    );
+    ev_periodic_start(el, &ep);
+    ev_loop(el, 0);
+
+    qsort(latencies, done_cnt, sizeof(*latencies), cmp_double);
+
+    printf(
+        "%lu of %lu connections finished, %lu failed, %lu unfinished\n",
+            (unsigned long) done_cnt, (unsigned long) numConns,
+            (unsigned long) failed_cnt,
+            (unsigned long) (numConns - done_cnt - failed_cnt)
+    );
+
+    if (done_cnt > 0) {
+        printf(
+            "latency (ms): p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  "
+            "max %.2f\n",
+                percentile(0.5), percentile(0.9), percentile(0.99),
+                percentile(0.999), latencies[done_cnt - 1] * 1000
+        );
+    }
+
+    return 0;
+}
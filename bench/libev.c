@@ -0,0 +1,36 @@
+/*
+ * libev, built for the benchmarks in this directory, with its epoll(7) calls
+ * counted for bench/fdwatch.cc.
+ */
+
+#include <stddef.h>
+
+size_t numEpollCtl = 0;
+size_t numEpollWait = 0;
+
+#ifdef __linux__
+#include <sys/epoll.h>
+
+static int
+counted_epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev) {
+    numEpollCtl++;
+    return epoll_ctl(epfd, op, fd, ev);
+}
+
+static int
+counted_epoll_wait(int epfd, struct epoll_event *evs, int maxevs, int tmo) {
+    numEpollWait++;
+    return epoll_wait(epfd, evs, maxevs, tmo);
+}
+
+#define epoll_ctl counted_epoll_ctl
+#define epoll_wait counted_epoll_wait
+#endif
+
+#define EV_STANDALONE 1
+#define EV_USE_POLL 0
+#define EV_USE_INOTIFY 0
+#define EV_USE_EVENTFD 0
+#define EV_USE_SIGNALFD 0
+
+#include "ev.c"
@@ -0,0 +1,22 @@
+#!/bin/env bash
+
+# Measure connection latency while some requests spin in a busy loop (see
+# preemptd.js): with no CPU quota, with preemption only, and with preemption
+# and termination.
+
+DIR=$(dirname $0)
+
+for quota in 0:0 10:0 10:500; do
+    echo "CPU quota $quota ..."
+
+    $DIR/../build/corona -c $quota $DIR/preemptd.js &
+    serverPid=$!
+    sleep 1
+
+    $DIR/../build/latency -n 10000 -r 1000 -t 5 localhost 4000 || \
+        echo "latency exit status $?"
+
+    kill $serverPid
+    wait $serverPid 2>/dev/null
+    echo
+done
@@ -0,0 +1,44 @@
+// Like tcpd.js, but every BUSY_EVERY'th connection spins for BUSY_MS
+// milliseconds before being closed, as a request stuck in a loop would. Run
+// under 'corona -c' to see how well everyone else is shielded from it; see
+// preempt.sh.
+var BUSY_EVERY = 1000;
+var BUSY_MS = 2000;
+
+var fd = sys.socket(sys.AF_INET, sys.SOCK_STREAM, sys.PROTO_TCP);
+if (fd < 0) {
+    throw new Error('socket');
+}
+
+var err = sys.setsockopt(fd, sys.SOL_SOCKET, sys.SO_REUSEPORT, 1);
+if (err < 0) {
+    throw new Error('setsockopt');
+}
+
+err = sys.bind(fd, 4000);
+if (err < 0) {
+    throw new Error('bind');
+}
+
+err = sys.listen(fd, 1024);
+if (err < 0) {
+    throw new Error('listen');
+}
+
+err = sys.fcntl(fd, sys.F_SETFL, sys.O_NONBLOCK);
+if (err < 0) {
+    throw new Error('fcntl');
+}
+
+var i = 0;
+var err = sys.accept(fd, function(fd2) {
+    if (++i % BUSY_EVERY == 0) {
+        // Termination (see 'corona -c') leaves fd2 open, so the client
+        // reports it as unfinished
+        var end = Date.now() + BUSY_MS;
+        while (Date.now() < end) {
+        }
+    }
+
+    sys.close(fd2);
+});
@@ -0,0 +1,202 @@
+// Microbenchmark for the scheduler's run queue.
+//
+// Compares the cost of scheduling and popping runnable threads using the
+// intrusive Queue from src/queue.h against the std::list<CoronaThread*> that
+// the scheduler used to use. Each round schedules every thread, then pops
+// them all off again, mimicking a burst of ReadyCB() calls drained by
+// PopRunnableThread(). The "stamped" runs also time how long each thread
+// waited, as the scheduler does for sys.schedstats(), reading the clock
+// either on every push and pop or only once per pop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <time.h>
+#include <list>
+#include "../src/queue.h"
+
+// Stand-in for CoronaThread; only the linkage matters here
+struct FakeThread {
+    QueueLink<FakeThread> ft_link_;
+    double ft_runnable_since_;
+    char ft_pad_[120];
+};
+
+typedef Queue<FakeThread, &FakeThread::ft_link_> FakeThreadQueue;
+
+static size_t numThreads = 100000;
+static size_t numRounds = 100;
+
+static double
+now(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double
+bench_list(FakeThread *threads) {
+    std::list<FakeThread*> runq;
+    size_t popped = 0;
+    double start = now();
+
+    for (size_t r = 0; r < numRounds; r++) {
+        for (size_t i = 0; i < numThreads; i++) {
+            runq.push_back(&threads[i]);
+        }
+
+        while (!runq.empty()) {
+            runq.pop_front();
+            popped++;
+        }
+    }
+
+    double elapsed = now() - start;
+    if (popped != numThreads * numRounds) {
+        fprintf(stderr, "list: popped %lu threads\n", (unsigned long) popped);
+        exit(1);
+    }
+
+    return elapsed;
+}
+
+static double
+bench_queue(FakeThread *threads, bool dup) {
+    FakeThreadQueue runq;
+    size_t popped = 0;
+    double start = now();
+
+    for (size_t r = 0; r < numRounds; r++) {
+        for (size_t i = 0; i < numThreads; i++) {
+            runq.PushBack(&threads[i]);
+
+            // Simulate libev firing ReadyCB() twice for the same thread
+            if (dup) {
+                runq.PushBack(&threads[i]);
+            }
+        }
+
+        while (runq.PopFront()) {
+            popped++;
+        }
+    }
+
+    double elapsed = now() - start;
+    if (popped != numThreads * numRounds) {
+        fprintf(stderr, "queue: popped %lu threads\n", (unsigned long) popped);
+        exit(1);
+    }
+
+    return elapsed;
+}
+
+// What ev_time() does
+static double
+clock_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double
+bench_stamped(FakeThread *threads, bool clock_per_push) {
+    FakeThreadQueue runq;
+    FakeThread *ft;
+    size_t popped = 0;
+    double waited = 0;
+    double start = now();
+
+    for (size_t r = 0; r < numRounds; r++) {
+        // Pushed from the event loop, whose idea of the time is free
+        double loop_now = clock_now();
+
+        for (size_t i = 0; i < numThreads; i++) {
+            runq.PushBack(&threads[i]);
+            threads[i].ft_runnable_since_ =
+                (clock_per_push) ? clock_now() : loop_now;
+        }
+
+        while ((ft = runq.PopFront())) {
+            waited += clock_now() - ft->ft_runnable_since_;
+            popped++;
+        }
+    }
+
+    double elapsed = now() - start;
+    if (popped != numThreads * numRounds || waited < 0) {
+        fprintf(stderr, "stamped: popped %lu threads\n",
+                (unsigned long) popped);
+        exit(1);
+    }
+
+    return elapsed;
+}
+
+static void
+report(const char *name, double elapsed) {
+    double ops = (double) numThreads * numRounds;
+
+    printf(
+        "%-24s %8.3f s  %7.2f ns/schedule+pop\n",
+            name, elapsed, (elapsed * 1e9) / ops
+    );
+}
+
+static void
+usage(FILE *fp, const char *name) {
+    fprintf(fp, "usage: %s [-n <threads>] [-r <rounds>]\n\n", name);
+    fprintf(fp, "Benchmark the scheduler run queue.\n\n");
+    fprintf(fp, "Options:\n");
+    fprintf(fp, "  -h                help\n");
+    fprintf(fp,
+"  -n <threads>      runnable threads per round (default: %lu)\n",
+        (unsigned long) numThreads);
+    fprintf(fp,
+"  -r <rounds>       rounds to run (default: %lu)\n",
+        (unsigned long) numRounds);
+}
+
+int
+main(int argc, char **argv) {
+    int c;
+
+    while ((c = getopt(argc, argv, "n:r:h")) != -1) {
+        switch (c) {
+        case 'n':
+            numThreads = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            numRounds = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    FakeThread *threads = new FakeThread[numThreads];
+
+    printf(
+        "%lu runnable threads, %lu rounds\n",
+            (unsigned long) numThreads, (unsigned long) numRounds
+    );
+
+    report("std::list", bench_list(threads));
+    report("Queue", bench_queue(threads, false));
+    report("Queue (double ReadyCB)", bench_queue(threads, true));
+    report("Queue, stamped per push", bench_stamped(threads, true));
+    report("Queue, stamped per pop", bench_stamped(threads, false));
+
+    delete[] threads;
+
+    return 0;
+}
@@ -0,0 +1,216 @@
+// Measure resident memory for parked coroutines.
+//
+// Creates N coroutines whose stacks come either from malloc() (as
+// platform-sigstack.cc does) or from a MAP_NORESERVE mmap() with a PROT_NONE
+// guard page (as platform-sigstack-linux.cc does). Each coroutine touches a
+// few KB of its stack, as a coroutine parked in YieldIO() would have, and
+// then switches back to main() and stays parked. We then report the growth
+// in RSS.
+//
+// Each configuration runs in its own child process so that the numbers
+// don't pollute each other.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "coro.h"
+
+#ifndef MAP_STACK
+#define MAP_STACK 0
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+enum StackMode {
+    STACK_MALLOC,
+    STACK_MMAP
+};
+
+struct Coro {
+    coro_context c_ctx;
+    void *c_stack;
+};
+
+static const size_t kStackSize = 128 * 1024;
+
+static size_t touchBytes = 8 * 1024;
+static coro_context mainCtx;
+
+// Resident set size of this process, in bytes
+static size_t
+rss(void) {
+    size_t pages = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp) {
+        size_t vsz;
+
+        if (fscanf(fp, "%lu %lu", &vsz, &pages) != 2) {
+            pages = 0;
+        }
+        fclose(fp);
+
+        return pages * getpagesize();
+    }
+
+    // No procfs; fall back to the high-water mark, which is good enough
+    // since we only ever grow
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return ru.ru_maxrss;
+#else
+    return ru.ru_maxrss * 1024;
+#endif
+}
+
+static void *
+stack_alloc(StackMode mode) {
+    if (mode == STACK_MALLOC) {
+        return malloc(kStackSize);
+    }
+
+    const size_t page_size = getpagesize();
+    char *m = (char*) mmap(
+        NULL, kStackSize + page_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0
+    );
+
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (mprotect(m, page_size, PROT_NONE)) {
+        munmap(m, kStackSize + page_size);
+        return NULL;
+    }
+
+    return m + page_size;
+}
+
+static void
+coro_entry(void *arg) {
+    Coro *co = (Coro*) arg;
+    volatile char *buf = (volatile char*) alloca(touchBytes);
+
+    for (size_t i = 0; i < touchBytes; i += 64) {
+        buf[i] = 1;
+    }
+
+    // Park forever
+    coro_transfer(&co->c_ctx, &mainCtx);
+    abort();
+}
+
+static int
+run(StackMode mode, size_t n) {
+    Coro *coros = (Coro*) calloc(n, sizeof(*coros));
+    size_t before = rss();
+
+    for (size_t i = 0; i < n; i++) {
+        if (!(coros[i].c_stack = stack_alloc(mode))) {
+            printf(
+                "%-7s %7lu coroutines: stack allocation failed after %lu: %s\n",
+                    (mode == STACK_MALLOC) ? "malloc" : "mmap",
+                    (unsigned long) n, (unsigned long) i, strerror(errno)
+            );
+            return 1;
+        }
+
+        coro_create(
+            &coros[i].c_ctx, coro_entry, &coros[i], coros[i].c_stack,
+            kStackSize
+        );
+        coro_transfer(&mainCtx, &coros[i].c_ctx);
+    }
+
+    size_t after = rss();
+
+    printf(
+        "%-7s %7lu coroutines: %9.1f MB RSS, %6.1f KB/coroutine\n",
+            (mode == STACK_MALLOC) ? "malloc" : "mmap",
+            (unsigned long) n,
+            (after - before) / (1024.0 * 1024.0),
+            (after - before) / (1024.0 * n)
+    );
+
+    return 0;
+}
+
+static void
+usage(FILE *fp, const char *name) {
+    fprintf(fp, "usage: %s [-t <bytes>] [<count> ...]\n\n", name);
+    fprintf(fp, "Measure RSS of parked coroutines (default counts: 10000 100000).\n\n");
+    fprintf(fp, "Options:\n");
+    fprintf(fp, "  -h                help\n");
+    fprintf(fp,
+"  -t <bytes>        stack bytes touched by each coroutine (default: %lu)\n",
+        (unsigned long) touchBytes);
+}
+
+int
+main(int argc, char **argv) {
+    static const size_t kDefaultCounts[] = { 10000, 100000 };
+    static const StackMode kModes[] = { STACK_MALLOC, STACK_MMAP };
+    int c;
+
+    while ((c = getopt(argc, argv, "t:h")) != -1) {
+        switch (c) {
+        case 't':
+            touchBytes = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    size_t ncounts = (optind < argc) ?
+        (size_t) (argc - optind) :
+        sizeof(kDefaultCounts) / sizeof(kDefaultCounts[0]);
+
+    printf(
+        "%lu KB stacks, %lu bytes touched per coroutine\n",
+            (unsigned long) kStackSize / 1024, (unsigned long) touchBytes
+    );
+
+    for (size_t i = 0; i < ncounts; i++) {
+        size_t n = (optind < argc) ?
+            strtoul(argv[optind + i], NULL, 10) :
+            kDefaultCounts[i];
+
+        for (size_t m = 0; m < sizeof(kModes) / sizeof(kModes[0]); m++) {
+            pid_t pid;
+            int status;
+
+            fflush(stdout);
+            if ((pid = fork()) == 0) {
+                exit(run(kModes[m], n));
+            }
+
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status)) {
+                printf(
+                    "%-7s %7lu coroutines: child died (signal %d)\n",
+                        (kModes[m] == STACK_MALLOC) ? "malloc" : "mmap",
+                        (unsigned long) n, WTERMSIG(status)
+                );
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+// Microbenchmark for connection deadlines.
+//
+// Arms N timers with deadlines spread over the next minute, re-arms each of
+// them a few times (as an idle timeout would be on every read), cancels 99%
+// of them (as when requests complete before their deadline) and then runs
+// time forwards until the rest have fired. This is done with the TimerWheel
+// from src/timerwheel.h and with libev's heap-based ev_timer, which is what
+// each coroutine used to arm directly.
+//
+// libev can only fire timers in real time, so for it we only measure arming,
+// re-arming and cancelling.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "ev.h"
+#include "../src/timerwheel.h"
+
+static size_t numTimers = 1000000;
+static size_t numRearms = 3;
+static double cancelRate = 0.99;
+static uint64_t maxTicks = 60000;
+
+static size_t numFired = 0;
+
+static double
+now(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+fire_cb(WheelTimer *wt) {
+    numFired++;
+}
+
+static void
+expire_cb(struct ev_loop *el, ev_timer *w, int revents) {
+    numFired++;
+}
+
+static void
+report(const char *name, const char *phase, double elapsed, size_t ops) {
+    printf(
+        "%-10s %-8s %8.3f s  %7.2f ns/op\n",
+            name, phase, elapsed, (elapsed * 1e9) / ops
+    );
+}
+
+static void
+bench_wheel(const uint64_t *expiry, const bool *cancel) {
+    WheelTimer *timers = new WheelTimer[numTimers];
+    TimerWheel wheel;
+    size_t cancelled = 0;
+    double start;
+
+    start = now();
+    for (size_t i = 0; i < numTimers; i++) {
+        timers[i].wt_cb_ = fire_cb;
+        wheel.Add(&timers[i], expiry[i]);
+    }
+    report("TimerWheel", "arm", now() - start, numTimers);
+
+    start = now();
+    for (size_t r = 0; r < numRearms; r++) {
+        for (size_t i = 0; i < numTimers; i++) {
+            wheel.Add(&timers[i], expiry[i] + r + 1);
+        }
+    }
+    report("TimerWheel", "re-arm", now() - start, numTimers * numRearms);
+
+    start = now();
+    for (size_t i = 0; i < numTimers; i++) {
+        if (cancel[i]) {
+            wheel.Remove(&timers[i]);
+            cancelled++;
+        }
+    }
+    report("TimerWheel", "cancel", now() - start, cancelled);
+
+    // Wake up at each NextExpiry() as the scheduler's libev timer does,
+    // rather than jumping straight to the end
+    size_t wakeups = 0;
+    numFired = 0;
+    start = now();
+    while (wheel.Size() > 0) {
+        wheel.Advance(wheel.NextExpiry());
+        wakeups++;
+    }
+    double elapsed = now() - start;
+
+    if (numFired != numTimers - cancelled) {
+        fprintf(
+            stderr, "wheel: fired %lu of %lu timers\n",
+                (unsigned long) numFired,
+                (unsigned long) (numTimers - cancelled)
+        );
+        exit(1);
+    }
+
+    report("TimerWheel", "fire", elapsed, numFired);
+    printf(
+        "%-10s %lu driver wakeups over %lu ticks\n",
+            "TimerWheel", (unsigned long) wakeups,
+            (unsigned long) wheel.Now()
+    );
+
+    delete[] timers;
+}
+
+static void
+bench_libev(const uint64_t *expiry, const bool *cancel) {
+    struct ev_loop *el = ev_loop_new(EVFLAG_AUTO);
+    ev_timer *timers = new ev_timer[numTimers];
+    size_t cancelled = 0;
+    double start;
+
+    start = now();
+    for (size_t i = 0; i < numTimers; i++) {
+        ev_timer *w = &timers[i];
+
+        ev_timer_init(w, expire_cb, expiry[i] / 1000.0, 0);
+        ev_timer_start(el, w);
+    }
+    report("ev_timer", "arm", now() - start, numTimers);
+
+    start = now();
+    for (size_t r = 0; r < numRearms; r++) {
+        for (size_t i = 0; i < numTimers; i++) {
+            ev_timer *w = &timers[i];
+
+            w->repeat = (expiry[i] + r + 1) / 1000.0;
+            ev_timer_again(el, w);
+        }
+    }
+    report("ev_timer", "re-arm", now() - start, numTimers * numRearms);
+
+    start = now();
+    for (size_t i = 0; i < numTimers; i++) {
+        if (cancel[i]) {
+            ev_timer_stop(el, &timers[i]);
+            cancelled++;
+        }
+    }
+    report("ev_timer", "cancel", now() - start, cancelled);
+
+    for (size_t i = 0; i < numTimers; i++) {
+        ev_timer_stop(el, &timers[i]);
+    }
+
+    delete[] timers;
+    ev_loop_destroy(el);
+}
+
+static void
+usage(FILE *fp, const char *name) {
+    fprintf(fp, "usage: %s [-n <timers>] [-r <rearms>] [-c <rate>]\n\n", name);
+    fprintf(fp, "Benchmark arming, re-arming, cancelling and firing timers.\n\n");
+    fprintf(fp, "Options:\n");
+    fprintf(fp, "  -h                help\n");
+    fprintf(fp,
+"  -n <timers>       timers to arm (default: %lu)\n",
+        (unsigned long) numTimers);
+    fprintf(fp,
+"  -r <rearms>       times to re-arm each timer (default: %lu)\n",
+        (unsigned long) numRearms);
+    fprintf(fp,
+"  -c <rate>         fraction of timers to cancel (default: %.2f)\n",
+        cancelRate);
+}
+
+int
+main(int argc, char **argv) {
+    int c;
+
+    while ((c = getopt(argc, argv, "c:n:r:h")) != -1) {
+        switch (c) {
+        case 'c':
+            cancelRate = strtod(optarg, NULL);
+            break;
+
+        case 'n':
+            numTimers = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            numRearms = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    // Use the same deadlines and cancellations for both
+    uint64_t *expiry = new uint64_t[numTimers];
+    bool *cancel = new bool[numTimers];
+
+    srandom(0);
+    for (size_t i = 0; i < numTimers; i++) {
+        expiry[i] = 1 + random() % maxTicks;
+        cancel[i] = (random() % 10000) < cancelRate * 10000;
+    }
+
+    printf(
+        "%lu timers over %lu ms, %lu re-arms each, %.0f%% cancelled\n",
+            (unsigned long) numTimers, (unsigned long) maxTicks,
+            (unsigned long) numRearms, cancelRate * 100
+    );
+
+    bench_wheel(expiry, cancel);
+    bench_libev(expiry, cancel);
+
+    delete[] expiry;
+    delete[] cancel;
+
+    return 0;
+}
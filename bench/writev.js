@@ -0,0 +1,96 @@
+// HTTP-style responses (a status line, some headers and a body) written
+// over a loopback connection, joined into one string for write() versus
+// passed to writev() as they are, with the body as a string and as a
+// Buffer. A spawned coroutine reads and discards everything. Run with
+// 'build/corona bench/writev.js'.
+var PORT = 4001;
+var BODY_SIZES = [1024, 65536, 1048576];
+var BYTES_PER_RUN = 256 * 1048576;
+
+var STATUS = 'HTTP/1.1 200 OK\r\n';
+var HEADERS = 'Content-Type: application/octet-stream\r\n' +
+    'Connection: keep-alive\r\n';
+
+var lfd = sys.socket(sys.AF_INET, sys.SOCK_STREAM, sys.PROTO_TCP);
+if (lfd < 0 ||
+    sys.setsockopt(lfd, sys.SOL_SOCKET, sys.SO_REUSEADDR, 1) < 0 ||
+    sys.bind(lfd, PORT, '127.0.0.1') < 0 ||
+    sys.listen(lfd, 1) < 0 ||
+    sys.fcntl(lfd, sys.F_SETFL, sys.O_NONBLOCK) < 0) {
+    throw new Error('listen');
+}
+
+var reader = sys.spawn(function() {
+    var fd = sys.accept(lfd);
+    var buf = new sys.Buffer(65536);
+    var total = 0;
+    var n;
+
+    if (fd < 0) {
+        throw new Error('accept');
+    }
+
+    while ((n = sys.read(fd, buf)) > 0) {
+        total += n;
+    }
+
+    sys.close(fd);
+    return total;
+});
+
+var fd = sys.socket(sys.AF_INET, sys.SOCK_STREAM, sys.PROTO_TCP);
+if (fd < 0 ||
+    sys.fcntl(fd, sys.F_SETFL, sys.O_NONBLOCK) < 0 ||
+    sys.connect(fd, PORT, '127.0.0.1') < 0) {
+    throw new Error('connect');
+}
+
+var written = 0;
+
+function run(name, size, respond) {
+    var count = Math.max(1, Math.floor(BYTES_PER_RUN / size));
+    var start = Date.now();
+
+    for (var i = 0; i < count; i++) {
+        var n = respond();
+        if (n < 0) {
+            throw new Error(name + ': errno ' + sys.errno);
+        }
+
+        written += n;
+    }
+
+    var secs = (Date.now() - start) / 1000;
+    console.log(
+        '  ' + name + ': ' + count + ' responses in ' + secs.toFixed(2) +
+            's, ' + Math.round(count / secs) + '/sec, ' +
+            (count * size / 1048576 / secs).toFixed(1) + ' MB/s of body'
+    );
+}
+
+BODY_SIZES.forEach(function(size) {
+    var body = new Array(size + 1).join('x');
+    var bodyBuf = new sys.Buffer(body);
+    var headers = HEADERS + 'Content-Length: ' + size + '\r\n\r\n';
+
+    console.log('body of ' + size + ' bytes ...');
+
+    run('concat + write', size, function() {
+        return sys.write(fd, STATUS + headers + body);
+    });
+
+    run('writev (string body)', size, function() {
+        return sys.writev(fd, [STATUS, headers, body]);
+    });
+
+    run('writev (Buffer body)', size, function() {
+        return sys.writev(fd, [STATUS, headers, bodyBuf]);
+    });
+});
+
+sys.close(fd);
+
+var read = reader.join();
+if (read != written) {
+    throw new Error('wrote ' + written + ' bytes, but read ' + read);
+}
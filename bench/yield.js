@@ -0,0 +1,100 @@
+// Coroutine switches per second: a token passed around rings of coroutines
+// over unbuffered channels (each hop switches straight to the next
+// coroutine) and over buffered ones (each hop goes through the run queue),
+// and a crowd of coroutines that keep calling sys.sleep(0). Every switch
+// hands V8's thread state over from one coroutine to the next, so that's
+// most of what this measures; see yield.sh. Run with
+// 'build/corona bench/yield.js'.
+var HOPS = 1000000;
+var RING_SIZES = [2, 100, 1000];
+var CAPACITIES = [0, 1];
+var SLEEPERS = 1000;
+var SLEEPS = 1000;
+
+function report(what, switches, start) {
+    var secs = (Date.now() - start) / 1000;
+
+    console.log(
+        what + ': ' + switches + ' switches in ' + secs.toFixed(2) + 's, ' +
+            Math.round(switches / secs) + '/sec'
+    );
+}
+
+// Each of 'size' coroutines (this one included) receives the token from
+// the one before it, adds one, and sends it on to the next
+function ring(size, capacity) {
+    var rounds = Math.floor(HOPS / size);
+    var chans = [];
+    var tasks = [];
+    var i;
+
+    for (i = 0; i < size; i++) {
+        chans.push(sys.channel(capacity));
+    }
+
+    for (i = 1; i < size; i++) {
+        tasks.push(sys.spawn(function(from, to) {
+            var token;
+
+            while ((token = from.recv()) !== undefined) {
+                if (to.send(token + 1) < 0) {
+                    throw new Error('send');
+                }
+            }
+
+            to.close();
+        }, chans[i - 1], chans[i]));
+    }
+
+    var start = Date.now();
+    var token = 0;
+
+    for (i = 0; i < rounds; i++) {
+        if (chans[0].send(token + 1) < 0) {
+            throw new Error('send');
+        }
+
+        token = chans[size - 1].recv();
+    }
+
+    report(
+        'ring of ' + size + ', capacity ' + capacity, rounds * size, start
+    );
+
+    // Closing our end closes the rest of them in turn
+    chans[0].close();
+    if (chans[size - 1].recv() !== undefined) {
+        throw new Error('ring not closed');
+    }
+
+    tasks.forEach(function(t) {
+        t.join();
+    });
+
+    if (token != rounds * size) {
+        throw new Error('token is ' + token + ', not ' + rounds * size);
+    }
+}
+
+RING_SIZES.forEach(function(size) {
+    CAPACITIES.forEach(function(capacity) {
+        ring(size, capacity);
+    });
+});
+
+// Coroutines sleeping for 0ms are woken together on each tick of the timer
+// wheel, so this is switches between many coroutines in a row rather than
+// between a few
+var start = Date.now();
+
+sys.nursery(function(n) {
+    for (var i = 0; i < SLEEPERS; i++) {
+        n.spawn(function() {
+            for (var j = 0; j < SLEEPS; j++) {
+                sys.sleep(0);
+            }
+        });
+    }
+});
+
+report(SLEEPERS + ' coroutines sleeping', SLEEPERS * SLEEPS, start);
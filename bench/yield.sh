@@ -0,0 +1,39 @@
+#!/bin/env bash
+
+# Compare coroutine switches per second (see yield.js) with and without the
+# cheaper handoff of V8's thread state between coroutines. The change to V8
+# that made it cheaper is backed out of a copy of the committed tree under
+# build/yield-base, which is built with its own V8; this tree is built as
+# usual. Set CORO to pick the context switch for both, as with make.
+
+DIR=$(cd $(dirname $0)/.. && pwd -P)
+BASE=$DIR/build/yield-base
+CORO=${CORO:-sjlj}
+
+# The change is the one that introduced V8_COROUTINE_THREADS
+CHANGE=$(cd $DIR && git log -n 1 --format=%H -S V8_COROUTINE_THREADS \
+    -- deps/v8-*/SConstruct)
+if [[ -z $CHANGE ]]; then
+    echo "can't find the thread-state handoff change" >&2
+    exit 1
+fi
+
+if [[ ! -d $BASE ]]; then
+    mkdir -p $BASE
+    (cd $DIR && git archive HEAD) | tar -x -C $BASE && \
+        (cd $DIR && git diff $CHANGE^ $CHANGE -- deps) | \
+            (cd $BASE && git apply -R) || {
+        rm -rf $BASE
+        exit 1
+    }
+fi
+
+make -C $BASE CORO=$CORO build/corona >/dev/null || exit 1
+make -C $DIR CORO=$CORO build/corona >/dev/null || exit 1
+
+echo "Without the cheaper handoff ($BASE) ..."
+$BASE/build/corona $DIR/bench/yield.js || echo "corona exit status $?"
+
+echo
+echo "With it ..."
+$DIR/build/corona $DIR/bench/yield.js || echo "corona exit status $?"
@@ -67,20 +67,20 @@ namespace v8 {
 
 
 #define EXCEPTION_PREAMBLE()                                      \
-  thread_local.IncrementCallDepth();                              \
+  thread_local->IncrementCallDepth();                             \
   ASSERT(!i::Top::external_caught_exception());                   \
   bool has_pending_exception = false
 
 
 #define EXCEPTION_BAILOUT_CHECK(value)                                         \
   do {                                                                         \
-    thread_local.DecrementCallDepth();                                         \
+    thread_local->DecrementCallDepth();                                        \
     if (has_pending_exception) {                                               \
-      if (thread_local.CallDepthIsZero() && i::Top::is_out_of_memory()) {      \
-        if (!thread_local.ignore_out_of_memory())                              \
+      if (thread_local->CallDepthIsZero() && i::Top::is_out_of_memory()) {     \
+        if (!thread_local->ignore_out_of_memory())                             \
           i::V8::FatalProcessOutOfMemory(NULL);                                \
       }                                                                        \
-      bool call_depth_is_zero = thread_local.CallDepthIsZero();                \
+      bool call_depth_is_zero = thread_local->CallDepthIsZero();               \
       i::Top::OptionalRescheduleException(call_depth_is_zero);                 \
       return value;                                                            \
     }                                                                          \
@@ -99,7 +99,14 @@ namespace v8 {
 // --- D a t a   t h a t   i s   s p e c i f i c   t o   a   t h r e a d ---
 
 
-static i::HandleScopeImplementer thread_local;
+// The handle scope implementer of the thread that holds the V8 lock.
+// Archiving a thread stashes this pointer in its ThreadState and installs a
+// blank implementer instead of copying the object out and back in; see
+// HandleScopeImplementer::ArchiveThread().  The spare is a blank implementer
+// kept around so that switching threads does not allocate.
+static i::HandleScopeImplementer* thread_local =
+    new i::HandleScopeImplementer();
+static i::HandleScopeImplementer* spare_thread_local = NULL;
 
 
 // --- E x c e p t i o n   B e h a v i o r ---
@@ -482,23 +489,23 @@ void Context::Enter() {
   if (IsDeadCheck("v8::Context::Enter()")) return;
   ENTER_V8;
   i::Handle<i::Context> env = Utils::OpenHandle(this);
-  thread_local.EnterContext(env);
+  thread_local->EnterContext(env);
 
-  thread_local.SaveContext(i::Top::context());
+  thread_local->SaveContext(i::Top::context());
   i::Top::set_context(*env);
 }
 
 
 void Context::Exit() {
   if (!i::V8::IsRunning()) return;
-  if (!ApiCheck(thread_local.LeaveLastContext(),
+  if (!ApiCheck(thread_local->LeaveLastContext(),
                 "v8::Context::Exit()",
                 "Cannot exit non-entered context")) {
     return;
   }
 
   // Content of 'last_context' could be NULL.
-  i::Context* last_context = thread_local.RestoreContext();
+  i::Context* last_context = thread_local->RestoreContext();
   i::Top::set_context(last_context);
 }
 
@@ -3346,7 +3353,7 @@ bool Context::InContext() {
 
 v8::Local<v8::Context> Context::GetEntered() {
   if (IsDeadCheck("v8::Context::GetEntered()")) return Local<Context>();
-  i::Handle<i::Object> last = thread_local.LastEnteredContext();
+  i::Handle<i::Object> last = thread_local->LastEnteredContext();
   if (last.is_null()) return Local<Context>();
   i::Handle<i::Context> context = i::Handle<i::Context>::cast(last);
   return Utils::ToLocal(context);
@@ -3779,7 +3786,7 @@ Local<Integer> Integer::NewFromUnsigned(uint32_t value) {
 
 
 void V8::IgnoreOutOfMemoryException() {
-  thread_local.set_ignore_out_of_memory(true);
+  thread_local->set_ignore_out_of_memory(true);
 }
 
 
@@ -4779,29 +4786,31 @@ namespace internal {
 
 
 HandleScopeImplementer* HandleScopeImplementer::instance() {
-  return &thread_local;
+  return thread_local;
 }
 
 
 void HandleScopeImplementer::FreeThreadResources() {
-  thread_local.Free();
+  thread_local->Free();
 }
 
 
 char* HandleScopeImplementer::ArchiveThread(char* storage) {
-  return thread_local.ArchiveThreadHelper(storage);
-}
-
-
-char* HandleScopeImplementer::ArchiveThreadHelper(char* storage) {
   v8::ImplementationUtilities::HandleScopeData* current =
       v8::ImplementationUtilities::CurrentHandleScope();
-  handle_scope_data_ = *current;
-  memcpy(storage, this, sizeof(*this));
-
-  ResetAfterArchive();
+  thread_local->handle_scope_data_ = *current;
   current->Initialize();
 
+  // The archived thread keeps its implementer; hand the next thread a blank
+  // one.
+  *reinterpret_cast<HandleScopeImplementer**>(storage) = thread_local;
+  if (spare_thread_local != NULL) {
+    thread_local = spare_thread_local;
+    spare_thread_local = NULL;
+  } else {
+    thread_local = new HandleScopeImplementer();
+  }
+
   return storage + ArchiveSpacePerThread();
 }
 
@@ -4812,13 +4821,22 @@ int HandleScopeImplementer::ArchiveSpacePerThread() {
 
 
 char* HandleScopeImplementer::RestoreThread(char* storage) {
-  return thread_local.RestoreThreadHelper(storage);
-}
-
+  // Whatever is installed now was handed out blank by ArchiveThread() and
+  // has either not been used or been released by FreeThreadResources().
+  ASSERT(thread_local->blocks_.is_empty());
+  ASSERT(thread_local->entered_contexts_.is_empty());
+  ASSERT(thread_local->saved_contexts_.is_empty());
+  thread_local->Free();
+  thread_local->ignore_out_of_memory_ = false;
+  if (spare_thread_local == NULL) {
+    spare_thread_local = thread_local;
+  } else {
+    delete thread_local;
+  }
 
-char* HandleScopeImplementer::RestoreThreadHelper(char* storage) {
-  memcpy(this, storage, sizeof(*this));
-  *v8::ImplementationUtilities::CurrentHandleScope() = handle_scope_data_;
+  thread_local = *reinterpret_cast<HandleScopeImplementer**>(storage);
+  *v8::ImplementationUtilities::CurrentHandleScope() =
+      thread_local->handle_scope_data_;
   return storage + ArchiveSpacePerThread();
 }
 
@@ -4845,15 +4863,15 @@ void HandleScopeImplementer::IterateThis(ObjectVisitor* v) {
 void HandleScopeImplementer::Iterate(ObjectVisitor* v) {
   v8::ImplementationUtilities::HandleScopeData* current =
       v8::ImplementationUtilities::CurrentHandleScope();
-  thread_local.handle_scope_data_ = *current;
-  thread_local.IterateThis(v);
+  thread_local->handle_scope_data_ = *current;
+  thread_local->IterateThis(v);
 }
 
 
 char* HandleScopeImplementer::Iterate(ObjectVisitor* v, char* storage) {
-  HandleScopeImplementer* thread_local =
-      reinterpret_cast<HandleScopeImplementer*>(storage);
-  thread_local->IterateThis(v);
+  HandleScopeImplementer* archived =
+      *reinterpret_cast<HandleScopeImplementer**>(storage);
+  archived->IterateThis(v);
   return storage + ArchiveSpacePerThread();
 }
 
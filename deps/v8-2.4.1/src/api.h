@@ -371,15 +371,6 @@ class HandleScopeImplementer {
   }
 
  private:
-  void ResetAfterArchive() {
-    blocks_.Initialize(0);
-    entered_contexts_.Initialize(0);
-    saved_contexts_.Initialize(0);
-    spare_ = NULL;
-    ignore_out_of_memory_ = false;
-    call_depth_ = 0;
-  }
-
   void Free() {
     ASSERT(blocks_.length() == 0);
     ASSERT(entered_contexts_.length() == 0);
@@ -406,8 +397,6 @@ class HandleScopeImplementer {
   v8::ImplementationUtilities::HandleScopeData handle_scope_data_;
 
   void IterateThis(ObjectVisitor* v);
-  char* RestoreThreadHelper(char* from);
-  char* ArchiveThreadHelper(char* to);
 
   DISALLOW_COPY_AND_ASSIGN(HandleScopeImplementer);
 };
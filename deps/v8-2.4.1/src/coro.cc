@@ -112,11 +112,22 @@ trampoline (int sig)
 
 # if CORO_ASM
 
+/* Mach-O prefixes C symbols with an underscore and has no .type directive */
+#  if __APPLE__
+#   define CORO_ASM_SYMBOL "_coro_transfer"
+#   define CORO_ASM_TYPE ""
+#  else
+#   define CORO_ASM_SYMBOL "coro_transfer"
+#   define CORO_ASM_TYPE ".type coro_transfer, @function\n"
+#  endif
+
+  /* only the callee-saved registers of the SysV ABI need saving here; the
+   * compiler has already spilled everything else around the call */
   asm (
        ".text\n"
-       ".globl coro_transfer\n"
-       ".type coro_transfer, @function\n"
-       "coro_transfer:\n"
+       ".globl " CORO_ASM_SYMBOL "\n"
+       CORO_ASM_TYPE
+       CORO_ASM_SYMBOL ":\n"
        /* windows, of course, gives a shit on the amd64 ABI and uses different registers */
        /* http://blogs.msdn.com/freik/archive/2005/03/17/398200.aspx */
        #if __amd64
@@ -145,6 +156,12 @@ trampoline (int sig)
          "\tpop  %r12\n"
          "\tpop  %rbx\n"
          "\tpop  %rbp\n"
+         /* return with an indirect jump rather than "ret": every switch
+          * returns somewhere other than where the return stack buffer
+          * predicts, and the resulting mispredicts cost more than the
+          * rest of the switch combined */
+         "\tpop  %rcx\n"
+         "\tjmp  *%rcx\n"
        #elif __i386
          #define NUM_SAVED 4
          "\tpush %ebp\n"
@@ -167,10 +184,10 @@ trampoline (int sig)
          "\tpop  %esi\n"
          "\tpop  %ebx\n"
          "\tpop  %ebp\n"
+         "\tret\n"
        #else
          #error unsupported architecture
        #endif
-       "\tret\n"
   );
 
 # endif
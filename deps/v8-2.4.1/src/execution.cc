@@ -272,6 +272,20 @@ void StackGuard::Preempt() {
 }
 
 
+#ifdef V8_COROUTINE_THREADS
+void StackGuard::RequestInterruptCheck() {
+  // We may have interrupted one of the methods here in the middle of
+  // updating thread_local_, so take no lock and leave the flags alone. Each
+  // store is a single word; at worst the interrupted method overwrites one
+  // and the request is lost.
+  if (thread_local_.postpone_interrupts_nesting_ > 0) return;
+  thread_local_.jslimit_ = kInterruptLimit;
+  thread_local_.climit_ = kInterruptLimit;
+  Heap::SetStackLimits();
+}
+#endif
+
+
 bool StackGuard::IsTerminateExecution() {
   ExecutionAccess access;
   return thread_local_.interrupt_flags_ & TERMINATE;
@@ -659,6 +673,17 @@ void Execution::ProcessDebugMesssages(bool debug_command_only) {
 #endif
 
 Object* Execution::HandleStackGuardInterrupt() {
+#ifdef V8_COROUTINE_THREADS
+  // Thread::RequestYield() only lowers the limits, as it may be called from
+  // a signal handler; now that we're at a safe point, turn it into a
+  // preemption. Limits lowered by a request that was since withdrawn go
+  // back up here too.
+  if (Thread::TakeYieldRequest()) {
+    StackGuard::Preempt();
+  } else if (!StackGuard::IsPreempted()) {
+    StackGuard::Continue(PREEMPT);
+  }
+#endif
 #ifdef ENABLE_DEBUGGER_SUPPORT
   if (StackGuard::IsDebugBreak() || StackGuard::IsDebugCommand()) {
     DebugBreakHelper();
@@ -170,6 +170,12 @@ class StackGuard : public AllStatic {
   static void Interrupt();
   static bool IsTerminateExecution();
   static void TerminateExecution();
+#ifdef V8_COROUTINE_THREADS
+  // Make the running JavaScript call HandleStackGuardInterrupt() at its next
+  // stack guard check, without setting any interrupt flag. Unlike the
+  // methods above, this is safe to call from a signal handler.
+  static void RequestInterruptCheck();
+#endif
 #ifdef ENABLE_DEBUGGER_SUPPORT
   static bool IsDebugBreak();
   static void DebugBreak();
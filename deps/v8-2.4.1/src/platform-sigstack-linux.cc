@@ -0,0 +1,1081 @@
+// Copyright 2006-2008 the V8 project authors. All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//     * Neither the name of Google Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Platform specific code for running V8 on coroutines on Linux goes here.
+// This is the Linux counterpart of platform-sigstack.cc: the OS-level bits
+// are taken from platform-linux.cc, while V8 "threads" are coroutines that
+// all share a single OS thread. For the POSIX comaptible parts the
+// implementation is in platform-posix.cc.
+
+#include <pthread.h>    // only used by the profiling Sampler
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>  // mmap & munmap
+#include <sys/mman.h>   // mmap & munmap
+#include <sys/stat.h>   // open
+#include <fcntl.h>      // open
+#include <unistd.h>     // sysconf
+#ifdef __GLIBC__
+#include <execinfo.h>   // backtrace, backtrace_symbols
+#endif  // def __GLIBC__
+#include <strings.h>    // index
+#include <errno.h>
+#include <stdarg.h>
+
+#undef MAP_TYPE
+
+#include "v8.h"
+
+#include "execution.h"
+#include "platform.h"
+#include "top.h"
+#include "v8threads.h"
+#include "coro.h"
+
+#if 0
+#define PGLOG(x) \
+  do { \
+    printf x; \
+  } while (0)
+#else
+#define PGLOG(x) do {} while(0)
+#endif
+
+// Older C libraries don't know about MAP_STACK; it's only a hint anyway.
+#ifndef MAP_STACK
+#define MAP_STACK 0
+#endif
+
+
+namespace v8 {
+namespace internal {
+
+
+class MainThread : public Thread {
+  public:
+    void Run() {
+      UNREACHABLE();
+    }
+} main_th;
+
+// Export some scheduler data structures to whoever wants to look at them
+Thread *main_thread = &main_th;
+Thread *current_thread = main_thread;
+
+
+double ceiling(double x) {
+  return ceil(x);
+}
+
+
+void OS::Setup() {
+  // Seed the random number generator.
+  // Convert the current time to a 64-bit integer first, before converting it
+  // to an unsigned. Going directly can cause an overflow and the seed to be
+  // set to all ones. The seed will be identical for different instances that
+  // call this setup code within the same millisecond.
+  uint64_t seed = static_cast<uint64_t>(TimeCurrentMillis());
+  srandom(static_cast<unsigned int>(seed));
+}
+
+
+uint64_t OS::CpuFeaturesImpliedByPlatform() {
+#if (defined(__VFP_FP__) && !defined(__SOFTFP__))
+  // Here gcc is telling us that we are on an ARM and gcc is assuming that we
+  // have VFP3 instructions.  If gcc can assume it then so can we.
+  return 1u << VFP3;
+#elif CAN_USE_ARMV7_INSTRUCTIONS
+  return 1u << ARMv7;
+#else
+  return 0;  // Linux runs on anything.
+#endif
+}
+
+
+#ifdef __arm__
+bool OS::ArmCpuHasFeature(CpuFeature feature) {
+  const char* search_string = NULL;
+  const char* file_name = "/proc/cpuinfo";
+  // Simple detection of VFP at runtime for Linux.
+  // It is based on /proc/cpuinfo, which reveals hardware configuration
+  // to user-space applications.  According to ARM (mid 2009), no similar
+  // facility is universally available on the ARM architectures,
+  // so it's up to individual OSes to provide such.
+  //
+  // This is written as a straight shot one pass parser
+  // and not using STL string and ifstream because,
+  // on Linux, it's reading from a (non-mmap-able)
+  // character special device.
+  switch (feature) {
+    case VFP3:
+      search_string = "vfp";
+      break;
+    case ARMv7:
+      search_string = "ARMv7";
+      break;
+    default:
+      UNREACHABLE();
+  }
+
+  FILE* f = NULL;
+  const char* what = search_string;
+
+  if (NULL == (f = fopen(file_name, "r")))
+    return false;
+
+  int k;
+  while (EOF != (k = fgetc(f))) {
+    if (k == *what) {
+      ++what;
+      while ((*what != '\0') && (*what == fgetc(f))) {
+        ++what;
+      }
+      if (*what == '\0') {
+        fclose(f);
+        return true;
+      } else {
+        what = search_string;
+      }
+    }
+  }
+  fclose(f);
+
+  // Did not find string in the proc file.
+  return false;
+}
+#endif  // def __arm__
+
+
+int OS::ActivationFrameAlignment() {
+#ifdef V8_TARGET_ARCH_ARM
+  // On EABI ARM targets this is required for fp correctness in the
+  // runtime system.
+  return 8;
+#elif V8_TARGET_ARCH_MIPS
+  return 8;
+#endif
+  // With gcc 4.4 the tree vectorization optimizer can generate code
+  // that requires 16 byte alignment such as movdqa on x86.
+  return 16;
+}
+
+
+#ifdef V8_TARGET_ARCH_ARM
+// 0xffff0fa0 is the hard coded address of a function provided by
+// the kernel which implements a memory barrier. On older
+// ARM architecture revisions (pre-v6) this may be implemented using
+// a syscall. This address is stable, and in active use (hard coded)
+// by at least glibc-2.7 and the Android C library.
+typedef void (*LinuxKernelMemoryBarrierFunc)(void);
+LinuxKernelMemoryBarrierFunc pLinuxKernelMemoryBarrier __attribute__((weak)) =
+    (LinuxKernelMemoryBarrierFunc) 0xffff0fa0;
+#endif
+
+void OS::ReleaseStore(volatile AtomicWord* ptr, AtomicWord value) {
+#if defined(V8_TARGET_ARCH_ARM) && defined(__arm__)
+  // Only use on ARM hardware.
+  pLinuxKernelMemoryBarrier();
+#else
+  __asm__ __volatile__("" : : : "memory");
+  // An x86 store acts as a release barrier.
+#endif
+  *ptr = value;
+}
+
+
+const char* OS::LocalTimezone(double time) {
+  if (isnan(time)) return "";
+  time_t tv = static_cast<time_t>(floor(time/msPerSecond));
+  struct tm* t = localtime(&tv);
+  if (NULL == t) return "";
+  return t->tm_zone;
+}
+
+
+double OS::LocalTimeOffset() {
+  time_t tv = time(NULL);
+  struct tm* t = localtime(&tv);
+  // tm_gmtoff includes any daylight savings offset, so subtract it.
+  return static_cast<double>(t->tm_gmtoff * msPerSecond -
+                             (t->tm_isdst > 0 ? 3600 * msPerSecond : 0));
+}
+
+
+// We keep the lowest and highest addresses mapped as a quick way of
+// determining that pointers are outside the heap (used mostly in assertions
+// and verification).  The estimate is conservative, ie, not all addresses in
+// 'allocated' space are actually allocated to our heap.  The range is
+// [lowest, highest), inclusive on the low and and exclusive on the high end.
+static void* lowest_ever_allocated = reinterpret_cast<void*>(-1);
+static void* highest_ever_allocated = reinterpret_cast<void*>(0);
+
+
+static void UpdateAllocatedSpaceLimits(void* address, int size) {
+  lowest_ever_allocated = Min(lowest_ever_allocated, address);
+  highest_ever_allocated =
+      Max(highest_ever_allocated,
+          reinterpret_cast<void*>(reinterpret_cast<char*>(address) + size));
+}
+
+
+bool OS::IsOutsideAllocatedSpace(void* address) {
+  return address < lowest_ever_allocated || address >= highest_ever_allocated;
+}
+
+
+size_t OS::AllocateAlignment() {
+  return sysconf(_SC_PAGESIZE);
+}
+
+
+void* OS::Allocate(const size_t requested,
+                   size_t* allocated,
+                   bool is_executable) {
+  // TODO(805): Port randomization of allocated executable memory to Linux.
+  const size_t msize = RoundUp(requested, sysconf(_SC_PAGESIZE));
+  int prot = PROT_READ | PROT_WRITE | (is_executable ? PROT_EXEC : 0);
+  void* mbase = mmap(NULL, msize, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mbase == MAP_FAILED) {
+    LOG(StringEvent("OS::Allocate", "mmap failed"));
+    return NULL;
+  }
+  *allocated = msize;
+  UpdateAllocatedSpaceLimits(mbase, msize);
+  return mbase;
+}
+
+
+void OS::Free(void* address, const size_t size) {
+  // TODO(1240712): munmap has a return value which is ignored here.
+  int result = munmap(address, size);
+  USE(result);
+  ASSERT(result == 0);
+}
+
+
+#ifdef ENABLE_HEAP_PROTECTION
+
+void OS::Protect(void* address, size_t size) {
+  // TODO(1240712): mprotect has a return value which is ignored here.
+  mprotect(address, size, PROT_READ);
+}
+
+
+void OS::Unprotect(void* address, size_t size, bool is_executable) {
+  // TODO(1240712): mprotect has a return value which is ignored here.
+  int prot = PROT_READ | PROT_WRITE | (is_executable ? PROT_EXEC : 0);
+  mprotect(address, size, prot);
+}
+
+#endif
+
+
+void OS::Sleep(int milliseconds) {
+  unsigned int ms = static_cast<unsigned int>(milliseconds);
+  usleep(1000 * ms);
+}
+
+
+void OS::Abort() {
+  // Redirect to std abort to signal abnormal program termination.
+  abort();
+}
+
+
+void OS::DebugBreak() {
+// TODO(lrn): Introduce processor define for runtime system (!= V8_ARCH_x,
+//  which is the architecture of generated code).
+#if (defined(__arm__) || defined(__thumb__))
+# if defined(CAN_USE_ARMV5_INSTRUCTIONS)
+  asm("bkpt 0");
+# endif
+#elif defined(__mips__)
+  asm("break");
+#else
+  asm("int $3");
+#endif
+}
+
+
+class PosixMemoryMappedFile : public OS::MemoryMappedFile {
+ public:
+  PosixMemoryMappedFile(FILE* file, void* memory, int size)
+    : file_(file), memory_(memory), size_(size) { }
+  virtual ~PosixMemoryMappedFile();
+  virtual void* memory() { return memory_; }
+ private:
+  FILE* file_;
+  void* memory_;
+  int size_;
+};
+
+
+OS::MemoryMappedFile* OS::MemoryMappedFile::create(const char* name, int size,
+    void* initial) {
+  FILE* file = fopen(name, "w+");
+  if (file == NULL) return NULL;
+  int result = fwrite(initial, size, 1, file);
+  if (result < 1) {
+    fclose(file);
+    return NULL;
+  }
+  void* memory =
+      mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+  return new PosixMemoryMappedFile(file, memory, size);
+}
+
+
+PosixMemoryMappedFile::~PosixMemoryMappedFile() {
+  if (memory_) munmap(memory_, size_);
+  fclose(file_);
+}
+
+
+void OS::LogSharedLibraryAddresses() {
+#ifdef ENABLE_LOGGING_AND_PROFILING
+  // This function assumes that the layout of the file is as follows:
+  // hex_start_addr-hex_end_addr rwxp <unused data> [binary_file_name]
+  // If we encounter an unexpected situation we abort scanning further entries.
+  FILE* fp = fopen("/proc/self/maps", "r");
+  if (fp == NULL) return;
+
+  // Allocate enough room to be able to store a full file name.
+  const int kLibNameLen = FILENAME_MAX + 1;
+  char* lib_name = reinterpret_cast<char*>(malloc(kLibNameLen));
+
+  // This loop will terminate once the scanning hits an EOF.
+  while (true) {
+    uintptr_t start, end;
+    char attr_r, attr_w, attr_x, attr_p;
+    // Parse the addresses and permission bits at the beginning of the line.
+    if (fscanf(fp, "%" V8PRIxPTR "-%" V8PRIxPTR, &start, &end) != 2) break;
+    if (fscanf(fp, " %c%c%c%c", &attr_r, &attr_w, &attr_x, &attr_p) != 4) break;
+
+    int c;
+    if (attr_r == 'r' && attr_w != 'w' && attr_x == 'x') {
+      // Found a read-only executable entry. Skip characters until we reach
+      // the beginning of the filename or the end of the line.
+      do {
+        c = getc(fp);
+      } while ((c != EOF) && (c != '\n') && (c != '/'));
+      if (c == EOF) break;  // EOF: Was unexpected, just exit.
+
+      // Process the filename if found.
+      if (c == '/') {
+        ungetc(c, fp);  // Push the '/' back into the stream to be read below.
+
+        // Read to the end of the line. Exit if the read fails.
+        if (fgets(lib_name, kLibNameLen, fp) == NULL) break;
+
+        // Drop the newline character read by fgets. We do not need to check
+        // for a zero-length string because we know that we at least read the
+        // '/' character.
+        lib_name[strlen(lib_name) - 1] = '\0';
+      } else {
+        // No library name found, just record the raw address range.
+        snprintf(lib_name, kLibNameLen,
+                 "%08" V8PRIxPTR "-%08" V8PRIxPTR, start, end);
+      }
+      LOG(SharedLibraryEvent(lib_name, start, end));
+    } else {
+      // Entry not describing executable data. Skip to end of line to setup
+      // reading the next entry.
+      do {
+        c = getc(fp);
+      } while ((c != EOF) && (c != '\n'));
+      if (c == EOF) break;
+    }
+  }
+  free(lib_name);
+  fclose(fp);
+#endif
+}
+
+
+int OS::StackWalk(Vector<OS::StackFrame> frames) {
+  // backtrace is a glibc extension.
+#ifdef __GLIBC__
+  int frames_size = frames.length();
+  ScopedVector<void*> addresses(frames_size);
+
+  int frames_count = backtrace(addresses.start(), frames_size);
+
+  char** symbols = backtrace_symbols(addresses.start(), frames_count);
+  if (symbols == NULL) {
+    return kStackWalkError;
+  }
+
+  for (int i = 0; i < frames_count; i++) {
+    frames[i].address = addresses[i];
+    // Format a text representation of the frame based on the information
+    // available.
+    SNPrintF(MutableCStrVector(frames[i].text, kStackWalkMaxTextLen),
+             "%s",
+             symbols[i]);
+    // Make sure line termination is in place.
+    frames[i].text[kStackWalkMaxTextLen - 1] = '\0';
+  }
+
+  free(symbols);
+
+  return frames_count;
+#else  // ndef __GLIBC__
+  return 0;
+#endif  // ndef __GLIBC__
+}
+
+
+// Constants used for mmap.
+static const int kMmapFd = -1;
+static const int kMmapFdOffset = 0;
+
+
+VirtualMemory::VirtualMemory(size_t size) {
+  address_ = mmap(NULL, size, PROT_NONE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                  kMmapFd, kMmapFdOffset);
+  size_ = size;
+}
+
+
+VirtualMemory::~VirtualMemory() {
+  if (IsReserved()) {
+    if (0 == munmap(address(), size())) address_ = MAP_FAILED;
+  }
+}
+
+
+bool VirtualMemory::IsReserved() {
+  return address_ != MAP_FAILED;
+}
+
+
+bool VirtualMemory::Commit(void* address, size_t size, bool is_executable) {
+  int prot = PROT_READ | PROT_WRITE | (is_executable ? PROT_EXEC : 0);
+  if (MAP_FAILED == mmap(address, size, prot,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                         kMmapFd, kMmapFdOffset)) {
+    return false;
+  }
+
+  UpdateAllocatedSpaceLimits(address, size);
+  return true;
+}
+
+
+bool VirtualMemory::Uncommit(void* address, size_t size) {
+  return mmap(address, size, PROT_NONE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+              kMmapFd, kMmapFdOffset) != MAP_FAILED;
+}
+
+
+class ThreadHandle::PlatformData : public Malloced {
+ public:
+  explicit PlatformData(ThreadHandle::Kind kind)
+      : stack_(NULL), stack_size_(0), stack_high_water_(0),
+        stack_map_(NULL), stack_map_size_(0) {
+    Initialize(kind);
+  }
+
+  ~PlatformData() {
+    if (stack_map_) {
+      int result = munmap(stack_map_, stack_map_size_);
+      USE(result);
+      ASSERT(result == 0);
+    }
+
+#ifndef CORO_SJLJ
+    coro_destroy(&coro_ctx_);
+#endif
+  }
+
+  // Note that this does not touch the stack. Handles are re-initialized
+  // every time the V8 lock changes hands; only Thread objects own a stack,
+  // and they keep it for their entire lifetime.
+  void Initialize(ThreadHandle::Kind kind) {
+    ThreadHandle::PlatformData *current_pd = NULL;
+
+    id_ = -1;
+    memset(&coro_ctx_, 0, sizeof(coro_ctx_));
+    valid_ = false;
+    memset(&locals_, 0, sizeof(locals_));
+
+    switch (kind) {
+      case ThreadHandle::SELF:
+        current_pd = current_thread->thread_handle_data();
+
+        ASSERT(next_id > 0);
+        ASSERT(current_pd->id_ >= 0);
+
+        id_ = current_pd->id_;
+        memcpy(&coro_ctx_, &current_pd->coro_ctx_, sizeof(coro_ctx_));
+        valid_ = current_pd->valid_;
+        memcpy(&locals_, &current_pd->locals_, sizeof(locals_));
+        break;
+
+      case ThreadHandle::INVALID:
+        id_ = next_id++;
+        break;
+
+      default:
+        UNREACHABLE();
+    }
+  }
+
+  // Map a stack of 'size' usable bytes (rounded up to whole pages) with a
+  // PROT_NONE guard page below it. The mapping is MAP_NORESERVE, so only
+  // pages that the coroutine actually touches are backed by physical
+  // memory, and running off the end of the stack faults on the guard page
+  // rather than scribbling on whatever happens to live below it.
+  void AllocateStack(size_t size) {
+    const size_t page_size = getpagesize();
+
+    ASSERT(stack_map_ == NULL);
+
+    if (size == 0) {
+      size = default_stack_size;
+    }
+
+    stack_size_ = RoundUp(Max(size, kMinStackSize), page_size);
+    stack_map_size_ = stack_size_ + page_size;
+    stack_map_ = mmap(NULL, stack_map_size_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                      -1, 0);
+    if (stack_map_ == MAP_FAILED) {
+      // Note that every stack costs two map entries; running out of
+      // vm.max_map_count shows up here as ENOMEM.
+      stack_map_ = NULL;
+      V8::FatalProcessOutOfMemory("Thread::Thread (stack)");
+    }
+
+    if (mprotect(stack_map_, page_size, PROT_NONE) != 0) {
+      V8::FatalProcessOutOfMemory("Thread::Thread (guard page)");
+    }
+
+    stack_ = reinterpret_cast<char*>(stack_map_) + page_size;
+  }
+
+  static int AllocateLocalId() {
+    ASSERT(next_local < kMaxThreadLocals);
+    return next_local++;
+  }
+
+  static const int kMaxThreadLocals = 16;
+
+  // The default matches SIGSTKSZ on Mac OS X, which is what
+  // platform-sigstack.cc used to use. Linux's SIGSTKSZ is far too small to
+  // run JavaScript on, and since the mapping is lazily backed, a generous
+  // size costs only address space.
+  static const size_t kDefaultStackSize = 128 * KB;
+  static const size_t kMinStackSize = 16 * KB;
+  static size_t default_stack_size;
+
+  int id_;
+  coro_context coro_ctx_;
+  void *stack_;
+  size_t stack_size_;
+  bool valid_;
+  void *locals_[kMaxThreadLocals];
+
+  // The deepest stack usage found by Thread::StackHighWater() so far
+  size_t stack_high_water_;
+
+  private:
+    void *stack_map_;
+    size_t stack_map_size_;
+
+    static int next_id;
+    static int next_local;
+};
+
+
+int ThreadHandle::PlatformData::next_id = 0;
+int ThreadHandle::PlatformData::next_local = 0;
+size_t ThreadHandle::PlatformData::default_stack_size =
+    ThreadHandle::PlatformData::kDefaultStackSize;
+
+
+ThreadHandle::ThreadHandle(Kind kind) {
+  data_ = new PlatformData(kind);
+}
+
+
+void ThreadHandle::Initialize(ThreadHandle::Kind kind) {
+  data_->Initialize(kind);
+}
+
+
+ThreadHandle::~ThreadHandle() {
+  delete data_;
+}
+
+
+bool ThreadHandle::IsSelf() const {
+  return (data_->id_ == current_thread->thread_handle_data()->id_);
+}
+
+
+bool ThreadHandle::IsValid() const {
+  return data_->valid_;
+}
+
+
+static void
+Trampoline(void *arg) {
+  Thread *tp = (Thread*) arg;
+  ThreadHandle::PlatformData *pd = tp->thread_handle_data();
+
+  ASSERT(pd->valid_);
+  ASSERT(current_thread == tp);
+
+  tp->Run();
+
+  UNREACHABLE();
+}
+
+
+Thread::Thread() : ThreadHandle(ThreadHandle::INVALID) {
+  ThreadHandle::PlatformData *pd = thread_handle_data();
+
+  pd->AllocateStack(0);
+  coro_create(&pd->coro_ctx_, Trampoline, this, pd->stack_, pd->stack_size_);
+}
+
+
+Thread::Thread(size_t stack_size) : ThreadHandle(ThreadHandle::INVALID) {
+  ThreadHandle::PlatformData *pd = thread_handle_data();
+
+  pd->AllocateStack(stack_size);
+  coro_create(&pd->coro_ctx_, Trampoline, this, pd->stack_, pd->stack_size_);
+}
+
+
+Thread::~Thread() {
+}
+
+
+void Thread::SetDefaultStackSize(size_t stack_size) {
+  ThreadHandle::PlatformData::default_stack_size = Max(
+      stack_size, ThreadHandle::PlatformData::kMinStackSize);
+}
+
+
+size_t Thread::GetDefaultStackSize() {
+  return ThreadHandle::PlatformData::default_stack_size;
+}
+
+
+char* Thread::stack_bottom() {
+  return reinterpret_cast<char*>(thread_handle_data()->stack_);
+}
+
+
+size_t Thread::stack_size() {
+  return thread_handle_data()->stack_size_;
+}
+
+
+// Stack pages are zero-filled by the kernel on first touch, which makes
+// them ready-painted. Pages that were never touched aren't resident, so
+// mincore(2) lets us skip straight to the first one that was, and we only
+// need to look below the deepest usage that we've already found. This is
+// usually a syscall and a scan of part of one page.
+size_t Thread::StackHighWater() {
+  ThreadHandle::PlatformData *pd = thread_handle_data();
+  const size_t page_size = getpagesize();
+  char *bottom = reinterpret_cast<char*>(pd->stack_);
+  char *top = bottom + pd->stack_size_;
+  char *end = top - pd->stack_high_water_;
+
+  for (char *page = bottom; page < end; ) {
+    unsigned char resident[64];
+    size_t npages = Min(static_cast<size_t>(ARRAY_SIZE(resident)),
+                        (end - page + page_size - 1) / page_size);
+
+    if (mincore(page, npages * page_size, resident) != 0) {
+      memset(resident, 1, sizeof(resident));
+    }
+
+    for (size_t i = 0; i < npages; i++, page += page_size) {
+      if (!(resident[i] & 1)) {
+        continue;
+      }
+
+      intptr_t *w = reinterpret_cast<intptr_t*>(page);
+      intptr_t *w_end = reinterpret_cast<intptr_t*>(Min(page + page_size, end));
+      for (; w < w_end; w++) {
+        if (*w != 0) {
+          pd->stack_high_water_ = top - reinterpret_cast<char*>(w);
+          return pd->stack_high_water_;
+        }
+      }
+    }
+  }
+
+  return pd->stack_high_water_;
+}
+
+
+void Thread::Start() {
+  ThreadHandle::PlatformData *this_pd = thread_handle_data();
+  Thread *prev_thread = current_thread;
+  ThreadHandle::PlatformData *prev_pd = prev_thread->thread_handle_data();
+
+  ASSERT(current_thread != this);
+
+  this_pd->valid_ = true;
+
+  current_thread = this;
+  coro_transfer(&prev_pd->coro_ctx_, &this_pd->coro_ctx_);
+
+  ASSERT(current_thread != this);
+  ASSERT(current_thread == prev_thread);
+}
+
+
+void Thread::Join() {
+  UNIMPLEMENTED();
+}
+
+
+Thread::LocalStorageKey Thread::CreateThreadLocalKey() {
+  int k = ThreadHandle::PlatformData::AllocateLocalId();
+
+  PGLOG(("CreateThreadLocalKey() = %d\n", k));
+
+  return static_cast<LocalStorageKey>(k);
+}
+
+
+void Thread::DeleteThreadLocalKey(LocalStorageKey key) {
+  UNIMPLEMENTED();
+}
+
+
+void* Thread::GetThreadLocal(LocalStorageKey key) {
+  ThreadHandle::PlatformData *pd = current_thread->thread_handle_data();
+  int k = static_cast<int>(key);
+
+  ASSERT(k >= 0);
+  ASSERT(k < ThreadHandle::PlatformData::kMaxThreadLocals);
+
+  PGLOG(("GetThreadLocal(%d, %d) = %p\n", pd->id_, k, pd->locals_[k]));
+
+  return pd->locals_[k];
+}
+
+
+void Thread::SetThreadLocal(LocalStorageKey key, void* value) {
+  ThreadHandle::PlatformData *pd = current_thread->thread_handle_data();
+  int k = static_cast<int>(key);
+
+  ASSERT(k >= 0);
+  ASSERT(k < ThreadHandle::PlatformData::kMaxThreadLocals);
+
+  PGLOG(("SetThreadLocal(%d, %d, %p)\n", pd->id_, k, value));
+  pd->locals_[k] = value;
+}
+
+
+static Thread::YieldCPUCallback yield_cpu_callback = NULL;
+
+
+// Threads are coroutines, so there is nobody else to yield to unless the
+// embedder has given us a scheduler to call.
+void Thread::YieldCPU() {
+  if (yield_cpu_callback != NULL) {
+    yield_cpu_callback();
+  }
+}
+
+
+void Thread::SetYieldCPUCallback(YieldCPUCallback callback) {
+  yield_cpu_callback = callback;
+}
+
+
+static volatile sig_atomic_t yield_requested = 0;
+
+
+// A signal handler may have interrupted V8 in the middle of updating the
+// stack guard's flags, so we mustn't touch them here (see
+// StackGuard::RequestInterruptCheck()).
+void Thread::RequestYield() {
+  yield_requested = 1;
+  StackGuard::RequestInterruptCheck();
+}
+
+
+bool Thread::TakeYieldRequest() {
+  bool requested = yield_requested != 0;
+
+  yield_requested = 0;
+  return requested;
+}
+
+
+void Thread::ClearInterrupts() {
+  ASSERT(Locker::IsLocked());
+  yield_requested = 0;
+  StackGuard::Continue(PREEMPT);
+  StackGuard::Continue(TERMINATE);
+}
+
+
+// All coroutines share a single OS thread and only switch at well-defined
+// points, so there is nothing to lock.
+class SigstackMutex : public Mutex {
+ public:
+
+  SigstackMutex() { PGLOG(("SigstackMutex::SigstackMutex()\n")); }
+
+  ~SigstackMutex() { PGLOG(("SigstackMutex::~SigstackMutex()\n")); }
+
+  int Lock() { PGLOG(("SigstackMutex::Lock()\n")); return 0; }
+
+  int Unlock() { PGLOG(("SigstackMutex::Unlock()\n")); return 0; }
+};
+
+
+Mutex* OS::CreateMutex() {
+  PGLOG(("OS::CreateMutex()\n"));
+
+  return new SigstackMutex();
+}
+
+
+class SigstackSemaphore : public Semaphore {
+ public:
+  explicit SigstackSemaphore(int count) {
+    PGLOG(("SigstackSemaphore::SigstackSemaphore(%d)\n", count));
+  }
+
+  ~SigstackSemaphore() {
+    PGLOG(("SigstackSemaphore::~SigstackSemaphore()\n"));
+  }
+
+  void Wait() { PGLOG(("SigstackSemaphore::Wait()\n")); }
+
+  bool Wait(int timeout);
+
+  void Signal() { PGLOG(("SigstackSemaphore::Signal()\n")); }
+};
+
+
+bool SigstackSemaphore::Wait(int timeout) {
+  PGLOG(("SigstackSemaphore::Wait(%d)\n", timeout));
+  return true;
+}
+
+
+Semaphore* OS::CreateSemaphore(int count) {
+  PGLOG(("OS::CreateSemaphore(%d)\n", count));
+  return new SigstackSemaphore(count);
+}
+
+
+#ifdef ENABLE_LOGGING_AND_PROFILING
+
+static Sampler* active_sampler_ = NULL;
+static pthread_t vm_thread_ = 0;
+
+
+#if !defined(__GLIBC__) && (defined(__arm__) || defined(__thumb__))
+// Android runs a fairly new Linux kernel, so signal info is there,
+// but the C library doesn't have the structs defined.
+
+struct sigcontext {
+  uint32_t trap_no;
+  uint32_t error_code;
+  uint32_t oldmask;
+  uint32_t gregs[16];
+  uint32_t arm_cpsr;
+  uint32_t fault_address;
+};
+typedef uint32_t __sigset_t;
+typedef struct sigcontext mcontext_t;
+typedef struct ucontext {
+  uint32_t uc_flags;
+  struct ucontext* uc_link;
+  stack_t uc_stack;
+  mcontext_t uc_mcontext;
+  __sigset_t uc_sigmask;
+} ucontext_t;
+enum ArmRegisters {R15 = 15, R13 = 13, R11 = 11};
+
+#endif
+
+
+// A function that determines if a signal handler is called in the context
+// of a VM thread.
+//
+// The problem is that SIGPROF signal can be delivered to an arbitrary thread
+// (see http://code.google.com/p/google-perftools/issues/detail?id=106#c2)
+// So, if the signal is being handled in the context of a non-VM thread,
+// it means that the VM thread is running, and trying to sample its stack can
+// cause a crash.
+static inline bool IsVmThread() {
+  // In the case of a single VM thread, this check is enough.
+  if (pthread_equal(pthread_self(), vm_thread_)) return true;
+  // If there are multiple threads that use VM, they must have a thread id
+  // stored in TLS. To verify that the thread is really executing VM,
+  // we check Top's data. Having that ThreadManager::RestoreThread first
+  // restores ThreadLocalTop from TLS, and only then erases the TLS value,
+  // reading Top::thread_id() should not be affected by races.
+  if (ThreadManager::HasId() && !ThreadManager::IsArchived() &&
+      ThreadManager::CurrentId() == Top::thread_id()) {
+    return true;
+  }
+  return false;
+}
+
+
+static void ProfilerSignalHandler(int signal, siginfo_t* info, void* context) {
+#ifndef V8_HOST_ARCH_MIPS
+  USE(info);
+  if (signal != SIGPROF) return;
+  if (active_sampler_ == NULL) return;
+
+  TickSample sample_obj;
+  TickSample* sample = CpuProfiler::TickSampleEvent();
+  if (sample == NULL) sample = &sample_obj;
+
+  // We always sample the VM state.
+  sample->state = VMState::current_state();
+  // If profiling, we extract the current pc and sp.
+  if (active_sampler_->IsProfiling()) {
+    // Extracting the sample from the context is extremely machine dependent.
+    ucontext_t* ucontext = reinterpret_cast<ucontext_t*>(context);
+    mcontext_t& mcontext = ucontext->uc_mcontext;
+#if V8_HOST_ARCH_IA32
+    sample->pc = reinterpret_cast<Address>(mcontext.gregs[REG_EIP]);
+    sample->sp = reinterpret_cast<Address>(mcontext.gregs[REG_ESP]);
+    sample->fp = reinterpret_cast<Address>(mcontext.gregs[REG_EBP]);
+#elif V8_HOST_ARCH_X64
+    sample->pc = reinterpret_cast<Address>(mcontext.gregs[REG_RIP]);
+    sample->sp = reinterpret_cast<Address>(mcontext.gregs[REG_RSP]);
+    sample->fp = reinterpret_cast<Address>(mcontext.gregs[REG_RBP]);
+#elif V8_HOST_ARCH_ARM
+// An undefined macro evaluates to 0, so this applies to Android's Bionic also.
+#if (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ <= 3))
+    sample->pc = reinterpret_cast<Address>(mcontext.gregs[R15]);
+    sample->sp = reinterpret_cast<Address>(mcontext.gregs[R13]);
+    sample->fp = reinterpret_cast<Address>(mcontext.gregs[R11]);
+#else
+    sample->pc = reinterpret_cast<Address>(mcontext.arm_pc);
+    sample->sp = reinterpret_cast<Address>(mcontext.arm_sp);
+    sample->fp = reinterpret_cast<Address>(mcontext.arm_fp);
+#endif
+#elif V8_HOST_ARCH_MIPS
+    // Implement this on MIPS.
+    UNIMPLEMENTED();
+#endif
+    if (IsVmThread()) {
+      active_sampler_->SampleStack(sample);
+    }
+  }
+
+  active_sampler_->Tick(sample);
+#endif
+}
+
+
+class Sampler::PlatformData : public Malloced {
+ public:
+  PlatformData() {
+    signal_handler_installed_ = false;
+  }
+
+  bool signal_handler_installed_;
+  struct sigaction old_signal_handler_;
+  struct itimerval old_timer_value_;
+};
+
+
+Sampler::Sampler(int interval, bool profiling)
+    : interval_(interval), profiling_(profiling), active_(false) {
+  data_ = new PlatformData();
+}
+
+
+Sampler::~Sampler() {
+  delete data_;
+}
+
+
+void Sampler::Start() {
+  // There can only be one active sampler at the time on POSIX
+  // platforms.
+  if (active_sampler_ != NULL) return;
+
+  vm_thread_ = pthread_self();
+
+  // Request profiling signals.
+  struct sigaction sa;
+  sa.sa_sigaction = ProfilerSignalHandler;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_SIGINFO;
+  if (sigaction(SIGPROF, &sa, &data_->old_signal_handler_) != 0) return;
+  data_->signal_handler_installed_ = true;
+
+  // Set the itimer to generate a tick for each interval.
+  itimerval itimer;
+  itimer.it_interval.tv_sec = interval_ / 1000;
+  itimer.it_interval.tv_usec = (interval_ % 1000) * 1000;
+  itimer.it_value.tv_sec = itimer.it_interval.tv_sec;
+  itimer.it_value.tv_usec = itimer.it_interval.tv_usec;
+  setitimer(ITIMER_PROF, &itimer, &data_->old_timer_value_);
+
+  // Set this sampler as the active sampler.
+  active_sampler_ = this;
+  active_ = true;
+}
+
+
+void Sampler::Stop() {
+  // Restore old signal handler
+  if (data_->signal_handler_installed_) {
+    setitimer(ITIMER_PROF, &data_->old_timer_value_, NULL);
+    sigaction(SIGPROF, &data_->old_signal_handler_, 0);
+    data_->signal_handler_installed_ = false;
+  }
+
+  // This sampler is no longer the active sampler.
+  active_sampler_ = NULL;
+  active_ = false;
+}
+
+
+#endif  // ENABLE_LOGGING_AND_PROFILING
+
+} }  // namespace v8::internal
@@ -59,6 +59,7 @@
 
 #include "v8.h"
 
+#include "execution.h"
 #include "platform.h"
 #include "coro.h"
 
@@ -383,7 +384,7 @@ bool VirtualMemory::Uncommit(void* address, size_t size) {
 
 class ThreadHandle::PlatformData : public Malloced {
  public:
-  explicit PlatformData(ThreadHandle::Kind kind) {
+  explicit PlatformData(ThreadHandle::Kind kind) : stack_high_water_(0) {
     Initialize(kind);
   }
 
@@ -403,6 +404,7 @@ class ThreadHandle::PlatformData : public Malloced {
     id_ = -1;
     memset(&coro_ctx_, 0, sizeof(coro_ctx_));
     stack_ = NULL;
+    stack_size_ = 0;
     valid_ = false;
     memset(&locals_, 0, sizeof(locals_));
 
@@ -416,13 +418,13 @@ class ThreadHandle::PlatformData : public Malloced {
         id_ = current_pd->id_;
         memcpy(&coro_ctx_, &current_pd->coro_ctx_, sizeof(coro_ctx_));
         stack_ = current_pd->stack_;
+        stack_size_ = current_pd->stack_size_;
         valid_ = current_pd->valid_;
         memcpy(&locals_, &current_pd->locals_, sizeof(locals_));
         break;
 
       case ThreadHandle::INVALID:
         id_ = next_id++;
-        stack_ = malloc(kStackSize);
         break;
 
       default:
@@ -435,15 +437,34 @@ class ThreadHandle::PlatformData : public Malloced {
     return next_local++;
   }
 
+  // Allocate a zeroed stack of the given size, or the default size if
+  // that is 0; Thread::StackHighWater() relies on the zeroing. Large
+  // calloc()s are lazily backed, so untouched pages cost nothing.
+  void AllocateStack(size_t size) {
+    ASSERT(stack_ == NULL);
+
+    if (size == 0) {
+      size = default_stack_size;
+    }
+
+    stack_size_ = Max(size, kMinStackSize);
+    stack_ = calloc(1, stack_size_);
+  }
+
   static const int kMaxThreadLocals = 16;
-  static const size_t kStackSize = SIGSTKSZ;
+  static const size_t kMinStackSize = 16 * KB;
+  static size_t default_stack_size;
 
   int id_;
   coro_context coro_ctx_;
   void *stack_;
+  size_t stack_size_;
   bool valid_;
   void *locals_[kMaxThreadLocals];
 
+  // The deepest stack usage found by Thread::StackHighWater() so far
+  size_t stack_high_water_;
+
   private:
     static int next_id;
     static int next_local;
@@ -452,6 +473,7 @@ class ThreadHandle::PlatformData : public Malloced {
 
 int ThreadHandle::PlatformData::next_id = 0;
 int ThreadHandle::PlatformData::next_local = 0;
+size_t ThreadHandle::PlatformData::default_stack_size = SIGSTKSZ;
 
 
 ThreadHandle::ThreadHandle(Kind kind) {
@@ -496,13 +518,16 @@ Trampoline(void *arg) {
 Thread::Thread() : ThreadHandle(ThreadHandle::INVALID) {
   ThreadHandle::PlatformData *pd = thread_handle_data();
 
-  coro_create(
-    &pd->coro_ctx_,
-    Trampoline,
-    this,
-    pd->stack_,
-    ThreadHandle::PlatformData::kStackSize
-  );
+  pd->AllocateStack(0);
+  coro_create(&pd->coro_ctx_, Trampoline, this, pd->stack_, pd->stack_size_);
+}
+
+
+Thread::Thread(size_t stack_size) : ThreadHandle(ThreadHandle::INVALID) {
+  ThreadHandle::PlatformData *pd = thread_handle_data();
+
+  pd->AllocateStack(stack_size);
+  coro_create(&pd->coro_ctx_, Trampoline, this, pd->stack_, pd->stack_size_);
 }
 
 
@@ -510,6 +535,46 @@ Thread::~Thread() {
 }
 
 
+void Thread::SetDefaultStackSize(size_t stack_size) {
+  ThreadHandle::PlatformData::default_stack_size = Max(
+      stack_size, ThreadHandle::PlatformData::kMinStackSize);
+}
+
+
+size_t Thread::GetDefaultStackSize() {
+  return ThreadHandle::PlatformData::default_stack_size;
+}
+
+
+char* Thread::stack_bottom() {
+  return reinterpret_cast<char*>(thread_handle_data()->stack_);
+}
+
+
+size_t Thread::stack_size() {
+  return thread_handle_data()->stack_size_;
+}
+
+
+// Scan up from the bottom of the stack for the first byte that isn't still
+// zero; there's no need to look above the deepest usage already found.
+size_t Thread::StackHighWater() {
+  ThreadHandle::PlatformData *pd = thread_handle_data();
+  char *top = reinterpret_cast<char*>(pd->stack_) + pd->stack_size_;
+  intptr_t *w = reinterpret_cast<intptr_t*>(pd->stack_);
+  intptr_t *w_end = reinterpret_cast<intptr_t*>(top - pd->stack_high_water_);
+
+  for (; w < w_end; w++) {
+    if (*w != 0) {
+      pd->stack_high_water_ = top - reinterpret_cast<char*>(w);
+      break;
+    }
+  }
+
+  return pd->stack_high_water_;
+}
+
+
 void Thread::Start() {
   ThreadHandle::PlatformData *this_pd = thread_handle_data();
   Thread *prev_thread = current_thread;
@@ -571,8 +636,48 @@ void Thread::SetThreadLocal(LocalStorageKey key, void* value) {
 }
 
 
+static Thread::YieldCPUCallback yield_cpu_callback = NULL;
+
+
+// Threads are coroutines, so there is nobody else to yield to unless the
+// embedder has given us a scheduler to call.
 void Thread::YieldCPU() {
-  UNIMPLEMENTED();
+  if (yield_cpu_callback != NULL) {
+    yield_cpu_callback();
+  }
+}
+
+
+void Thread::SetYieldCPUCallback(YieldCPUCallback callback) {
+  yield_cpu_callback = callback;
+}
+
+
+static volatile sig_atomic_t yield_requested = 0;
+
+
+// A signal handler may have interrupted V8 in the middle of updating the
+// stack guard's flags, so we mustn't touch them here (see
+// StackGuard::RequestInterruptCheck()).
+void Thread::RequestYield() {
+  yield_requested = 1;
+  StackGuard::RequestInterruptCheck();
+}
+
+
+bool Thread::TakeYieldRequest() {
+  bool requested = yield_requested != 0;
+
+  yield_requested = 0;
+  return requested;
+}
+
+
+void Thread::ClearInterrupts() {
+  ASSERT(Locker::IsLocked());
+  yield_requested = 0;
+  StackGuard::Continue(PREEMPT);
+  StackGuard::Continue(TERMINATE);
 }
 
 
@@ -375,6 +375,25 @@ class Thread: public ThreadHandle {
   Thread();
   virtual ~Thread();
 
+  // Create a new thread with a stack of (at least) the given size, or of
+  // the default size if that is 0. Only the coroutine (sigstack) platforms
+  // support this and the stack methods below.
+  explicit Thread(size_t stack_size);
+
+  // The size of the stacks of threads created without an explicit size.
+  static void SetDefaultStackSize(size_t stack_size);
+  static size_t GetDefaultStackSize();
+
+  // The lowest usable address of this thread's stack, and its size.
+  char* stack_bottom();
+  size_t stack_size();
+
+  // The most stack that this thread has ever used, in bytes. Stacks start
+  // out zeroed, so this is found by looking for the deepest byte that isn't
+  // zero any more; it can come up short by however many zero bytes the
+  // deepest frame happened to write at its bottom.
+  size_t StackHighWater();
+
   // Start new thread by calling the Run() method in the new thread.
   void Start();
 
@@ -399,9 +418,29 @@ class Thread: public ThreadHandle {
     return GetThreadLocal(key) != NULL;
   }
 
-  // A hint to the scheduler to let another thread run.
+  // A hint to the scheduler to let another thread run. On the coroutine
+  // (sigstack) platforms this calls the callback set with
+  // SetYieldCPUCallback(), if any, as there is no OS scheduler to defer to.
   static void YieldCPU();
 
+  typedef void (*YieldCPUCallback)();
+  static void SetYieldCPUCallback(YieldCPUCallback callback);
+
+  // Ask the running JavaScript to call YieldCPU() (with the V8 lock
+  // released) at its next stack guard check. This may be called from a
+  // signal handler on the coroutine platforms, where all threads share a
+  // single OS thread: it only sets a flag and lowers the stack limits, and
+  // the stack guard sets the preemption flag itself.
+  static void RequestYield();
+
+  // Take the request made by RequestYield(), if any; for the stack guard.
+  static bool TakeYieldRequest();
+
+  // Withdraw any RequestYield() or v8::V8::TerminateExecution() that the
+  // current thread has not acted on yet. Must be called with the V8 lock
+  // held.
+  static void ClearInterrupts();
+
  private:
   class PlatformData;
   PlatformData* data_;
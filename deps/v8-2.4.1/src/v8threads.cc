@@ -124,6 +124,18 @@ void Locker::StopPreemption() {
 namespace internal {
 
 
+#ifdef V8_COROUTINE_THREADS
+// When V8 threads are coroutines sharing one OS thread they can only switch
+// at Locker/Unlocker boundaries.  At those points the regexp stack is idle
+// and the bootstrapper is not running, so every thread would archive the
+// same regexp and bootstrapper state; leave it in place instead.  The debug
+// state is likewise identical unless a debugger is attached.
+static const bool kShareIdleState = true;
+#else
+static const bool kShareIdleState = false;
+#endif
+
+
 bool ThreadManager::RestoreThread() {
   // First check whether the current thread has been 'lazily archived', ie
   // not archived at all.  If that is the case we put the state storage we
@@ -160,11 +172,16 @@ bool ThreadManager::RestoreThread() {
   from = Top::RestoreThread(from);
   from = Relocatable::RestoreState(from);
 #ifdef ENABLE_DEBUGGER_SUPPORT
-  from = Debug::RestoreDebug(from);
+  if (state->debug_archived()) {
+    Debug::RestoreDebug(from);
+  }
+  from += Debug::ArchiveSpacePerThread();
 #endif
   from = StackGuard::RestoreStackGuard(from);
-  from = RegExpStack::RestoreStack(from);
-  from = Bootstrapper::RestoreState(from);
+  if (!kShareIdleState) {
+    from = RegExpStack::RestoreStack(from);
+    from = Bootstrapper::RestoreState(from);
+  }
   Thread::SetThreadLocal(thread_state_key, NULL);
   if (state->terminate_on_restore()) {
     StackGuard::TerminateExecution();
@@ -191,15 +208,17 @@ void ThreadManager::Unlock() {
 
 
 static int ArchiveSpacePerThread() {
+  int shared = kShareIdleState ? 0 :
+                    RegExpStack::ArchiveSpacePerThread() +
+                   Bootstrapper::ArchiveSpacePerThread();
   return HandleScopeImplementer::ArchiveSpacePerThread() +
                             Top::ArchiveSpacePerThread() +
 #ifdef ENABLE_DEBUGGER_SUPPORT
                           Debug::ArchiveSpacePerThread() +
 #endif
                      StackGuard::ArchiveSpacePerThread() +
-                    RegExpStack::ArchiveSpacePerThread() +
-                   Bootstrapper::ArchiveSpacePerThread() +
-                    Relocatable::ArchiveSpacePerThread();
+                    Relocatable::ArchiveSpacePerThread() +
+                    shared;
 }
 
 
@@ -209,6 +228,7 @@ ThreadState* ThreadState::in_use_anchor_ = new ThreadState();
 
 ThreadState::ThreadState() : id_(ThreadManager::kInvalidId),
                              terminate_on_restore_(false),
+                             debug_archived_(false),
                              next_(this), previous_(this) {
 }
 
@@ -291,11 +311,21 @@ void ThreadManager::EagerlyArchiveThread() {
   to = Top::ArchiveThread(to);
   to = Relocatable::ArchiveState(to);
 #ifdef ENABLE_DEBUGGER_SUPPORT
-  to = Debug::ArchiveDebug(to);
+  state->set_debug_archived(!kShareIdleState ||
+                            Debugger::IsDebuggerActive() ||
+                            Debug::InDebugger());
+  if (state->debug_archived()) {
+    Debug::ArchiveDebug(to);
+  }
+  to += Debug::ArchiveSpacePerThread();
 #endif
   to = StackGuard::ArchiveStackGuard(to);
-  to = RegExpStack::ArchiveStack(to);
-  to = Bootstrapper::ArchiveState(to);
+  if (!kShareIdleState) {
+    to = RegExpStack::ArchiveStack(to);
+    to = Bootstrapper::ArchiveState(to);
+  } else {
+    ASSERT(!Bootstrapper::IsActive());
+  }
   lazily_archived_thread_.Initialize(ThreadHandle::INVALID);
   lazily_archived_thread_state_ = NULL;
 }
@@ -308,7 +338,10 @@ void ThreadManager::FreeThreadResources() {
   Debug::FreeThreadResources();
 #endif
   StackGuard::FreeThreadResources();
-  RegExpStack::FreeThreadResources();
+  // A shared regexp stack outlives any one thread.
+  if (!kShareIdleState) {
+    RegExpStack::FreeThreadResources();
+  }
   Bootstrapper::FreeThreadResources();
 }
 
@@ -56,6 +56,13 @@ class ThreadState {
     terminate_on_restore_ = terminate_on_restore;
   }
 
+  // Was the debugger state archived along with the rest?  It is left in
+  // place when it is shared by all threads; see EagerlyArchiveThread().
+  bool debug_archived() { return debug_archived_; }
+  void set_debug_archived(bool debug_archived) {
+    debug_archived_ = debug_archived;
+  }
+
   // Get data area for archiving a thread.
   char* data() { return data_; }
  private:
@@ -65,6 +72,7 @@ class ThreadState {
 
   int id_;
   bool terminate_on_restore_;
+  bool debug_archived_;
   char* data_;
   ThreadState* next_;
   ThreadState* previous_;
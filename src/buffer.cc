@@ -0,0 +1,306 @@
+#include <string.h>
+#include "buffer.h"
+#include "bufpool.h"
+#include "corona.h"
+#include "v8-util.h"
+
+// Memory shared by a buffer and its slices, and how many of them there are.
+// The memory comes from the given class of the pool, or from the heap if
+// that's -1.
+struct BufferStorage {
+    char *bs_data_;
+    size_t bs_len_;
+    size_t bs_refs_;
+    int bs_cls_;
+};
+
+// Template for the JavaScript objects wrapping buffers; see Buffer::Wrap()
+static v8::Persistent<v8::FunctionTemplate> g_bufferTmpl;
+
+const size_t Buffer::kMaxLength = 0x3fffffff;
+
+// Allocate storage of the given length, which the first buffer to use it
+// takes a reference to. Buffers small enough come from the pool, which
+// tells V8 about its memory itself.
+static BufferStorage *
+NewStorage(size_t len) {
+    BufferStorage *bs = new BufferStorage();
+    int cls = BufPoolClass(len);
+
+    bs->bs_len_ = len;
+    bs->bs_refs_ = 0;
+
+    if (len <= kBufPoolSizes[cls]) {
+        bs->bs_data_ = BufPoolGet(cls);
+        bs->bs_cls_ = cls;
+    } else {
+        bs->bs_data_ = new char[len];
+        bs->bs_cls_ = -1;
+        v8::V8::AdjustAmountOfExternalAllocatedMemory((int) len);
+    }
+
+    return bs;
+}
+
+Buffer::Buffer(BufferStorage *bs, char *data, size_t len) :
+    bf_storage_(bs),
+    bf_data_(data),
+    bf_len_(len) {
+    bs->bs_refs_++;
+}
+
+Buffer::~Buffer(void) {
+    BufferStorage *bs = this->bf_storage_;
+
+    if (--bs->bs_refs_ > 0) {
+        return;
+    }
+
+    if (bs->bs_cls_ >= 0) {
+        BufPoolPut(bs->bs_cls_, bs->bs_data_);
+    } else {
+        v8::V8::AdjustAmountOfExternalAllocatedMemory(-(int) bs->bs_len_);
+        delete[] bs->bs_data_;
+    }
+
+    delete bs;
+}
+
+v8::Handle<v8::Object>
+Buffer::New(size_t len) {
+    v8::HandleScope scope;
+
+    ASSERT(len <= kMaxLength);
+
+    BufferStorage *bs = NewStorage(len);
+    Buffer *buf = new Buffer(bs, bs->bs_data_, len);
+    v8::Local<v8::Object> obj =
+        g_bufferTmpl->InstanceTemplate()->NewInstance();
+
+    buf->Wrap(obj);
+    return scope.Close(obj);
+}
+
+Buffer *
+Buffer::Unwrap(v8::Handle<v8::Value> val) {
+    if (!g_bufferTmpl->HasInstance(val)) {
+        return NULL;
+    }
+
+    v8::Handle<v8::Object> obj = v8::Handle<v8::Object>::Cast(val);
+    return (Buffer*) v8::External::Unwrap(obj->GetInternalField(0));
+}
+
+char *
+Buffer::Data(void) const {
+    return this->bf_data_;
+}
+
+size_t
+Buffer::Length(void) const {
+    return this->bf_len_;
+}
+
+v8::Handle<v8::Object>
+Buffer::Slice(size_t start, size_t end) {
+    v8::HandleScope scope;
+
+    ASSERT(start <= end && end <= this->bf_len_);
+
+    Buffer *buf = new Buffer(
+        this->bf_storage_, this->bf_data_ + start, end - start
+    );
+    v8::Local<v8::Object> obj =
+        g_bufferTmpl->InstanceTemplate()->NewInstance();
+
+    buf->Wrap(obj);
+    return scope.Close(obj);
+}
+
+void
+Buffer::Wrap(v8::Handle<v8::Object> obj) {
+    ASSERT(this->bf_obj_.IsEmpty());
+
+    obj->SetInternalField(0, v8::External::New(this));
+    obj->SetIndexedPropertiesToExternalArrayData(
+        this->bf_data_, v8::kExternalUnsignedByteArray, this->bf_len_
+    );
+
+    this->bf_obj_ = v8::Persistent<v8::Object>::New(obj);
+    this->bf_obj_.MakeWeak(this, Buffer::WeakCB);
+}
+
+// Our wrapper is garbage, so nobody can get at our bytes any more
+void
+Buffer::WeakCB(v8::Persistent<v8::Value> obj, void *arg) {
+    Buffer *self = (Buffer*) arg;
+
+    ASSERT(self->bf_obj_ == obj);
+
+    self->bf_obj_.Dispose();
+    self->bf_obj_.Clear();
+    delete self;
+}
+
+// Buffer()
+//
+// <buffer> = new Buffer(<length> | <string>)
+//
+// Returns a buffer of the given length, whose bytes are not initialized, or
+// one holding the given string encoded as UTF-8.
+v8::Handle<v8::Value>
+Buffer::Construct(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    if (!args.IsConstructCall()) {
+        v8::Handle<v8::Value> argv[] = { args[0] };
+
+        return scope.Close(g_bufferTmpl->GetFunction()->NewInstance(
+            (args.Length() > 0) ? 1 : 0, argv
+        ));
+    }
+
+    V8_ARG_EXISTS(args, 0);
+
+    BufferStorage *bs;
+    size_t len;
+
+    if (args[0]->IsString()) {
+        v8::String::Utf8Value str(args[0]);
+
+        len = str.length();
+        bs = NewStorage(len);
+        memcpy(bs->bs_data_, *str, len);
+    } else {
+        if (!args[0]->IsUint32() || args[0]->Uint32Value() > kMaxLength) {
+            return v8::ThrowException(v8::Exception::RangeError(FormatString(
+                "Length must be an integer from 0 to %lu",
+                (unsigned long) kMaxLength
+            )));
+        }
+
+        len = args[0]->Uint32Value();
+        bs = NewStorage(len);
+    }
+
+    Buffer *buf = new Buffer(bs, bs->bs_data_, len);
+    buf->Wrap(args.This());
+
+    return args.This();
+}
+
+#define BUFFER_THIS(buf, args) \
+    do { \
+        if (!((buf) = Buffer::Unwrap((args).This()))) { \
+            return v8::ThrowException(v8::Exception::TypeError( \
+                v8::String::New("Receiver is not a Buffer") \
+            )); \
+        } \
+    } while (0)
+
+// Get a [start, end) range for a buffer of the given length from the given
+// arguments, defaulting to the whole buffer; negative values count back
+// from the end, and both are clamped to the buffer, as with Array.slice()
+static void
+RangeArgs(const v8::Arguments &args, size_t len, size_t *start,
+          size_t *end) {
+    double vals[] = { 0, (double) len };
+
+    for (int i = 0; i < 2; i++) {
+        if (args.Length() > i && !args[i]->IsUndefined()) {
+            vals[i] = args[i]->IntegerValue();
+        }
+
+        if (vals[i] < 0) {
+            vals[i] += len;
+        }
+
+        vals[i] = (vals[i] < 0) ? 0 : (vals[i] > len) ? len : vals[i];
+    }
+
+    *start = (size_t) vals[0];
+    *end = (vals[1] < vals[0]) ? *start : (size_t) vals[1];
+}
+
+// Buffer.prototype.slice()
+//
+// <buffer> = buffer.slice([<start>[, <end>]])
+//
+// Returns a buffer for bytes [start, end) of this one, sharing its memory:
+// writes to either are seen by both.
+static v8::Handle<v8::Value>
+BufferSlice(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Buffer *buf;
+    size_t start, end;
+
+    BUFFER_THIS(buf, args);
+    RangeArgs(args, buf->Length(), &start, &end);
+
+    return scope.Close(buf->Slice(start, end));
+}
+
+// Buffer.prototype.toString()
+//
+// <string> = buffer.toString([<start>[, <end>]])
+//
+// Returns bytes [start, end) of this buffer, decoded as UTF-8.
+static v8::Handle<v8::Value>
+BufferToString(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Buffer *buf;
+    size_t start, end;
+
+    BUFFER_THIS(buf, args);
+    RangeArgs(args, buf->Length(), &start, &end);
+
+    return scope.Close(
+        v8::String::New(buf->Data() + start, end - start)
+    );
+}
+
+// Getter for buffer.length
+static v8::Handle<v8::Value>
+BufferLength(v8::Local<v8::String> name, const v8::AccessorInfo &info) {
+    Buffer *buf = Buffer::Unwrap(info.Holder());
+
+    return v8::Integer::NewFromUnsigned((buf) ? buf->Length() : 0);
+}
+
+// Set buffer functions on the given target object
+void
+InitBuffers(v8::Handle<v8::Object> target) {
+    v8::HandleScope scope;
+
+    g_bufferTmpl = v8::Persistent<v8::FunctionTemplate>::New(
+        v8::FunctionTemplate::New(Buffer::Construct)
+    );
+    g_bufferTmpl->SetClassName(v8::String::NewSymbol("Buffer"));
+    g_bufferTmpl->InstanceTemplate()->SetInternalFieldCount(1);
+    g_bufferTmpl->InstanceTemplate()->SetAccessor(
+        v8::String::NewSymbol("length"),
+        BufferLength,
+        NULL,
+        v8::Handle<v8::Value>(),
+        v8::DEFAULT,
+        (v8::PropertyAttribute) (v8::ReadOnly | v8::DontDelete)
+    );
+
+    v8::Local<v8::ObjectTemplate> proto = g_bufferTmpl->PrototypeTemplate();
+    proto->Set(
+        v8::String::NewSymbol("slice"),
+        v8::FunctionTemplate::New(BufferSlice)
+    );
+    proto->Set(
+        v8::String::NewSymbol("toString"),
+        v8::FunctionTemplate::New(BufferToString)
+    );
+
+    target->Set(
+        v8::String::NewSymbol("Buffer"),
+        g_bufferTmpl->GetFunction(),
+        (v8::PropertyAttribute) (v8::ReadOnly | v8::DontDelete)
+    );
+}
@@ -0,0 +1,79 @@
+#ifndef __corona_buffer_h__
+#define __corona_buffer_h__
+
+#include <v8.h>
+
+struct BufferStorage;
+
+/**
+ * A run of bytes outside of the V8 heap, for moving data between sockets
+ * without turning it into strings and back.
+ *
+ * JavaScript sees a Buffer object whose elements are the bytes themselves
+ * (see v8::Object::SetIndexedPropertiesToExternalArrayData()), so buf[i]
+ * reads and writes the memory that the syscalls use. Slices share their
+ * parent's storage, which is freed once the last Buffer using it has been
+ * garbage collected. The storage is reported to V8 as external memory, so
+ * that lots of garbage buffers trigger a collection. Buffers of up to 64 KB
+ * are taken from the I/O buffer pool (see BufPoolGet()).
+ *
+ * Buffers belong to their JavaScript wrapper, and are deleted when it is
+ * garbage collected.
+ */
+class Buffer {
+    public:
+        /**
+         * Create a buffer of the given length, and return its wrapper. The
+         * bytes are not initialized.
+         */
+        static v8::Handle<v8::Object> New(size_t len);
+
+        /**
+         * Get the buffer represented by the given JavaScript value, or NULL
+         * if it isn't a buffer.
+         */
+        static Buffer *Unwrap(v8::Handle<v8::Value> val);
+
+        /**
+         * Our bytes.
+         */
+        char *Data(void) const;
+        size_t Length(void) const;
+
+        /**
+         * Create a buffer for bytes [start, end) of ours, sharing our
+         * storage, and return its wrapper.
+         */
+        v8::Handle<v8::Object> Slice(size_t start, size_t end);
+
+        /**
+         * The longest buffer that we can make; V8 indexes external arrays
+         * with an int.
+         */
+        static const size_t kMaxLength;
+
+    private:
+        Buffer(BufferStorage *bs, char *data, size_t len);
+        ~Buffer(void);
+
+        // Make the given object our wrapper
+        void Wrap(v8::Handle<v8::Object> obj);
+
+        static v8::Handle<v8::Value> Construct(const v8::Arguments &args);
+        static void WeakCB(v8::Persistent<v8::Value> obj, void *arg);
+
+        BufferStorage *bf_storage_;
+        char *bf_data_;
+        size_t bf_len_;
+
+        v8::Persistent<v8::Object> bf_obj_;
+
+        friend void InitBuffers(v8::Handle<v8::Object> target);
+};
+
+/**
+ * Set buffer-related functions on the given target object.
+ */
+void InitBuffers(v8::Handle<v8::Object> target);
+
+#endif /* __corona_buffer_h__ */
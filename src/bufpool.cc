@@ -0,0 +1,112 @@
+#include "bufpool.h"
+#include "corona.h"
+#include "v8-util.h"
+
+const size_t kBufPoolSizes[kBufPoolClasses] = { 4096, 16384, 65536 };
+
+// Free buffers of each class, linked through their first word
+struct FreeBuffer {
+    FreeBuffer *fb_next_;
+};
+
+static FreeBuffer *g_bufPoolFree[kBufPoolClasses];
+static BufPoolStats g_bufPoolStats[kBufPoolClasses];
+
+int
+BufPoolClass(size_t len) {
+    int cls = 0;
+
+    while (cls < kBufPoolClasses - 1 && kBufPoolSizes[cls] < len) {
+        cls++;
+    }
+
+    return cls;
+}
+
+// Carve a new slab up into free buffers of the given class
+static void
+AddSlab(int cls) {
+    size_t size = kBufPoolSizes[cls];
+    char *slab = new char[kBufPoolSlabSize];
+
+    for (size_t off = 0; off + size <= kBufPoolSlabSize; off += size) {
+        BufPoolPut(cls, slab + off);
+    }
+
+    g_bufPoolStats[cls].bps_resident_ += kBufPoolSlabSize;
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(kBufPoolSlabSize);
+}
+
+char *
+BufPoolGet(int cls) {
+    ASSERT(cls >= 0 && cls < kBufPoolClasses);
+
+    BufPoolStats *bps = &g_bufPoolStats[cls];
+
+    if (g_bufPoolFree[cls]) {
+        bps->bps_hits_++;
+    } else {
+        bps->bps_misses_++;
+        AddSlab(cls);
+    }
+
+    FreeBuffer *fb = g_bufPoolFree[cls];
+
+    g_bufPoolFree[cls] = fb->fb_next_;
+    bps->bps_free_--;
+
+    return (char*) fb;
+}
+
+void
+BufPoolPut(int cls, char *buf) {
+    ASSERT(cls >= 0 && cls < kBufPoolClasses);
+
+    FreeBuffer *fb = (FreeBuffer*) buf;
+
+    fb->fb_next_ = g_bufPoolFree[cls];
+    g_bufPoolFree[cls] = fb;
+    g_bufPoolStats[cls].bps_free_++;
+}
+
+const BufPoolStats &
+GetBufPoolStats(int cls) {
+    ASSERT(cls >= 0 && cls < kBufPoolClasses);
+
+    return g_bufPoolStats[cls];
+}
+
+// bufpoolstats()
+//
+// <stats> = bufpoolstats()
+//
+// Returns an array of counters for each size class of the I/O buffer pool,
+// smallest first: the buffer size, checkouts that found a free buffer
+// (hits) and those that needed a new slab (misses), the number of buffers
+// free, and the bytes of slabs that the class holds (resident).
+static v8::Handle<v8::Value>
+BufPoolStatsFunc(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    v8::Local<v8::Array> stats = v8::Array::New(kBufPoolClasses);
+
+    for (int i = 0; i < kBufPoolClasses; i++) {
+        const BufPoolStats *bps = &g_bufPoolStats[i];
+        v8::Local<v8::Object> cls = v8::Object::New();
+
+        SET_NUMBER(cls, "size", kBufPoolSizes[i]);
+        SET_NUMBER(cls, "hits", bps->bps_hits_);
+        SET_NUMBER(cls, "misses", bps->bps_misses_);
+        SET_NUMBER(cls, "free", bps->bps_free_);
+        SET_NUMBER(cls, "resident", bps->bps_resident_);
+        stats->Set(i, cls);
+    }
+
+    return scope.Close(stats);
+}
+
+// Set pool functions on the given target object
+void
+InitBufPool(v8::Handle<v8::Object> target) {
+    SET_FUNC(target, "bufpoolstats", BufPoolStatsFunc);
+}
@@ -0,0 +1,71 @@
+#ifndef __corona_bufpool_h__
+#define __corona_bufpool_h__
+
+#include <stddef.h>
+#include <v8.h>
+
+/**
+ * Pool of I/O buffers in a few size classes.
+ *
+ * Each class keeps a free list of buffers carved out of slabs of
+ * kBufPoolSlabSize bytes, so that reads don't go to malloc each time and
+ * the V8 heap is only told about new slabs (see
+ * v8::V8::AdjustAmountOfExternalAllocatedMemory()) rather than about every
+ * buffer. Slabs are never given back; the pool stays as big as the most
+ * buffers that have been checked out at once.
+ *
+ * Buffers should only be checked out for as long as they're needed. The
+ * read bindings take one once the fd has something to read, and put it
+ * back before blocking, so that idle connections hold none.
+ */
+static const int kBufPoolClasses = 3;
+
+/**
+ * The size of each class's buffers.
+ */
+extern const size_t kBufPoolSizes[kBufPoolClasses];
+
+/**
+ * The size of the slabs that buffers are carved out of.
+ */
+static const size_t kBufPoolSlabSize = 65536;
+
+/**
+ * Get the class of the smallest buffers holding the given number of bytes,
+ * or the largest class if none are that big.
+ */
+int BufPoolClass(size_t len);
+
+/**
+ * Check out a buffer of the given class, or put one back.
+ *
+ * The caller must hold the V8 lock.
+ */
+char *BufPoolGet(int cls);
+void BufPoolPut(int cls, char *buf);
+
+/**
+ * Counters for each size class of the pool.
+ *
+ * The number of checkouts that found a free buffer and those that had to
+ * carve up a new slab, the number of buffers free, and how many bytes
+ * of slabs the class has, whether checked out or not.
+ */
+struct BufPoolStats {
+    size_t bps_hits_;
+    size_t bps_misses_;
+    size_t bps_free_;
+    size_t bps_resident_;
+};
+
+/**
+ * Get the counters for the given class of the pool.
+ */
+const BufPoolStats &GetBufPoolStats(int cls);
+
+/**
+ * Set pool-related functions on the given target object.
+ */
+void InitBufPool(v8::Handle<v8::Object> target);
+
+#endif /* __corona_bufpool_h__ */
@@ -9,11 +9,16 @@
 #include <libgen.h>
 #include <ctype.h>
 #include <errno.h>
+#include <signal.h>
 #include <string>
 #include <list>
 #include <ev.h>
+#include "buffer.h"
+#include "bufpool.h"
 #include "corona.h"
+#include "future.h"
 #include "syscalls.h"
+#include "task.h"
 #include "sched.h"
 #include "v8-util.h"
 
@@ -58,9 +63,11 @@ CheckCB(struct ev_loop *el, struct ev_check *ep, int revents) {
         last_gc = ev_now(el);
     }
 
-    if ((g_current_thread = PopRunnableThread())) {
-        g_current_thread->Start();
-    }
+    // Top the thread pool back up while we're idle so that the next burst
+    // of callbacks doesn't hit the allocator
+    FillThreadPool();
+
+    RunTick();
 }
 
 // atexit() handler; tears down all global state
@@ -246,13 +253,60 @@ AppThread::Run2(void) {
     ASSERT(!val.IsEmpty());
 }
 
+// Print usage information
+static void
+Usage(FILE *fp) {
+    fprintf(fp,
+"usage: %s [options] <script>\n\n", g_execname);
+    fprintf(fp,
+"Run the given JavaScript file.\n\n");
+    fprintf(fp,
+"Options:\n");
+    fprintf(fp,
+"  -h                help\n");
+    fprintf(fp,
+"  -p <low>:<high>   idle coroutine pool watermarks; the pool is kept at\n"
+"                    <low> idle coroutines and never holds more than <high>\n"
+"                    (default: %lu:%lu)\n",
+        (unsigned long) kThreadPoolDefaultLow,
+        (unsigned long) kThreadPoolDefaultHigh);
+    fprintf(fp,
+"  -b <n>[:<usec>]   run at most <n> coroutines or <usec> microseconds\n"
+"                    before polling for I/O again; 0 is unlimited\n"
+"                    (default: %lu:%lu)\n",
+        (unsigned long) kTickBudgetDefaultThreads,
+        (unsigned long) kTickBudgetDefaultUsec);
+    fprintf(fp,
+"  -c <ms>[:<ms>]    preempt coroutines that run for the first <ms> of CPU\n"
+"                    time without yielding, and terminate those that run\n"
+"                    for the second without blocking; 0 is unlimited\n"
+"                    (default: 0:0)\n");
+    fprintf(fp,
+"  -S <policy>       scheduling policy: 'fifo', 'lifo' (most recently woken\n"
+"                    first) or 'priority' (by sys.schedclass()) (default:\n"
+"                    fifo)\n");
+    fprintf(fp,
+"  -s <KB>           default coroutine stack size; see sys.schedstats().stack\n"
+"                    for how much is actually used (default: %lu, minimum: %lu)\n",
+        (unsigned long) v8::internal::Thread::GetDefaultStackSize() / 1024,
+        (unsigned long) kStackSizeMin / 1024);
+}
+
 // TODO: Parse arguments using FlagList::SetFlagsFromCommandLine(); use '--' to
 //       delimit V8 options from corona options
 int
 main(int argc, char *argv[]) {
     char boot_path[MAXPATHLEN];
     struct ev_check check;
-    AppThread app_thread(argv[1]);
+    unsigned long pool_low = kThreadPoolDefaultLow;
+    unsigned long pool_high = kThreadPoolDefaultHigh;
+    unsigned long tick_threads = kTickBudgetDefaultThreads;
+    unsigned long tick_usec = kTickBudgetDefaultUsec;
+    unsigned long cpu_slice_ms = 0;
+    unsigned long cpu_limit_ms = 0;
+    unsigned long stack_kb = 0;
+    SchedPolicy *sched_policy = NULL;
+    int c;
 
     // Our cleanup handler is smart enough to avoid attempting to clean up
     // things that have not yet been initialized
@@ -260,6 +314,96 @@ main(int argc, char *argv[]) {
 
     g_execname = basename(argv[0]);
 
+    while ((c = getopt(argc, argv, "b:c:hp:s:S:")) != -1) {
+        switch (c) {
+        case 'b':
+            if (sscanf(optarg, "%lu:%lu", &tick_threads, &tick_usec) < 1) {
+                fprintf(
+                    stderr,
+                    "%s: invalid tick budget: %s\n",
+                        g_execname, optarg
+                );
+                return 1;
+            }
+            break;
+
+        case 'c':
+            if (sscanf(optarg, "%lu:%lu", &cpu_slice_ms, &cpu_limit_ms) < 1) {
+                fprintf(
+                    stderr,
+                    "%s: invalid CPU quota: %s\n",
+                        g_execname, optarg
+                );
+                return 1;
+            }
+            break;
+
+        case 'h':
+            Usage(stdout);
+            return 0;
+
+        case 'p':
+            if (sscanf(optarg, "%lu:%lu", &pool_low, &pool_high) != 2 ||
+                pool_low > pool_high) {
+                fprintf(
+                    stderr,
+                    "%s: invalid pool watermarks: %s\n",
+                        g_execname, optarg
+                );
+                return 1;
+            }
+            break;
+
+        case 's':
+            if (sscanf(optarg, "%lu", &stack_kb) != 1 ||
+                stack_kb * 1024 < kStackSizeMin) {
+                fprintf(
+                    stderr,
+                    "%s: invalid stack size: %s\n",
+                        g_execname, optarg
+                );
+                return 1;
+            }
+            break;
+
+        case 'S':
+            if (!(sched_policy = NewSchedPolicy(optarg))) {
+                fprintf(
+                    stderr,
+                    "%s: invalid scheduling policy: %s\n",
+                        g_execname, optarg
+                );
+                return 1;
+            }
+            break;
+
+        default:
+            Usage(stderr);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        Usage(stderr);
+        return 1;
+    }
+
+    // Before creating any threads
+    if (stack_kb) {
+        SetDefaultStackSize(stack_kb * 1024);
+    }
+
+    // On the heap: once the script returns, the thread is reaped like any
+    // other, while tasks that it spawned may still be running
+    AppThread *app_thread = new AppThread(argv[optind]);
+
+    SetThreadPoolWatermarks(pool_low, pool_high);
+    SetTickBudget(tick_threads, tick_usec);
+    SetCpuQuota(cpu_slice_ms / 1000.0, cpu_limit_ms / 1000.0);
+    if (sched_policy) {
+        SetSchedPolicy(sched_policy);
+    }
+
     // Initialize V8
     {
         v8::Locker lock;
@@ -276,6 +420,11 @@ main(int argc, char *argv[]) {
             CreateNamespace(g_v8Ctx->Global(), v8::String::New("sys"))
         );
         InitSyscalls(g_sysObj);
+        InitSched(g_sysObj);
+        InitFutures(g_sysObj);
+        InitTasks(g_sysObj);
+        InitBuffers(g_sysObj);
+        InitBufPool(g_sysObj);
 
         // Run the bootloader, boot.js
         if (!GetBootLibPath(boot_path, sizeof(boot_path))) {
@@ -289,6 +438,10 @@ main(int argc, char *argv[]) {
         }
     }
 
+    // Writes to connections that the other end has closed fail with EPIPE,
+    // rather than killing us; write() may be flushing in the background
+    signal(SIGPIPE, SIG_IGN);
+
     // Initialize the event loop and add our first thread
    
     g_loop = ev_default_loop(EVFLAG_AUTO);
@@ -297,7 +450,7 @@ main(int argc, char *argv[]) {
     ev_check_start(g_loop, &check);
     ev_unref(g_loop);
 
-    ScheduleRunnableThread(&app_thread);
+    ScheduleRunnableThread(app_thread);
 
     ev_loop(g_loop, 0);
     ev_default_destroy();
@@ -0,0 +1,375 @@
+#include <errno.h>
+#include "corona.h"
+#include "future.h"
+#include "sched.h"
+#include "v8-util.h"
+
+// Template for the JavaScript objects wrapping futures; see Future::Wrap()
+static v8::Persistent<v8::FunctionTemplate> g_futureTmpl;
+
+// Wait lists longer than this are copied to the heap; see WaitFutures()
+static const size_t kWaitFuturesStack = 32;
+
+Future::Future(void) :
+    fu_waiter_(NULL),
+    fu_claimed_(false),
+    fu_done_(false),
+    fu_result_(-1),
+    fu_error_(0) {
+    ev_init(&this->fu_io_.fu_w_, Future::IOReadyCB);
+    this->fu_io_.fu_self_ = this;
+    ev_init(&this->fu_timer_.fu_w_, Future::TimeoutCB);
+    this->fu_timer_.fu_self_ = this;
+}
+
+Future::~Future(void) {
+    // Anyone waiting on us would be holding a reference to our wrapper
+    ASSERT(this->fu_waiter_ == NULL);
+
+    this->Unwatch();
+}
+
+bool
+Future::Done(void) const {
+    return this->fu_done_;
+}
+
+int
+Future::Result(void) {
+    ASSERT(this->fu_done_);
+
+    this->fu_claimed_ = true;
+    return this->fu_result_;
+}
+
+int
+Future::Error(void) const {
+    ASSERT(this->fu_done_);
+
+    return this->fu_error_;
+}
+
+void
+Future::Complete(int result, int err) {
+    ASSERT(!this->fu_done_);
+
+    this->Unwatch();
+
+    this->fu_done_ = true;
+    this->fu_result_ = result;
+    this->fu_error_ = err;
+
+    if (this->fu_waiter_) {
+        CoronaThread *ct = this->fu_waiter_;
+
+        this->fu_waiter_ = NULL;
+        ct->FutureDone();
+    }
+}
+
+void
+Future::WatchFd(int fd, int events, ev_tstamp timeout) {
+    ASSERT(!this->fu_done_);
+
+    // Futures are usually one-offs (e.g. a connect), so unlike
+    // CoronaThread::YieldIO() there's no point sharing a watcher per fd
+    this->Unwatch();
+
+    ev_io_set(&this->fu_io_.fu_w_, fd, events);
+    ev_io_start(g_loop, &this->fu_io_.fu_w_);
+
+    if (timeout >= 0) {
+        ev_timer_set(&this->fu_timer_.fu_w_, timeout, 0);
+        ev_timer_start(g_loop, &this->fu_timer_.fu_w_);
+    }
+}
+
+void
+Future::Unwatch(void) {
+    ev_io_stop(g_loop, &this->fu_io_.fu_w_);
+    ev_timer_stop(g_loop, &this->fu_timer_.fu_w_);
+}
+
+void
+Future::IOReadyCB(struct ev_loop *el, struct ev_io *w, int revents) {
+    Future *self = ((struct fu_io*) w)->fu_self_;
+
+    if (revents & EV_ERROR) {
+        self->Complete(-1, EBADF);
+        return;
+    }
+
+    self->Ready();
+}
+
+void
+Future::TimeoutCB(struct ev_loop *el, struct ev_timer *w, int revents) {
+    Future *self = ((struct fu_timer*) w)->fu_self_;
+
+    self->Complete(-1, ETIMEDOUT);
+}
+
+v8::Handle<v8::Object>
+Future::Wrap(void) {
+    return this->Wrap(g_futureTmpl);
+}
+
+v8::Handle<v8::Object>
+Future::Wrap(v8::Handle<v8::FunctionTemplate> tmpl) {
+    v8::HandleScope scope;
+
+    ASSERT(this->fu_obj_.IsEmpty());
+
+    v8::Local<v8::Object> obj = tmpl->InstanceTemplate()->NewInstance();
+    obj->SetInternalField(0, v8::External::New(this));
+
+    this->fu_obj_ = v8::Persistent<v8::Object>::New(obj);
+    this->fu_obj_.MakeWeak(this, Future::WeakCB);
+
+    return scope.Close(obj);
+}
+
+Future *
+Future::Unwrap(v8::Handle<v8::Value> val) {
+    if (!g_futureTmpl->HasInstance(val)) {
+        return NULL;
+    }
+
+    v8::Handle<v8::Object> obj = v8::Handle<v8::Object>::Cast(val);
+    return (Future*) v8::External::Unwrap(obj->GetInternalField(0));
+}
+
+// Our wrapper is garbage; nobody can ask for our result any more
+void
+Future::WeakCB(v8::Persistent<v8::Value> obj, void *arg) {
+    Future *self = (Future*) arg;
+
+    ASSERT(self->fu_obj_ == obj);
+
+    self->fu_obj_.Dispose();
+    self->fu_obj_.Clear();
+    delete self;
+}
+
+v8::Handle<v8::FunctionTemplate>
+FutureTemplate(void) {
+    return g_futureTmpl;
+}
+
+bool
+FutureMode(void) {
+    return g_current_thread && g_current_thread->GetFutureMode();
+}
+
+// Wait for all or any of the futures in the given array
+static v8::Handle<v8::Value>
+WaitFutures(const v8::Arguments &args, bool all) {
+    v8::HandleScope scope;
+
+    v8::Local<v8::Array> arr;
+    ev_tstamp timeout = -1;
+    Future *stack_futs[kWaitFuturesStack];
+    Future **futs = stack_futs;
+    int err;
+
+    V8_ARG_EXISTS(args, 0);
+    V8_ARG_TYPE(args, 0, Array);
+    arr = v8::Local<v8::Array>::Cast(args[0]);
+
+    if (args.Length() > 1) {
+        double ms = 0;
+
+        V8_ARG_VALUE(ms, args, 1, Number);
+        timeout = ms / 1000.0;
+    }
+
+    size_t len = arr->Length();
+    if (!all && len == 0) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Nothing to wait for")
+        ));
+    }
+
+    if (len > kWaitFuturesStack) {
+        futs = new Future*[len];
+    }
+
+    v8::Handle<v8::Value> exc;
+
+    for (size_t i = 0; i < len && exc.IsEmpty(); i++) {
+        if (!(futs[i] = Future::Unwrap(arr->Get(i)))) {
+            exc = v8::Exception::TypeError(FormatString(
+                "Element %lu is not a Future", (unsigned long) i
+            ));
+        } else if (futs[i]->fu_waiter_ &&
+                   futs[i]->fu_waiter_ != g_current_thread) {
+            exc = v8::Exception::Error(FormatString(
+                "Element %lu is already being waited on", (unsigned long) i
+            ));
+        }
+    }
+
+    if (!exc.IsEmpty()) {
+        if (futs != stack_futs) {
+            delete[] futs;
+        }
+
+        return v8::ThrowException(exc);
+    }
+
+    err = g_current_thread->WaitFutures(futs, len, all, timeout);
+
+    // For waitAny(), the first one that's done
+    int idx = 0;
+    if (!all && err == 0) {
+        while (idx < (int) len && !futs[idx]->Done()) {
+            idx++;
+        }
+
+        ASSERT(idx < (int) len);
+    }
+
+    if (futs != stack_futs) {
+        delete[] futs;
+    }
+
+    return scope.Close(v8::Integer::New((err < 0) ? err : idx));
+}
+
+// waitAll()
+//
+// <err> = waitAll(<futures>[, <timeout>])
+//
+// Blocks the calling coroutine until all of the futures in the given array
+// are done; their results can then be had without blocking. Returns 0, or
+// -1 with errno set to ETIMEDOUT if the timeout (in milliseconds) expired
+// first.
+static v8::Handle<v8::Value>
+WaitAll(const v8::Arguments &args) {
+    return WaitFutures(args, true);
+}
+
+// waitAny()
+//
+// <index> = waitAny(<futures>[, <timeout>])
+//
+// Blocks the calling coroutine until any of the futures in the given array
+// is done, and returns the index of the first that is. Returns -1 with
+// errno set to ETIMEDOUT if the timeout (in milliseconds) expired first.
+static v8::Handle<v8::Value>
+WaitAny(const v8::Arguments &args) {
+    return WaitFutures(args, false);
+}
+
+// futuremode()
+//
+// <old mode> = futuremode([<mode>])
+//
+// Returns whether the calling coroutine is in future mode, first setting
+// the mode if one is given. In future mode, calls that would otherwise
+// block the coroutine (e.g. accept() without a callback, or connect())
+// return a Future instead. Coroutines start out in blocking mode.
+static v8::Handle<v8::Value>
+FutureModeFunc(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    bool old_mode = g_current_thread->GetFutureMode();
+    bool mode = old_mode;
+
+    if (args.Length() > 0) {
+        V8_ARG_VALUE(mode, args, 0, Boolean);
+    }
+
+    g_current_thread->SetFutureMode(mode);
+    return scope.Close(v8::Boolean::New(old_mode));
+}
+
+// Future.prototype.get()
+//
+// <result> = future.get([<timeout>])
+//
+// Returns the result of the call that returned this future, blocking the
+// calling coroutine until it is done, and sets errno as the call would
+// have. If the timeout (in milliseconds) expires first, returns -1 with
+// errno set to ETIMEDOUT; the call carries on.
+static v8::Handle<v8::Value>
+FutureGet(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Future *fut = Future::Unwrap(args.This());
+    ev_tstamp timeout = -1;
+
+    if (!fut) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Receiver is not a Future")
+        ));
+    }
+
+    if (args.Length() > 0) {
+        double ms = 0;
+
+        V8_ARG_VALUE(ms, args, 0, Number);
+        timeout = ms / 1000.0;
+    }
+
+    if (fut->fu_waiter_ && fut->fu_waiter_ != g_current_thread) {
+        return v8::ThrowException(v8::Exception::Error(
+            v8::String::New("Future is already being waited on")
+        ));
+    }
+
+    if (g_current_thread->WaitFutures(&fut, 1, true, timeout) < 0) {
+        return scope.Close(v8::Integer::New(-1));
+    }
+
+    int result = fut->Result();
+    errno = fut->Error();
+    return scope.Close(v8::Integer::New(result));
+}
+
+// Future.prototype.done()
+//
+// <done> = future.done()
+//
+// Returns whether the call that returned this future is done, without
+// blocking.
+static v8::Handle<v8::Value>
+FutureIsDone(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Future *fut = Future::Unwrap(args.This());
+
+    if (!fut) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Receiver is not a Future")
+        ));
+    }
+
+    return scope.Close(v8::Boolean::New(fut->Done()));
+}
+
+// Set future functions on the given target object
+void
+InitFutures(v8::Handle<v8::Object> target) {
+    v8::HandleScope scope;
+
+    g_futureTmpl = v8::Persistent<v8::FunctionTemplate>::New(
+        v8::FunctionTemplate::New()
+    );
+    g_futureTmpl->SetClassName(v8::String::NewSymbol("Future"));
+    g_futureTmpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    v8::Local<v8::ObjectTemplate> proto = g_futureTmpl->PrototypeTemplate();
+    proto->Set(
+        v8::String::NewSymbol("get"),
+        v8::FunctionTemplate::New(FutureGet)
+    );
+    proto->Set(
+        v8::String::NewSymbol("done"),
+        v8::FunctionTemplate::New(FutureIsDone)
+    );
+
+    SET_FUNC(target, "futuremode", FutureModeFunc);
+    SET_FUNC(target, "waitAll", WaitAll);
+    SET_FUNC(target, "waitAny", WaitAny);
+}
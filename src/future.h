@@ -0,0 +1,141 @@
+#ifndef __corona_future_h__
+#define __corona_future_h__
+
+#include <ev.h>
+#include <v8.h>
+
+class CoronaThread;
+
+/**
+ * The pending result of a nominally blocking call.
+ *
+ * A coroutine in future mode (see sys.futuremode()) gets one of these back
+ * from a call that would otherwise block it, and carries on. The operation
+ * is driven to completion from the event loop in the meantime, without a
+ * coroutine of its own; the coroutine only blocks once it asks for the
+ * result, or waits for this and other futures at once (see
+ * CoronaThread::WaitFutures()).
+ *
+ * Results are kept as the syscall return value and errno, rather than as
+ * JavaScript values, since the event loop completes futures without
+ * holding the V8 lock.
+ *
+ * Futures belong to their JavaScript wrapper (see Wrap()), and are deleted
+ * when it is garbage collected, abandoning the operation if it is still
+ * pending.
+ */
+class Future {
+    public:
+        Future(void);
+        virtual ~Future(void);
+
+        /**
+         * Has the operation finished?
+         */
+        bool Done(void) const;
+
+        /**
+         * The operation's result and errno. Must be Done().
+         *
+         * Subclasses whose result is a resource (e.g. an fd) may want to
+         * release it if it is never asked for; see fu_claimed_.
+         */
+        int Result(void);
+        int Error(void) const;
+
+        /**
+         * Create the JavaScript object representing this future, which owns
+         * it from then on.
+         */
+        v8::Handle<v8::Object> Wrap(void);
+
+        /**
+         * Get the future represented by the given JavaScript value, or NULL
+         * if it isn't a future.
+         */
+        static Future *Unwrap(v8::Handle<v8::Value> val);
+
+        /**
+         * The thread blocked waiting for us, if any; see
+         * CoronaThread::WaitFutures(). A future can only have one waiter at
+         * a time.
+         */
+        CoronaThread *fu_waiter_;
+
+    protected:
+        /**
+         * Wrap() for subclasses with a JavaScript class of their own, whose
+         * template must inherit from FutureTemplate().
+         */
+        v8::Handle<v8::Object> Wrap(v8::Handle<v8::FunctionTemplate> tmpl);
+
+        /**
+         * Finish the operation, waking our waiter if this was the last
+         * thing that it was waiting for.
+         */
+        void Complete(int result, int err);
+
+        /**
+         * Have Ready() called once the given fd is readable (EV_READ) or
+         * writable (EV_WRITE).
+         *
+         * If 'timeout' is non-negative, give up after that many seconds and
+         * fail with ETIMEDOUT.
+         */
+        void WatchFd(int fd, int events, ev_tstamp timeout = -1);
+
+        /**
+         * The fd passed to WatchFd() is ready; subclasses retry their
+         * operation and Complete() or WatchFd() again.
+         */
+        virtual void Ready(void) = 0;
+
+        /**
+         * Has Result() been called? Set even if nobody has asked for the
+         * result, if the caller has taken responsibility for it anyway.
+         */
+        bool fu_claimed_;
+
+    private:
+        void Unwatch(void);
+        static void IOReadyCB(struct ev_loop *el, struct ev_io *w,
+                              int revents);
+        static void TimeoutCB(struct ev_loop *el, struct ev_timer *w,
+                              int revents);
+        static void WeakCB(v8::Persistent<v8::Value> obj, void *arg);
+
+        // Watchers for WatchFd(), with a reference back to us so that the
+        // callbacks can cast back to get it
+        struct fu_io {
+            struct ev_io fu_w_;
+            Future *fu_self_;
+        } fu_io_;
+
+        struct fu_timer {
+            struct ev_timer fu_w_;
+            Future *fu_self_;
+        } fu_timer_;
+
+        bool fu_done_;
+        int fu_result_;
+        int fu_error_;
+
+        v8::Persistent<v8::Object> fu_obj_;
+};
+
+/**
+ * The template for JavaScript Future objects; see Future::Wrap().
+ */
+v8::Handle<v8::FunctionTemplate> FutureTemplate(void);
+
+/**
+ * Does the calling coroutine want futures from blocking calls?
+ */
+bool FutureMode(void);
+
+/**
+ * Set future-related functions on the given target object.
+ */
+void InitFutures(v8::Handle<v8::Object> target);
+
+#endif /* __corona_future_h__ */
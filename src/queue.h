@@ -0,0 +1,200 @@
+#ifndef __corona_queue_h__
+#define __corona_queue_h__
+
+#include <stddef.h>
+
+/**
+ * Linkage for an intrusive, doubly-linked queue.
+ *
+ * Objects that want to live on a Queue embed one of these and hand the
+ * Queue template a pointer to the member. No memory is allocated when an
+ * object is enqueued or dequeued.
+ *
+ * The ql_queue_ field records which queue (if any) the object is on. This
+ * doubles as an "already queued" flag, so pushing an object that is already
+ * on a queue is a cheap no-op rather than a corruption of the list.
+ */
+template <typename T>
+struct QueueLink {
+    QueueLink(void) : ql_next_(NULL), ql_prev_(NULL), ql_queue_(NULL) {}
+
+    T *ql_next_;
+    T *ql_prev_;
+    const void *ql_queue_;
+};
+
+/**
+ * Intrusive queue of T, linked through the QueueLink<T> member L.
+ *
+ * All operations are O(1).
+ */
+template <typename T, QueueLink<T> T::*L>
+class Queue {
+    public:
+        Queue(void) : head_(NULL), tail_(NULL), size_(0) {}
+
+        bool Empty(void) const {
+            return head_ == NULL;
+        }
+
+        size_t Size(void) const {
+            return size_;
+        }
+
+        T *Front(void) const {
+            return head_;
+        }
+
+        /**
+         * The object after the given one on whatever queue it is on, or
+         * NULL if it is last.
+         */
+        static T *Next(const T *t) {
+            return (t->*L).ql_next_;
+        }
+
+        /**
+         * Is the given object on this queue?
+         */
+        bool Contains(const T *t) const {
+            return (t->*L).ql_queue_ == this;
+        }
+
+        /**
+         * Is the given object on any queue linked through L?
+         */
+        static bool IsQueued(const T *t) {
+            return (t->*L).ql_queue_ != NULL;
+        }
+
+        /**
+         * Unlink an object from whichever queue linked through L it is on;
+         * returns false if it was not queued.
+         */
+        static bool Unlink(T *t) {
+            Queue *q = static_cast<Queue*>(
+                const_cast<void*>((t->*L).ql_queue_)
+            );
+
+            return q && q->Remove(t);
+        }
+
+        /**
+         * Append an object; returns false if it was already queued.
+         */
+        bool PushBack(T *t) {
+            QueueLink<T> *l = &(t->*L);
+
+            if (l->ql_queue_) {
+                return false;
+            }
+
+            l->ql_queue_ = this;
+            l->ql_next_ = NULL;
+            l->ql_prev_ = tail_;
+
+            if (tail_) {
+                (tail_->*L).ql_next_ = t;
+            } else {
+                head_ = t;
+            }
+
+            tail_ = t;
+            size_++;
+
+            return true;
+        }
+
+        /**
+         * Prepend an object; returns false if it was already queued.
+         */
+        bool PushFront(T *t) {
+            QueueLink<T> *l = &(t->*L);
+
+            if (l->ql_queue_) {
+                return false;
+            }
+
+            l->ql_queue_ = this;
+            l->ql_prev_ = NULL;
+            l->ql_next_ = head_;
+
+            if (head_) {
+                (head_->*L).ql_prev_ = t;
+            } else {
+                tail_ = t;
+            }
+
+            head_ = t;
+            size_++;
+
+            return true;
+        }
+
+        /**
+         * Remove and return the first object, or NULL if we're empty.
+         */
+        T *PopFront(void) {
+            T *t = head_;
+
+            if (t) {
+                Remove(t);
+            }
+
+            return t;
+        }
+
+        /**
+         * Remove and return the last object, or NULL if we're empty.
+         */
+        T *PopBack(void) {
+            T *t = tail_;
+
+            if (t) {
+                Remove(t);
+            }
+
+            return t;
+        }
+
+        /**
+         * Unlink an object; returns false if it was not on this queue.
+         */
+        bool Remove(T *t) {
+            QueueLink<T> *l = &(t->*L);
+
+            if (l->ql_queue_ != this) {
+                return false;
+            }
+
+            if (l->ql_prev_) {
+                (l->ql_prev_->*L).ql_next_ = l->ql_next_;
+            } else {
+                head_ = l->ql_next_;
+            }
+
+            if (l->ql_next_) {
+                (l->ql_next_->*L).ql_prev_ = l->ql_prev_;
+            } else {
+                tail_ = l->ql_prev_;
+            }
+
+            l->ql_next_ = NULL;
+            l->ql_prev_ = NULL;
+            l->ql_queue_ = NULL;
+            size_--;
+
+            return true;
+        }
+
+    private:
+        T *head_;
+        T *tail_;
+        size_t size_;
+
+        // Not copyable; objects point back at us
+        Queue(const Queue &);
+        Queue &operator=(const Queue &);
+};
+
+#endif /* __corona_queue_h__ */
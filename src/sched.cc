@@ -1,41 +1,659 @@
-#include <list>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include "corona.h"
+#include "future.h"
+#include "task.h"
 #include "sched.h"
 
 CoronaThread *g_current_thread = NULL;
 
-static std::list<CoronaThread*> g_runnableThreads;
-static std::list<CoronaThread*> g_zombieThreads;
+// Built-in scheduling policies; see NewSchedPolicy()
+class FifoSchedPolicy : public SchedPolicy {
+    public:
+        const char *Name(void) const {
+            return "fifo";
+        }
 
-CoronaThread *
-PopRunnableThread(void) {
-    CoronaThread *next;
+        bool Push(CoronaThread *ct) {
+            return queue_.PushBack(ct);
+        }
 
-    if (g_runnableThreads.empty()) {
-        next = NULL;
-    } else {
-        next = g_runnableThreads.front();
-        g_runnableThreads.pop_front();
+        CoronaThread *Pop(void) {
+            return queue_.PopFront();
+        }
+
+        bool Remove(CoronaThread *ct) {
+            return queue_.Remove(ct);
+        }
+
+        size_t Size(void) const {
+            return queue_.Size();
+        }
+
+    private:
+        CoronaThreadQueue queue_;
+};
+
+class LifoSchedPolicy : public SchedPolicy {
+    public:
+        const char *Name(void) const {
+            return "lifo";
+        }
+
+        bool Push(CoronaThread *ct) {
+            return queue_.PushFront(ct);
+        }
+
+        CoronaThread *Pop(void) {
+            return queue_.PopFront();
+        }
+
+        bool Remove(CoronaThread *ct) {
+            return queue_.Remove(ct);
+        }
+
+        size_t Size(void) const {
+            return queue_.Size();
+        }
+
+    private:
+        CoronaThreadQueue queue_;
+};
+
+class PrioritySchedPolicy : public SchedPolicy {
+    public:
+        PrioritySchedPolicy(void) : size_(0) {}
+
+        const char *Name(void) const {
+            return "priority";
+        }
+
+        bool Push(CoronaThread *ct) {
+            if (!queues_[ct->GetSchedClass()].PushBack(ct)) {
+                return false;
+            }
+
+            size_++;
+            return true;
+        }
+
+        CoronaThread *Pop(void) {
+            CoronaThread *ct;
+
+            for (int i = 0; i < kSchedClasses; i++) {
+                if ((ct = queues_[i].PopFront())) {
+                    size_--;
+                    return ct;
+                }
+            }
+
+            return NULL;
+        }
+
+        bool Remove(CoronaThread *ct) {
+            if (!queues_[ct->GetSchedClass()].Remove(ct)) {
+                return false;
+            }
+
+            size_--;
+            return true;
+        }
+
+        size_t Size(void) const {
+            return size_;
+        }
+
+    private:
+        CoronaThreadQueue queues_[kSchedClasses];
+        size_t size_;
+};
+
+// Runnable threads, in whatever order the policy likes
+static FifoSchedPolicy g_fifoPolicy;
+static SchedPolicy *g_schedPolicy = &g_fifoPolicy;
+static SchedClassStats g_schedClassStats[kSchedClasses];
+
+static CoronaThreadQueue g_zombieThreads;
+
+// Idle CallbackThread objects, waiting to be handed a new callback
+static CoronaThreadQueue g_pooledThreads;
+static size_t g_poolLowWatermark = kThreadPoolDefaultLow;
+static size_t g_poolHighWatermark = kThreadPoolDefaultHigh;
+static ThreadPoolStats g_poolStats;
+
+// Per-fd I/O watcher.
+//
+// These are created on the first YieldIO() on an fd and stay armed across
+// waits, so a coroutine that keeps waiting on the same fd (e.g. an accept
+// loop) does not cost an epoll_ctl(2) or kevent(2) per wait. The interest
+// set is only changed when a waiter wants an event that isn't registered
+// yet, or when an event fires that nobody is waiting for.
+//
+// The ev_io must be the first member; IOReadyCB() casts back from it.
+struct FdWatcher {
+    struct ev_io fw_io_;
+
+    // Threads blocked in YieldIO() on this fd, by direction
+    CoronaThreadQueue fw_readers_;
+    CoronaThreadQueue fw_writers_;
+
+    // Select() cases and Poll() fds on this fd, which have watchers of
+    // their own but fail along with the threads above when the fd goes
+    // away
+    SelectCaseQueue fw_cases_;
+    PollFdQueue fw_pollfds_;
+
+    // Have we ev_unref()'d the loop on behalf of this watcher?
+    bool fw_unref_;
+};
+
+// Per-tick budget; see SetTickBudget()
+static size_t g_tickBudgetThreads = kTickBudgetDefaultThreads;
+static size_t g_tickBudgetUsec = kTickBudgetDefaultUsec;
+static TickStats g_tickStats;
+
+// State of the current tick. g_tickNow is when the running thread was
+// popped off of the run queue; see SchedNow().
+static ev_tstamp g_tickStart = 0;
+static ev_tstamp g_tickNow = 0;
+static size_t g_tickThreads = 0;
+static bool g_tickExhausted = false;
+
+// Active whenever we return to the event loop with runnable threads left
+// over, so that it polls without blocking
+static struct ev_idle g_tickIdle;
+
+// Timeouts for Sleep() and YieldIO().
+//
+// Rather than each waiting thread starting an ev_timer of its own, which
+// costs O(log n) in libev's heap to arm and again to cancel, threads arm a
+// WheelTimer on g_timerWheel and a single ev_timer wakes us up when the
+// wheel next has something to do. Most timeouts are cancelled long before
+// they fire, and cancelling doesn't touch the ev_timer at all.
+//
+// Wheel ticks are milliseconds since g_timerEpoch.
+static const ev_tstamp kTimerTick = 0.001;
+static TimerWheel g_timerWheel;
+static ev_tstamp g_timerEpoch = 0;
+static struct ev_timer g_timerDriver;
+static uint64_t g_timerDriverExpiry = TimerWheel::kNever;
+
+static StackStats g_stackStats;
+
+// CPU quotas; see SetCpuQuota().
+//
+// The SIGVTALRM timer ticks every kCpuTimerUsec of CPU time that we use.
+// g_cpuArmed says whether CpuTimerCB() may ask g_current_thread to stop at
+// its next safe point, where PreemptCB() works out whether it has to; it is
+// set while that thread holds the V8 lock (or is about to get it back, in
+// PreemptCB()). Since the thread starts a new slice every time it takes the
+// lock, g_cpuSliceStart is the CPU clock at the start of that slice.
+static const uint64_t kCpuTimerUsec = 1000;
+static uint64_t g_cpuSliceUsec = 0;
+static uint64_t g_cpuLimitUsec = 0;
+static uint64_t g_cpuSliceStart = 0;
+static volatile sig_atomic_t g_cpuArmed = 0;
+static CpuStats g_cpuStats;
+
+// Threads preempted during the current tick. These don't go back on the run
+// queue until the next tick, so that they are behind whatever the event
+// loop wakes up in the meantime.
+static CoronaThreadQueue g_preemptedThreads;
+
+// Where Select() starts looking for a case that's ready; bumped on every
+// call so that the same case doesn't always win
+static size_t g_selectRotor = 0;
+
+// Template for the JavaScript objects wrapping channels; see
+// Channel::Wrap()
+static v8::Persistent<v8::FunctionTemplate> g_channelTmpl;
+
+// Selects with more cases than this copy them to the heap; see SelectFunc()
+static const size_t kSelectStack = 16;
+
+// A callback waiting for its fd to become readable; see CallWhenReadable().
+//
+// The ev_io must be the first member; LazyReadyCB() casts back from it.
+struct LazyCallback {
+    struct ev_io lc_io_;
+
+    struct lc_timer {
+        WheelTimer lc_w_;
+        LazyCallback *lc_self_;
+    } lc_timer_;
+
+    v8::Persistent<v8::Function> lc_cb_;
+    int lc_sched_class_;
+    CallbackLimit *lc_limit_;
+};
+
+static LazyCallbackStats g_lazyStats;
+
+// Watchers indexed by fd; grown on demand and never shrunk, since fd
+// numbers are re-used
+static FdWatcher **g_fdWatchers = NULL;
+static int g_fdWatchersLen = 0;
+
+// The time as far as run queue waits and the tick budget are concerned:
+// when the running thread was popped, or when the event loop last polled
+// if none is. Either is at most one thread's run out of date, and saves
+// reading the clock on every push.
+static ev_tstamp
+SchedNow(void) {
+    return (g_current_thread) ? g_tickNow : ev_now(g_loop);
+}
+
+// Count how long the given thread waited to run, now that it's about to;
+// whoever popped it has just set g_tickNow
+static void
+CountRunnableWait(CoronaThread *ct) {
+    SchedClassStats *scs = &g_schedClassStats[ct->GetSchedClass()];
+    ev_tstamp waited = g_tickNow - ct->ct_runnable_since_;
+    size_t usec = (waited > 0) ? (size_t) (waited * 1e6) : 0;
+    size_t b = 0;
+
+    while (b < kSchedWaitBuckets - 1 && (usec >> b)) {
+        b++;
     }
 
-    while (!g_zombieThreads.empty()) {
-        CoronaThread *zt = g_zombieThreads.front();
-        g_zombieThreads.pop_front();
+    scs->scs_runs_++;
+    scs->scs_wait_usec_ += usec;
+    scs->scs_wait_hist_[b]++;
+    if (usec > scs->scs_wait_usec_max_) {
+        scs->scs_wait_usec_max_ = usec;
+    }
+}
+
+CoronaThread *
+PopRunnableThread(void) {
+    CoronaThread *next = g_schedPolicy->Pop();
+    CoronaThread *zt;
 
+    while ((zt = g_zombieThreads.PopFront())) {
         delete zt;
     }
 
+    if (next) {
+        CountRunnableWait(next);
+    }
+
     return next;
 }
 
 void
 ScheduleRunnableThread(CoronaThread *ct) {
-    g_runnableThreads.push_back(ct);
+    if (g_schedPolicy->Push(ct)) {
+        ct->ct_runnable_since_ = SchedNow();
+    }
+
+    // Woken by a watcher, which libev may call after our ev_check on the
+    // same pass through the loop; with nothing else active, ev_loop() would
+    // return before the thread ever ran
+    if (!g_current_thread && !ev_is_active(&g_tickIdle)) {
+        ev_idle_start(g_loop, &g_tickIdle);
+    }
+}
+
+SchedPolicy *
+NewSchedPolicy(const char *name) {
+    if (!strcmp(name, "fifo")) {
+        return new FifoSchedPolicy();
+    } else if (!strcmp(name, "lifo")) {
+        return new LifoSchedPolicy();
+    } else if (!strcmp(name, "priority")) {
+        return new PrioritySchedPolicy();
+    }
+
+    return NULL;
+}
+
+void
+SetSchedPolicy(SchedPolicy *policy) {
+    CoronaThread *ct;
+
+    ASSERT(policy);
+
+    // Keep their timestamps; they've been waiting all along
+    while ((ct = g_schedPolicy->Pop())) {
+        policy->Push(ct);
+    }
+
+    g_schedPolicy = policy;
+}
+
+const SchedClassStats &
+GetSchedClassStats(int cls) {
+    ASSERT(cls >= 0 && cls < kSchedClasses);
+
+    return g_schedClassStats[cls];
+}
+
+// Has this tick used up its budget, so that we should give the event loop
+// a chance to poll before running anything else?
+static bool
+TickExhausted(void) {
+    if (g_tickBudgetThreads && g_tickThreads >= g_tickBudgetThreads) {
+        g_tickExhausted = true;
+        return true;
+    }
+
+    if (g_tickBudgetUsec &&
+        (g_tickNow - g_tickStart) * 1e6 >= g_tickBudgetUsec) {
+        g_tickExhausted = true;
+        return true;
+    }
+
+    return false;
+}
+
+// Pop the next thread to run in this tick. Returns NULL if there are none,
+// or if the tick has used up its budget and we should give the event loop
+// a chance to poll.
+static CoronaThread *
+PopTickThread(void) {
+    g_tickNow = ev_time();
+
+    if (TickExhausted()) {
+        return NULL;
+    }
+
+    CoronaThread *ct = PopRunnableThread();
+    if (ct) {
+        g_tickThreads++;
+    }
+
+    return ct;
+}
+
+static void
+TickIdleCB(struct ev_loop *el, struct ev_idle *ep, int revents) {
+    // Nothing to do; being active is enough to keep ev_loop() from blocking
+}
+
+void
+RunTick(void) {
+    ASSERT(g_current_thread == NULL);
+
+    CoronaThread *ct;
+    while ((ct = g_preemptedThreads.PopFront())) {
+        ScheduleRunnableThread(ct);
+    }
+
+    // Nothing to do, but PopRunnableThread() still reaps any zombies
+    if (g_schedPolicy->Size() == 0) {
+        PopRunnableThread();
+        return;
+    }
+
+    size_t depth = g_schedPolicy->Size();
+    if (depth > g_tickStats.ts_runq_max_) {
+        g_tickStats.ts_runq_max_ = depth;
+    }
+
+    g_tickStart = ev_time();
+    g_tickThreads = 0;
+    g_tickExhausted = false;
+
+    if ((g_current_thread = PopTickThread())) {
+        g_current_thread->Start();
+    }
+
+    ASSERT(g_current_thread == NULL);
+
+    size_t usec = (size_t) ((ev_time() - g_tickStart) * 1e6);
+    g_tickStats.ts_ticks_++;
+    g_tickStats.ts_threads_ += g_tickThreads;
+    g_tickStats.ts_usec_ += usec;
+    if (usec > g_tickStats.ts_usec_max_) {
+        g_tickStats.ts_usec_max_ = usec;
+    }
+
+    if (g_schedPolicy->Size() == 0 && g_preemptedThreads.Empty()) {
+        ev_idle_stop(g_loop, &g_tickIdle);
+    } else {
+        ASSERT(g_tickExhausted);
+        g_tickStats.ts_exhausted_++;
+        ev_idle_start(g_loop, &g_tickIdle);
+    }
+}
+
+void
+SetTickBudget(size_t threads, size_t usec) {
+    g_tickBudgetThreads = threads;
+    g_tickBudgetUsec = usec;
+}
+
+const TickStats &
+GetTickStats(void) {
+    return g_tickStats;
+}
+
+void
+SetDefaultStackSize(size_t bytes) {
+    v8::internal::Thread::SetDefaultStackSize(
+        (bytes > kStackSizeMin) ? bytes : kStackSizeMin
+    );
+}
+
+const StackStats &
+GetStackStats(void) {
+    return g_stackStats;
+}
+
+// CPU time used by the process so far, in microseconds
+static uint64_t
+CpuClock(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+        ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+void
+SetCpuQuota(ev_tstamp slice, ev_tstamp limit) {
+    struct sigaction sa;
+    struct itimerval itv;
+
+    ASSERT(g_current_thread == NULL);
+
+    g_cpuSliceUsec = (slice > 0) ? (uint64_t) (slice * 1e6) : 0;
+    g_cpuLimitUsec = (limit > 0) ? (uint64_t) (limit * 1e6) : 0;
+
+    memset(&itv, 0, sizeof(itv));
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+
+    if (!g_cpuSliceUsec && !g_cpuLimitUsec) {
+        setitimer(ITIMER_VIRTUAL, &itv, NULL);
+        sa.sa_handler = SIG_DFL;
+        sigaction(SIGVTALRM, &sa, NULL);
+        v8::internal::Thread::SetYieldCPUCallback(NULL);
+        return;
+    }
+
+    v8::internal::Thread::SetYieldCPUCallback(CoronaThread::PreemptCB);
+
+    // Restart what we can; libev copes with EINTR from the rest
+    sa.sa_handler = CoronaThread::CpuTimerCB;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGVTALRM, &sa, NULL);
+
+    itv.it_interval.tv_usec = kCpuTimerUsec;
+    itv.it_value.tv_usec = kCpuTimerUsec;
+    setitimer(ITIMER_VIRTUAL, &itv, NULL);
+}
+
+const CpuStats &
+GetCpuStats(void) {
+    return g_cpuStats;
+}
+
+// Arm the timer wheel's ev_timer to fire at the given tick, or stop it if
+// that is TimerWheel::kNever
+static void
+ArmTimerDriver(uint64_t expiry) {
+    ev_timer_stop(g_loop, &g_timerDriver);
+
+    g_timerDriverExpiry = expiry;
+    if (expiry == TimerWheel::kNever) {
+        return;
+    }
+
+    // Relative to the loop's idea of the current time, which is stale by
+    // however long the current tick has been running
+    ev_tstamp after = g_timerEpoch + expiry * kTimerTick - ev_now(g_loop);
+    ev_timer_set(&g_timerDriver, (after > 0) ? after : 0, 0);
+    ev_timer_start(g_loop, &g_timerDriver);
+}
+
+static void
+TimerDriverCB(struct ev_loop *el, struct ev_timer *w, int revents) {
+    uint64_t now = (uint64_t) ((ev_now(el) - g_timerEpoch) / kTimerTick);
+
+    // libev doesn't call us until the tick we armed for has arrived, even
+    // if rounding says otherwise
+    if (now < g_timerDriverExpiry) {
+        now = g_timerDriverExpiry;
+    }
+
+    g_timerDriverExpiry = TimerWheel::kNever;
+    g_timerWheel.Advance(now);
+    ArmTimerDriver(g_timerWheel.NextExpiry());
+}
+
+// Arm a timer on the wheel to fire in 'secs' seconds
+static void
+ArmWheelTimer(WheelTimer *wt, ev_tstamp secs) {
+    ev_tstamp now = ev_time() - g_timerEpoch;
+
+    // Catch an idle wheel up first, so that the timer lands on its lowest
+    // level rather than cascading down through the ones above
+    if (g_timerWheel.Size() == 0) {
+        g_timerWheel.Advance((uint64_t) (now / kTimerTick));
+    }
+
+    // Round up; timers must not fire early
+    g_timerWheel.Add(wt, (uint64_t) ceil((now + secs) / kTimerTick));
+
+    if (wt->wt_expiry_ < g_timerDriverExpiry) {
+        ArmTimerDriver(wt->wt_expiry_);
+    }
+}
+
+// Disarm a timer on the wheel, if it is armed.
+//
+// This leaves the driver armed for whatever it was due to fire next; it
+// will re-arm itself when it finds nothing there. The exception is when
+// nothing is left, as it would keep ev_loop() from returning in the
+// meantime.
+static void
+CancelWheelTimer(WheelTimer *wt) {
+    if (g_timerWheel.Remove(wt) && g_timerWheel.Size() == 0) {
+        ArmTimerDriver(TimerWheel::kNever);
+    }
+}
+
+// Get the watcher for the given fd, creating it if necessary
+static FdWatcher *
+GetFdWatcher(int fd) {
+    ASSERT(fd >= 0);
+
+    if (fd >= g_fdWatchersLen) {
+        int len = (g_fdWatchersLen > 0) ? g_fdWatchersLen : 64;
+        while (len <= fd) {
+            len <<= 1;
+        }
+
+        FdWatcher **fdws = new FdWatcher*[len];
+        memset(fdws, 0, len * sizeof(*fdws));
+        if (g_fdWatchers) {
+            memcpy(fdws, g_fdWatchers, g_fdWatchersLen * sizeof(*fdws));
+            delete[] g_fdWatchers;
+        }
+
+        g_fdWatchers = fdws;
+        g_fdWatchersLen = len;
+    }
+
+    if (!g_fdWatchers[fd]) {
+        FdWatcher *fdw = new FdWatcher();
+
+        // Not started until YieldIO() knows what events it wants
+        ev_init(&fdw->fw_io_, NULL);
+        fdw->fw_unref_ = false;
+
+        g_fdWatchers[fd] = fdw;
+    }
+
+    return g_fdWatchers[fd];
+}
+
+// Stop an fd's watcher; libev requires that we undo any ev_unref() first
+static void
+StopFdWatcher(FdWatcher *fdw) {
+    if (fdw->fw_unref_) {
+        ev_ref(g_loop);
+        fdw->fw_unref_ = false;
+    }
+
+    ev_io_stop(g_loop, &fdw->fw_io_);
+}
+
+// An armed watcher that nobody is waiting on must not keep ev_loop() from
+// returning, so it only holds a reference on the loop while it has waiters
+static void
+UpdateFdWatcherRef(FdWatcher *fdw) {
+    bool idle = ev_is_active(&fdw->fw_io_) &&
+        fdw->fw_readers_.Empty() && fdw->fw_writers_.Empty();
+
+    if (idle && !fdw->fw_unref_) {
+        ev_unref(g_loop);
+        fdw->fw_unref_ = true;
+    } else if (!idle && fdw->fw_unref_) {
+        ev_ref(g_loop);
+        fdw->fw_unref_ = false;
+    }
+}
+
+void
+UnwatchFd(int fd) {
+    FdWatcher *fdw;
+
+    if (fd < 0 || fd >= g_fdWatchersLen || !(fdw = g_fdWatchers[fd])) {
+        return;
+    }
+
+    CoronaThread::FailIOWaiters(fdw, EBADF);
+    StopFdWatcher(fdw);
 }
 
-CoronaThread::CoronaThread(void) {
-    this->ct_ev_.ct_self_ = this;
-    this->ct_ev_type_ = 0;
+CoronaThread::CoronaThread(size_t stack_size) :
+    v8::internal::Thread(stack_size),
+    ct_runnable_since_(0),
+    ct_wait_events_(0),
+    ct_wait_fdw_(NULL),
+    ct_wait_error_(0),
+    ct_wait_futures_(NULL),
+    ct_wait_nfutures_(0),
+    ct_wait_needed_(0),
+    ct_wait_cases_(NULL),
+    ct_wait_ncases_(0),
+    ct_wait_fired_(-1),
+    ct_wait_pollfds_(NULL),
+    ct_wait_npollfds_(0),
+    ct_wait_nready_(0),
+    ct_cpu_usec_(0),
+    ct_cpu_terminated_(false),
+    ct_sched_class_(kSchedClassNormal),
+    ct_future_mode_(false),
+    ct_cancelled_(false) {
+    this->ct_timer_.ct_w_.wt_cb_ = CoronaThread::TimeoutCB;
+    this->ct_timer_.ct_self_ = this;
 }
 
 void
@@ -43,115 +661,1904 @@ CoronaThread::Run(void) {
     ASSERT(v8::internal::current_thread == this);
     ASSERT(g_current_thread == this);
 
-    {
+    do {
         v8::Locker lock;
+
+        // V8 assumes that every thread has a big stack, and would otherwise
+        // run off the end of ours rather than throwing a RangeError
+        v8::ResourceConstraints rc;
+        rc.set_stack_limit(
+            (uint32_t*) (this->stack_bottom() + kStackReserve)
+        );
+        v8::SetResourceConstraints(&rc);
+
         v8::Context::Scope ctx_scope(g_v8Ctx);
         v8::HandleScope scope;
 
+        this->ct_cpu_usec_ = 0;
+        this->ct_cpu_terminated_ = false;
+        this->StartCpuSlice();
+
         this->Run2();
-    }
+
+        this->EndCpuSlice();
+
+        size_t used = this->StackHighWater();
+        g_stackStats.ss_sampled_++;
+        g_stackStats.ss_used_total_ += used;
+        if (used > g_stackStats.ss_used_max_) {
+            g_stackStats.ss_used_max_ = used;
+        }
+    } while (this->Recycle());
     
     // If we get here, it means that the applicatoin code represented by
     // this control flow has returned; we're done. Find someone else to run
-    // and clean up after ourselves.
+    // and clean up after ourselves. Note that PopRunnableThread() reaps
+    // zombies, so we must not add ourselves to that list until afterwards.
 
-    g_current_thread = PopRunnableThread();
-    g_zombieThreads.push_back(this);
+    g_current_thread = PopTickThread();
+
+    ASSERT(!CoronaThreadQueue::IsQueued(this));
+    g_zombieThreads.PushBack(this);
 
     if (g_current_thread) {
         g_current_thread->Start();
     } else {
-        ASSERT(g_runnableThreads.empty());
         v8::internal::main_thread->Start();
     }
 
     UNREACHABLE();
 }
 
-void
-CoronaThread::Schedule(void) {
-    g_runnableThreads.push_back(this);
+bool
+CoronaThread::Recycle(void) {
+    return false;
 }
 
 void
-CoronaThread::YieldIO(int fd, int events) {
-    ASSERT(this->ct_ev_type_ == 0);
+CoronaThread::Switch(void) {
+    ASSERT(g_current_thread == this);
+    ASSERT(!v8::Locker::IsLocked());
 
-    this->ct_ev_type_ = EV_IO;
-    ev_io_init(
-        &this->ct_ev_.ct_u_.ct_io_,
-        (void (*)(struct ev_loop *, ev_io *, int)) CoronaThread::ReadyCB,
-        fd,
-        events);
-    ev_io_start(g_loop, &this->ct_ev_.ct_u_.ct_io_);
+    if ((g_current_thread = PopTickThread())) {
+        ASSERT(g_current_thread != this);
+        g_current_thread->Start();
+    } else {
+        v8::internal::main_thread->Start();
+    }
 
-    this->Yield();
+    ASSERT(g_current_thread == this);
+}
 
-    this->ct_ev_type_ = 0;
-    ev_io_stop(g_loop, &this->ct_ev_.ct_u_.ct_io_);
+void
+CoronaThread::Schedule(void) {
+    ScheduleRunnableThread(this);
 }
 
 void
-CoronaThread::Yield(void) {
-    ASSERT(this->ct_ev_type_ != 0);
-    ASSERT(g_current_thread == this);
-    ASSERT(v8::internal::current_thread == this);
+CoronaThread::Cancel(void) {
+    if (this->ct_cancelled_) {
+        return;
+    }
 
-    CoronaThread *next = NULL;
+    this->ct_cancelled_ = true;
 
-    // Pick another thread to run. If we don't have any, bounce out to the
-    // main thread to ask the event loop for more work.
-    if ((next = PopRunnableThread())) {
+    if (this == g_current_thread) {
+        v8::V8::TerminateExecution();
+    } else if (this->Blocked()) {
+        this->Interrupt(ECANCELED);
+    }
 
-        // If we're runnable, avoid recursing
-        if (next == this) {
-            return;
-        }
+    // Otherwise we're runnable, preempted or not yet started; Yield(),
+    // PreemptCB() or Run2() see to us once we get that far
+}
 
-        v8::Unlocker unlock;
+bool
+CoronaThread::Cancelled(void) const {
+    return this->ct_cancelled_;
+}
 
-        g_current_thread = next;
-        next->Start();
-        ASSERT(g_current_thread == this);
-    } else {
-        g_current_thread = NULL;
-        v8::internal::main_thread->Start();
-        ASSERT(g_current_thread == this);
-    }
+int
+CoronaThread::GetSchedClass(void) const {
+    return this->ct_sched_class_;
 }
 
 void
-CoronaThread::ReadyCB(struct ev_loop *el, void *evp, int revents) {
-    CoronaThread *self = ((struct ct_ev*) evp)->ct_self_;
+CoronaThread::SetSchedClass(int cls) {
+    ASSERT(cls >= 0 && cls < kSchedClasses);
 
-    g_runnableThreads.push_back(self);
+    this->ct_sched_class_ = cls;
 }
 
-CallbackThread::CallbackThread(v8::Function *cb, uint8_t argc,
-                               v8::Handle<v8::Value> argv[]) :
-    cb_(cb), argc_(argc) {
-    this->argv_ = new v8::Persistent<v8::Value>[argc];
+int
+CoronaThread::YieldIO(int fd, int events, ev_tstamp timeout) {
+    ASSERT(this->ct_wait_events_ == 0);
+    ASSERT(events == EV_READ || events == EV_WRITE);
 
-    for (uint8_t i = 0; i < argc; i++) {
-        this->argv_[i] = v8::Persistent<v8::Value>::New(argv[i]);
+    FdWatcher *fdw = GetFdWatcher(fd);
+    struct ev_io *w = &fdw->fw_io_;
+
+    this->ct_wait_events_ = events;
+    this->ct_wait_fdw_ = fdw;
+    this->ct_wait_error_ = 0;
+    if (events == EV_READ) {
+        fdw->fw_readers_.PushBack(this);
+    } else {
+        fdw->fw_writers_.PushBack(this);
     }
-}
 
-CallbackThread::~CallbackThread(void) {
-    this->cb_.Dispose();
+    // Only go to the kernel if we're interested in something new
+    if (!ev_is_active(w) || (w->events & events) != events) {
+        int all_events = (ev_is_active(w)) ? (w->events | events) : events;
 
-    for (uint8_t i = 0; i < this->argc_; i++) {
-        argv_[i].Dispose();
+        StopFdWatcher(fdw);
+        ev_io_init(w, CoronaThread::IOReadyCB, fd, all_events);
+        ev_io_start(g_loop, w);
     }
 
-    delete[] this->argv_;
+    UpdateFdWatcherRef(fdw);
+
+    if (timeout >= 0) {
+        this->StartTimer(timeout);
+    }
+
+    this->Yield();
+
+    ASSERT(!fdw->fw_readers_.Contains(this));
+    ASSERT(!fdw->fw_writers_.Contains(this));
+    ASSERT(!this->ct_timer_.ct_w_.Armed());
+    this->ct_wait_events_ = 0;
+    this->ct_wait_fdw_ = NULL;
+
+    if (this->ct_wait_error_) {
+        errno = this->ct_wait_error_;
+        return -1;
+    }
+
+    return 0;
 }
 
 void
-CallbackThread::Run2(void) {
-    cb_->Call(
-        v8::Context::GetCurrent()->Global(),
-        this->argc_,
-        this->argv_
-    );
+CoronaThread::Sleep(ev_tstamp secs) {
+    ASSERT(this->ct_wait_events_ == 0);
+
+    this->ct_wait_error_ = 0;
+    this->StartTimer((secs > 0) ? secs : 0);
+    this->Yield();
+
+    ASSERT(!this->ct_timer_.ct_w_.Armed());
+}
+
+int
+CoronaThread::WaitFutures(Future **futs, size_t nfuts, bool all,
+                          ev_tstamp timeout) {
+    ASSERT(this->ct_wait_events_ == 0);
+    ASSERT(this->ct_wait_futures_ == NULL);
+
+    size_t pending = 0;
+
+    // Look before we take on any of them, or a future that we left behind
+    // would still think that we were waiting for it
+    if (!all) {
+        for (size_t i = 0; i < nfuts; i++) {
+            if (futs[i]->Done()) {
+                return 0;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < nfuts; i++) {
+        if (futs[i]->Done()) {
+            continue;
+        }
+
+        // Each future only counts once, however often it is listed
+        if (futs[i]->fu_waiter_ != this) {
+            ASSERT(futs[i]->fu_waiter_ == NULL);
+            futs[i]->fu_waiter_ = this;
+            pending++;
+        }
+    }
+
+    if (pending == 0) {
+        return 0;
+    }
+
+    this->ct_wait_futures_ = futs;
+    this->ct_wait_nfutures_ = nfuts;
+    this->ct_wait_needed_ = (all) ? pending : 1;
+    this->ct_wait_error_ = 0;
+
+    if (timeout >= 0) {
+        this->StartTimer(timeout);
+    }
+
+    this->Yield();
+
+    ASSERT(!this->ct_timer_.ct_w_.Armed());
+    for (size_t i = 0; i < nfuts; i++) {
+        ASSERT(futs[i]->fu_waiter_ != this);
+    }
+
+    this->ct_wait_futures_ = NULL;
+    this->ct_wait_nfutures_ = 0;
+
+    if (this->ct_wait_error_) {
+        errno = this->ct_wait_error_;
+        return -1;
+    }
+
+    return 0;
+}
+
+// One of the futures that we're waiting for is done, and has already
+// forgotten about us
+void
+CoronaThread::FutureDone(void) {
+    ASSERT(this->ct_wait_futures_ != NULL);
+    ASSERT(this->ct_wait_needed_ > 0);
+
+    if (--this->ct_wait_needed_ == 0) {
+        this->DetachFutures();
+        this->Wake(0);
+    }
+}
+
+// Stop being the waiter for any futures that we're waiting on, so that they
+// don't try to wake us again
+void
+CoronaThread::DetachFutures(void) {
+    for (size_t i = 0; i < this->ct_wait_nfutures_; i++) {
+        if (this->ct_wait_futures_[i]->fu_waiter_ == this) {
+            this->ct_wait_futures_[i]->fu_waiter_ = NULL;
+        }
+    }
+}
+
+int
+CoronaThread::Select(SelectCase *cases, size_t ncases, ev_tstamp timeout) {
+    ASSERT(this->ct_wait_events_ == 0);
+    ASSERT(this->ct_wait_cases_ == NULL);
+    ASSERT(ncases > 0);
+
+    size_t first = g_selectRotor++ % ncases;
+
+    // Channels can tell us right away; fds have to wait for the event loop
+    for (size_t i = 0; i < ncases; i++) {
+        SelectCase *sc = &cases[(first + i) % ncases];
+
+        sc->sc_error_ = 0;
+        if (sc->sc_chan_ && sc->sc_chan_->TryCase(sc)) {
+            return sc - cases;
+        }
+    }
+
+    for (size_t i = 0; i < ncases; i++) {
+        SelectCase *sc = &cases[i];
+
+        sc->sc_thread_ = this;
+        sc->sc_index_ = i;
+
+        if (!sc->sc_chan_) {
+            ev_io_init(
+                &sc->sc_io_, CoronaThread::SelectIOCB,
+                sc->sc_fd_, sc->sc_events_
+            );
+            ev_io_start(g_loop, &sc->sc_io_);
+            GetFdWatcher(sc->sc_fd_)->fw_cases_.PushBack(sc);
+        } else if (sc->sc_send_) {
+            sc->sc_chan_->ch_senders_.PushBack(sc);
+        } else {
+            sc->sc_chan_->ch_receivers_.PushBack(sc);
+        }
+    }
+
+    this->ct_wait_cases_ = cases;
+    this->ct_wait_ncases_ = ncases;
+    this->ct_wait_fired_ = -1;
+    this->ct_wait_error_ = 0;
+
+    if (timeout >= 0) {
+        this->StartTimer(timeout);
+    }
+
+    this->Yield();
+
+    ASSERT(!this->ct_timer_.ct_w_.Armed());
+    for (size_t i = 0; i < ncases; i++) {
+        ASSERT(!SelectCaseQueue::IsQueued(&cases[i]));
+    }
+
+    int fired = this->ct_wait_fired_;
+
+    this->ct_wait_cases_ = NULL;
+    this->ct_wait_ncases_ = 0;
+
+    if (this->ct_wait_error_) {
+        errno = this->ct_wait_error_;
+        return -1;
+    }
+
+    ASSERT(fired >= 0);
+    return fired;
+}
+
+// One of the cases that we're blocked in Select() on has gone ahead, and
+// has already been taken off of its channel's queue
+void
+CoronaThread::CaseDone(SelectCase *sc, int err) {
+    ASSERT(sc->sc_thread_ == this);
+    ASSERT(this->ct_wait_cases_ != NULL);
+
+    sc->sc_error_ = err;
+    this->ct_wait_fired_ = sc->sc_index_;
+
+    this->DetachCases();
+    this->Wake(0);
+}
+
+// Withdraw all of our Select() cases, so that no other can go ahead
+void
+CoronaThread::DetachCases(void) {
+    for (size_t i = 0; i < this->ct_wait_ncases_; i++) {
+        SelectCase *sc = &this->ct_wait_cases_[i];
+
+        // Off of the channel's or the fd's queue
+        SelectCaseQueue::Unlink(sc);
+
+        if (!sc->sc_chan_) {
+            ev_io_stop(g_loop, &sc->sc_io_);
+        }
+    }
+}
+
+int
+CoronaThread::Poll(PollFd *fds, size_t nfds, ev_tstamp timeout) {
+    ASSERT(this->ct_wait_events_ == 0);
+    ASSERT(this->ct_wait_pollfds_ == NULL);
+    ASSERT(nfds > 0);
+
+    for (size_t i = 0; i < nfds; i++) {
+        PollFd *pf = &fds[i];
+
+        pf->pf_revents_ = 0;
+        pf->pf_thread_ = this;
+        ev_io_init(&pf->pf_io_, CoronaThread::PollIOCB, pf->pf_fd_,
+                   pf->pf_events_);
+        ev_io_start(g_loop, &pf->pf_io_);
+        GetFdWatcher(pf->pf_fd_)->fw_pollfds_.PushBack(pf);
+    }
+
+    this->ct_wait_pollfds_ = fds;
+    this->ct_wait_npollfds_ = nfds;
+    this->ct_wait_nready_ = 0;
+    this->ct_wait_error_ = 0;
+
+    if (timeout >= 0) {
+        this->StartTimer(timeout);
+    }
+
+    this->Yield();
+
+    ASSERT(!this->ct_timer_.ct_w_.Armed());
+
+    // Watchers for fds that became ready while we sat in the run queue
+    // have recorded it, and can go now
+    this->DetachPollFds();
+
+    size_t nready = this->ct_wait_nready_;
+
+    this->ct_wait_pollfds_ = NULL;
+    this->ct_wait_npollfds_ = 0;
+    this->ct_wait_nready_ = 0;
+
+    if (this->ct_wait_error_) {
+        errno = this->ct_wait_error_;
+        return -1;
+    }
+
+    ASSERT(nready > 0);
+    return nready;
+}
+
+// Stop watching the fds that we're blocked in Poll() on
+void
+CoronaThread::DetachPollFds(void) {
+    for (size_t i = 0; i < this->ct_wait_npollfds_; i++) {
+        PollFd *pf = &this->ct_wait_pollfds_[i];
+
+        ev_io_stop(g_loop, &pf->pf_io_);
+        PollFdQueue::Unlink(pf);
+    }
+}
+
+// One of the fds that we're blocked in Poll() on is ready, or has gone
+// away. Only the first one wakes us; the rest that libev reports on this
+// trip around the loop (or later ones, if we don't get to run before then)
+// just add to the tally.
+void
+CoronaThread::PollFdReady(PollFd *pf, int revents) {
+    ASSERT(this->ct_wait_pollfds_ != NULL);
+    ASSERT(pf->pf_revents_ == 0);
+
+    // Level-triggered, so it would keep firing until we run
+    ev_io_stop(g_loop, &pf->pf_io_);
+    PollFdQueue::Unlink(pf);
+
+    pf->pf_revents_ = revents & (EV_READ | EV_WRITE | EV_ERROR);
+    if (this->ct_wait_nready_++ == 0) {
+        this->Wake(0);
+    }
+}
+
+bool
+CoronaThread::GetFutureMode(void) const {
+    return this->ct_future_mode_;
+}
+
+void
+CoronaThread::SetFutureMode(bool future_mode) {
+    this->ct_future_mode_ = future_mode;
+}
+
+void
+CoronaThread::StartTimer(ev_tstamp secs) {
+    ASSERT(!this->ct_timer_.ct_w_.Armed());
+
+    ArmWheelTimer(&this->ct_timer_.ct_w_, secs);
+}
+
+// Is this thread blocked in YieldIO(), Sleep(), WaitFutures(), Select() or
+// Poll() and not yet woken? Once woken, we're on the run queue until we get
+// to run.
+bool
+CoronaThread::Blocked(void) const {
+    if (this == g_current_thread) {
+        return false;
+    }
+
+    if (this->ct_wait_events_) {
+        return (this->ct_wait_events_ == EV_READ) ?
+            this->ct_wait_fdw_->fw_readers_.Contains(this) :
+            this->ct_wait_fdw_->fw_writers_.Contains(this);
+    }
+
+    return (this->ct_wait_futures_ || this->ct_wait_cases_ ||
+            this->ct_wait_pollfds_ || this->ct_timer_.ct_w_.Armed()) &&
+           !CoronaThreadQueue::IsQueued(this);
+}
+
+// Give up on whatever this thread is Blocked() in, failing the wait with
+// the given error
+void
+CoronaThread::Interrupt(int err) {
+    FdWatcher *fdw = this->ct_wait_fdw_;
+
+    if (this->ct_wait_futures_) {
+        this->DetachFutures();
+    } else if (this->ct_wait_cases_) {
+        this->DetachCases();
+    } else if (this->ct_wait_pollfds_) {
+        this->DetachPollFds();
+    } else if (fdw) {
+        if (this->ct_wait_events_ == EV_READ) {
+            fdw->fw_readers_.Remove(this);
+        } else {
+            fdw->fw_writers_.Remove(this);
+        }
+
+        UpdateFdWatcherRef(fdw);
+    }
+
+    this->Wake(err);
+}
+
+// Make a thread that's blocked in YieldIO(), Sleep(), WaitFutures(),
+// Select() or Poll() runnable again; it must already have been taken off of
+// any fd wait queue
+void
+CoronaThread::Wake(int err) {
+    ASSERT(!CoronaThreadQueue::IsQueued(this));
+
+    CancelWheelTimer(&this->ct_timer_.ct_w_);
+
+    this->ct_wait_error_ = err;
+    ScheduleRunnableThread(this);
+}
+
+void
+CoronaThread::Yield(void) {
+    ASSERT(this->ct_wait_events_ != 0 || this->ct_wait_futures_ != NULL ||
+           this->ct_wait_cases_ != NULL || this->ct_wait_pollfds_ != NULL ||
+           this->ct_timer_.ct_w_.Armed());
+    ASSERT(g_current_thread == this);
+    ASSERT(v8::internal::current_thread == this);
+
+    CoronaThread *next = NULL;
+
+    // Pick another thread to run. If we don't have any, or this tick is
+    // over, bounce out to the main thread to ask the event loop for more
+    // work.
+    if ((next = PopTickThread())) {
+
+        // If we're runnable, avoid recursing
+        if (next == this) {
+            return;
+        }
+
+        this->EndCpuSlice();
+
+        v8::Unlocker unlock;
+
+        g_current_thread = next;
+        next->Start();
+        ASSERT(g_current_thread == this);
+    } else {
+        this->EndCpuSlice();
+
+        // Whoever the event loop runs next has to find our V8 state
+        // archived, not still in place
+        v8::Unlocker unlock;
+
+        g_current_thread = NULL;
+        v8::internal::main_thread->Start();
+        ASSERT(g_current_thread == this);
+    }
+
+    // Having blocked, we're no longer a candidate for termination. Don't
+    // start the next slice until the Unlocker is gone, as we don't hold the
+    // V8 lock before then.
+    this->ct_cpu_usec_ = 0;
+    this->ct_cpu_terminated_ = false;
+    this->StartCpuSlice();
+
+    // We may have been woken by Cancel(); now that we hold the lock again,
+    // have our JavaScript unwind
+    if (this->ct_cancelled_) {
+        v8::V8::TerminateExecution();
+    }
+}
+
+// Run the given thread, which we've just made runnable, straight away
+// rather than once its turn comes, and go to the back of the run queue
+// ourselves; see Channel::TrySend(). We stay put if this tick is over, or
+// if the thread is in a different scheduling class, as running it out of
+// turn could then jump it ahead of threads that the policy would run
+// first.
+void
+CoronaThread::HandOff(CoronaThread *next) {
+    ASSERT(g_current_thread == this);
+    ASSERT(next != this);
+
+    if (next->GetSchedClass() != this->GetSchedClass()) {
+        return;
+    }
+
+    g_tickNow = ev_time();
+    if (TickExhausted() || !g_schedPolicy->Remove(next)) {
+        return;
+    }
+
+    CountRunnableWait(next);
+    g_tickThreads++;
+    ScheduleRunnableThread(this);
+
+    this->EndCpuSlice();
+
+    {
+        v8::Unlocker unlock;
+
+        g_current_thread = next;
+        next->Start();
+        ASSERT(g_current_thread == this);
+    }
+
+    // We didn't block, so unlike Yield() we're still charged for the CPU
+    // that we've used since we last did
+    this->StartCpuSlice();
+
+    if (this->ct_cancelled_) {
+        v8::V8::TerminateExecution();
+    }
+}
+
+void
+CoronaThread::IOReadyCB(struct ev_loop *el, struct ev_io *w, int revents) {
+    FdWatcher *fdw = (FdWatcher*) w;
+    int unwanted = 0;
+    CoronaThread *ct;
+
+    // libev has decided that the fd is bad and stopped the watcher for us
+    if (revents & EV_ERROR) {
+        if (fdw->fw_unref_) {
+            ev_ref(el);
+            fdw->fw_unref_ = false;
+        }
+
+        FailIOWaiters(fdw, EBADF);
+        return;
+    }
+
+    // Level-triggered readiness, so if one waiter doesn't consume all of
+    // it, we'll be called again for the next one
+    if (revents & EV_READ) {
+        if ((ct = fdw->fw_readers_.PopFront())) {
+            ct->Wake(0);
+        } else {
+            unwanted |= EV_READ;
+        }
+    }
+
+    if (revents & EV_WRITE) {
+        if ((ct = fdw->fw_writers_.PopFront())) {
+            ct->Wake(0);
+        } else {
+            unwanted |= EV_WRITE;
+        }
+    }
+
+    // Nobody was waiting for some of what fired; drop it from the interest
+    // set or we'll hear about it on every trip around the loop. We don't do
+    // this eagerly when waking waiters, as they usually come right back.
+    if (unwanted) {
+        int events = w->events & ~unwanted;
+
+        StopFdWatcher(fdw);
+        if (events) {
+            ev_io_set(w, w->fd, events);
+            ev_io_start(el, w);
+        }
+    }
+
+    UpdateFdWatcherRef(fdw);
+}
+
+void
+CoronaThread::TimeoutCB(WheelTimer *wt) {
+    CoronaThread *self = ((struct ct_timer*) wt)->ct_self_;
+
+    // A plain Sleep() finishing isn't an error
+    self->Interrupt(
+        (self->ct_wait_fdw_ || self->ct_wait_futures_ ||
+         self->ct_wait_cases_ || self->ct_wait_pollfds_) ? ETIMEDOUT : 0
+    );
+}
+
+// An fd that we're blocked in Select() on is ready
+void
+CoronaThread::SelectIOCB(struct ev_loop *el, struct ev_io *w, int revents) {
+    SelectCase *sc = (SelectCase*) w;
+
+    sc->sc_thread_->CaseDone(sc, (revents & EV_ERROR) ? EBADF : 0);
+}
+
+// An fd that we're blocked in Poll() on is ready
+void
+CoronaThread::PollIOCB(struct ev_loop *el, struct ev_io *w, int revents) {
+    PollFd *pf = (PollFd*) w;
+
+    pf->pf_thread_->PollFdReady(pf, revents);
+}
+
+uint64_t
+CoronaThread::CpuUsed(void) {
+    uint64_t used = this->ct_cpu_usec_;
+
+    if (this == g_current_thread && g_cpuArmed) {
+        used += CpuClock() - g_cpuSliceStart;
+    }
+
+    return used;
+}
+
+// We've just taken the V8 lock; start charging our CPU time
+void
+CoronaThread::StartCpuSlice(void) {
+    if (!g_cpuSliceUsec && !g_cpuLimitUsec) {
+        return;
+    }
+
+    g_cpuSliceStart = CpuClock();
+    g_cpuArmed = 1;
+}
+
+// We're about to give up the V8 lock; stop charging our CPU time
+void
+CoronaThread::EndCpuSlice(void) {
+    if (!g_cpuArmed) {
+        return;
+    }
+
+    // Disarmed first, so that CpuTimerCB() can't make a request after we
+    // have withdrawn them
+    g_cpuArmed = 0;
+    this->ct_cpu_usec_ += CpuClock() - g_cpuSliceStart;
+
+    // A preemption or termination that we haven't reached a safe point for
+    // yet would otherwise hit whatever we run next; PreemptCB() decides
+    // again if it's still warranted
+    v8::internal::Thread::ClearInterrupts();
+}
+
+// SIGVTALRM handler; see SetCpuQuota(). The code that we've interrupted
+// may be in the middle of changing V8's interrupt state, so we only ask V8
+// to call PreemptCB() at its next safe point, and let that decide what to
+// do. We ask on every tick, since EndCpuSlice() withdraws any request.
+void
+CoronaThread::CpuTimerCB(int sig) {
+    if (g_cpuArmed) {
+        v8::internal::Thread::RequestYield();
+    }
+}
+
+// V8 has reached a safe point after CpuTimerCB() asked it to, and has
+// released the lock for us (see v8::internal::Thread::YieldCPU()). If we've
+// used up our slice, go to the back of the queue, and let the event loop
+// poll before anyone else runs.
+void
+CoronaThread::PreemptCB(void) {
+    CoronaThread *self = g_current_thread;
+
+    if (!g_cpuArmed) {
+        return;
+    }
+
+    ASSERT(self != NULL);
+    ASSERT(v8::internal::current_thread == self);
+
+    uint64_t used = CpuClock() - g_cpuSliceStart;
+
+    // V8 releases the lock lazily, so its interrupt state for us is still
+    // in place and the stack guard acts on a termination as soon as we
+    // return. Cancelled threads that were preempted rather than blocked
+    // end up here too; see Cancel().
+    if (self->ct_cancelled_) {
+        v8::V8::TerminateExecution();
+        return;
+    }
+
+    if (g_cpuLimitUsec && self->ct_cpu_usec_ + used >= g_cpuLimitUsec) {
+        if (!self->ct_cpu_terminated_) {
+            self->ct_cpu_terminated_ = true;
+            g_cpuStats.cs_terminated_++;
+        }
+
+        v8::V8::TerminateExecution();
+        return;
+    }
+
+    if (!g_cpuSliceUsec || used < g_cpuSliceUsec) {
+        return;
+    }
+
+    g_cpuArmed = 0;
+    self->ct_cpu_usec_ += used;
+    g_cpuStats.cs_preempted_++;
+
+    g_preemptedThreads.PushBack(self);
+    g_tickExhausted = true;
+    g_current_thread = NULL;
+    v8::internal::main_thread->Start();
+    ASSERT(g_current_thread == self);
+
+    // V8 takes the lock back once we return. A request that CpuTimerCB()
+    // makes before it has done so at worst costs the stack guard a call to
+    // us.
+    g_cpuSliceStart = CpuClock();
+    g_cpuArmed = 1;
+}
+
+void
+CoronaThread::FailIOWaiters(FdWatcher *fdw, int err) {
+    CoronaThreadQueue *queues[] = { &fdw->fw_readers_, &fdw->fw_writers_ };
+    CoronaThread *ct;
+    SelectCase *sc;
+    PollFd *pf;
+
+    for (size_t i = 0; i < sizeof(queues) / sizeof(queues[0]); i++) {
+        while ((ct = queues[i]->PopFront())) {
+            ct->Wake(err);
+        }
+    }
+
+    // This takes each selecting thread's other cases off of the queue too
+    while ((sc = fdw->fw_cases_.PopFront())) {
+        sc->sc_thread_->CaseDone(sc, err);
+    }
+
+    while ((pf = fdw->fw_pollfds_.PopFront())) {
+        pf->pf_thread_->PollFdReady(pf, EV_ERROR);
+    }
+
+    UpdateFdWatcherRef(fdw);
+}
+
+CallbackThread *
+CallbackThread::Acquire(size_t stack_size) {
+    CallbackThread *cbt = NULL;
+
+    // The pool only holds threads with default-sized stacks
+    if (stack_size == 0 || stack_size == Thread::GetDefaultStackSize()) {
+        cbt = (CallbackThread*) g_pooledThreads.PopFront();
+        stack_size = 0;
+    }
+
+    if (cbt) {
+        g_poolStats.tps_hits_++;
+        g_poolStats.tps_size_--;
+    } else {
+        g_poolStats.tps_misses_++;
+        cbt = new CallbackThread(stack_size);
+    }
+
+    cbt->ct_cancelled_ = false;
+    cbt->task_ = NULL;
+    cbt->limit_ = NULL;
+    cbt->lazy_ = NULL;
+
+    // Futures change what calls return, so callbacks must ask for them
+    cbt->SetFutureMode(false);
+
+    return cbt;
+}
+
+CallbackThread *
+CallbackThread::Get(v8::Handle<v8::Function> cb, uint8_t argc,
+                    v8::Handle<v8::Value> argv[], size_t stack_size,
+                    Task *task) {
+    CallbackThread *cbt = CallbackThread::Acquire(stack_size);
+
+    // New threads are in the same class as whoever spawns them
+    cbt->SetSchedClass(
+        (g_current_thread) ?
+            g_current_thread->GetSchedClass() : kSchedClassNormal
+    );
+
+    cbt->task_ = task;
+    cbt->Reset(cb, argc, argv);
+    return cbt;
+}
+
+// Called from the event loop, so we don't hold the V8 lock and can't touch
+// the callback's handle; the thread takes the record over in Run2()
+void
+CallbackThread::StartLazy(LazyCallback *lc) {
+    ev_io_stop(g_loop, &lc->lc_io_);
+    CancelWheelTimer(&lc->lc_timer_.lc_w_);
+    g_lazyStats.lcs_pending_--;
+
+    CallbackThread *cbt = CallbackThread::Acquire(0);
+
+    cbt->SetSchedClass(lc->lc_sched_class_);
+    cbt->limit_ = lc->lc_limit_;
+    cbt->lazy_ = lc;
+    cbt->Schedule();
+}
+
+void
+CallbackThread::LazyReadyCB(struct ev_loop *el, struct ev_io *w,
+                            int revents) {
+    g_lazyStats.lcs_ready_++;
+
+    // Including EV_ERROR; the callback finds out what's wrong when it reads
+    CallbackThread::StartLazy((LazyCallback*) w);
+}
+
+void
+CallbackThread::LazyTimeoutCB(WheelTimer *wt) {
+    g_lazyStats.lcs_timedout_++;
+
+    CallbackThread::StartLazy(((struct LazyCallback::lc_timer*) wt)->lc_self_);
+}
+
+void
+CallWhenReadable(v8::Handle<v8::Function> cb, int fd, ev_tstamp timeout,
+                 CallbackLimit *cl) {
+    LazyCallback *lc = new LazyCallback();
+
+    ev_io_init(&lc->lc_io_, CallbackThread::LazyReadyCB, fd, EV_READ);
+    ev_io_start(g_loop, &lc->lc_io_);
+
+    lc->lc_timer_.lc_w_.wt_cb_ = CallbackThread::LazyTimeoutCB;
+    lc->lc_timer_.lc_self_ = lc;
+    if (timeout >= 0) {
+        ArmWheelTimer(&lc->lc_timer_.lc_w_, timeout);
+    }
+
+    lc->lc_cb_ = v8::Persistent<v8::Function>::New(cb);
+    lc->lc_sched_class_ =
+        (g_current_thread) ?
+            g_current_thread->GetSchedClass() : kSchedClassNormal;
+    lc->lc_limit_ = cl;
+
+    g_lazyStats.lcs_pending_++;
+}
+
+const LazyCallbackStats &
+GetLazyCallbackStats(void) {
+    return g_lazyStats;
+}
+
+CallbackThread::CallbackThread(size_t stack_size) :
+    CoronaThread(stack_size),
+    argc_(0), argv_cap_(0), argv_(NULL), task_(NULL), limit_(NULL),
+    lazy_(NULL) {
+}
+
+CallbackThread::~CallbackThread(void) {
+    this->Clear();
+
+    delete[] this->argv_;
+}
+
+void
+CallbackThread::Reset(v8::Handle<v8::Function> cb, uint8_t argc,
+                      v8::Handle<v8::Value> argv[]) {
+    ASSERT(this->cb_.IsEmpty());
+    ASSERT(this->argc_ == 0);
+
+    // Only grow the handle slots; most callbacks take the same number of
+    // arguments, so this is almost always a no-op for pooled threads
+    if (argc > this->argv_cap_) {
+        delete[] this->argv_;
+        this->argv_ = new v8::Persistent<v8::Value>[argc];
+        this->argv_cap_ = argc;
+    }
+
+    this->cb_ = v8::Persistent<v8::Function>::New(cb);
+    this->argc_ = argc;
+
+    for (uint8_t i = 0; i < argc; i++) {
+        this->argv_[i] = v8::Persistent<v8::Value>::New(argv[i]);
+    }
+}
+
+void
+CallbackThread::Clear(void) {
+    if (!this->cb_.IsEmpty()) {
+        this->cb_.Dispose();
+        this->cb_.Clear();
+    }
+
+    for (uint8_t i = 0; i < this->argc_; i++) {
+        this->argv_[i].Dispose();
+        this->argv_[i].Clear();
+    }
+
+    this->argc_ = 0;
+}
+
+void
+CallbackThread::Run2(void) {
+    Task *task = this->task_;
+    LazyCallback *lc = this->lazy_;
+
+    this->task_ = NULL;
+    this->lazy_ = NULL;
+
+    if (lc) {
+        v8::Local<v8::Function> cb = v8::Local<v8::Function>::New(lc->lc_cb_);
+        v8::Handle<v8::Value> argv[] = {
+            v8::Integer::New(lc->lc_io_.fd)
+        };
+
+        lc->lc_cb_.Dispose();
+        delete lc;
+
+        cb->Call(v8::Context::GetCurrent()->Global(), 1, argv);
+        return;
+    }
+
+    if (!task) {
+        cb_->Call(
+            v8::Context::GetCurrent()->Global(),
+            this->argc_,
+            this->argv_
+        );
+
+        // Drop our references while we still hold the V8 lock
+        this->Clear();
+        return;
+    }
+
+    v8::TryCatch try_catch;
+    v8::Local<v8::Value> ret;
+
+    // A task cancelled before it got to run never does
+    if (!this->ct_cancelled_) {
+        ret = cb_->Call(
+            v8::Context::GetCurrent()->Global(),
+            this->argc_,
+            this->argv_
+        );
+    }
+
+    this->Clear();
+
+    // A termination that we finished before reaching a safe point for
+    // would otherwise hit the next callback that we're given
+    if (this->ct_cancelled_) {
+        v8::internal::Thread::ClearInterrupts();
+    }
+
+    task->Finish(ret, try_catch);
+}
+
+void
+CallbackThread::SetLimit(CallbackLimit *cl) {
+    ASSERT(this->limit_ == NULL);
+
+    this->limit_ = cl;
+}
+
+bool
+CallbackThread::Recycle(void) {
+    if (this->limit_) {
+        this->limit_->Release();
+        this->limit_ = NULL;
+    }
+
+    if (g_pooledThreads.Size() >= g_poolHighWatermark ||
+        this->stack_size() != Thread::GetDefaultStackSize()) {
+        g_poolStats.tps_retired_++;
+        return false;
+    }
+
+    g_pooledThreads.PushBack(this);
+    g_poolStats.tps_size_++;
+
+    // Park until CallbackThread::Get() hands us a new callback and someone
+    // schedules us
+    this->Switch();
+
+    return true;
+}
+
+void
+SetThreadPoolWatermarks(size_t low, size_t high) {
+    ASSERT(low <= high);
+
+    g_poolLowWatermark = low;
+    g_poolHighWatermark = high;
+
+    // Trim any excess; these have never been started or are parked in
+    // Recycle(), so there is no stack of interest to unwind.
+    while (g_pooledThreads.Size() > g_poolHighWatermark) {
+        g_zombieThreads.PushBack(g_pooledThreads.PopBack());
+        g_poolStats.tps_size_--;
+        g_poolStats.tps_retired_++;
+    }
+}
+
+void
+FillThreadPool(void) {
+    ASSERT(g_current_thread == NULL);
+
+    while (g_pooledThreads.Size() < g_poolLowWatermark) {
+        g_pooledThreads.PushBack(new CallbackThread(0));
+        g_poolStats.tps_size_++;
+    }
+}
+
+const ThreadPoolStats &
+GetThreadPoolStats(void) {
+    return g_poolStats;
+}
+
+// What CallbackLimit::Acquire() blocks on until Release() completes it
+class LimitFuture : public Future {
+    public:
+        void Signal(void) {
+            this->Complete(0, 0);
+        }
+
+    protected:
+        void Ready(void) {
+            UNREACHABLE();
+        }
+};
+
+CallbackLimit::CallbackLimit(size_t max) :
+    cl_max_(max),
+    cl_running_(0),
+    cl_closed_(false),
+    cl_waiter_(NULL) {
+    ASSERT(max > 0);
+}
+
+CallbackLimit::~CallbackLimit(void) {
+    ASSERT(this->cl_waiter_ == NULL);
+}
+
+int
+CallbackLimit::Acquire(ev_tstamp timeout) {
+    ASSERT(!this->cl_closed_);
+    ASSERT(this->cl_waiter_ == NULL);
+
+    while (this->cl_running_ >= this->cl_max_) {
+        LimitFuture fut;
+        Future *futs[] = { &fut };
+
+        this->cl_waiter_ = &fut;
+        int err = g_current_thread->WaitFutures(futs, 1, true, timeout);
+        this->cl_waiter_ = NULL;
+
+        if (err < 0) {
+            return -1;
+        }
+    }
+
+    this->cl_running_++;
+    return 0;
+}
+
+void
+CallbackLimit::Release(void) {
+    ASSERT(this->cl_running_ > 0);
+
+    this->cl_running_--;
+
+    if (this->cl_waiter_) {
+        LimitFuture *fut = (LimitFuture*) this->cl_waiter_;
+
+        // Acquire() clears this once it's running again
+        if (!fut->Done()) {
+            fut->Signal();
+        }
+    }
+
+    if (this->cl_closed_ && this->cl_running_ == 0) {
+        delete this;
+    }
+}
+
+void
+CallbackLimit::Close(void) {
+    ASSERT(this->cl_waiter_ == NULL);
+
+    this->cl_closed_ = true;
+
+    if (this->cl_running_ == 0) {
+        delete this;
+    }
+}
+
+size_t
+CallbackLimit::Running(void) const {
+    return this->cl_running_;
+}
+
+size_t
+CallbackLimit::Max(void) const {
+    return this->cl_max_;
+}
+
+Channel::Channel(size_t capacity) :
+    ch_cap_(capacity),
+    ch_head_(0),
+    ch_len_(0),
+    ch_closed_(false) {
+    if (capacity > 0) {
+        this->ch_buf_ = v8::Persistent<v8::Array>::New(
+            v8::Array::New(capacity)
+        );
+    }
+}
+
+Channel::~Channel(void) {
+    // Anyone blocked on us would be holding a reference to our wrapper
+    ASSERT(this->ch_senders_.Empty());
+    ASSERT(this->ch_receivers_.Empty());
+
+    if (!this->ch_buf_.IsEmpty()) {
+        this->ch_buf_.Dispose();
+        this->ch_buf_.Clear();
+    }
+}
+
+void
+Channel::Close(void) {
+    SelectCase *sc;
+
+    if (this->ch_closed_) {
+        return;
+    }
+
+    this->ch_closed_ = true;
+
+    // Nobody can be waiting on both queues unless they're in the same
+    // select, which the first CaseDone() takes off of both
+    while ((sc = this->ch_receivers_.PopFront())) {
+        Channel::Store(sc, v8::Undefined());
+        sc->sc_thread_->CaseDone(sc, EPIPE);
+    }
+
+    while ((sc = this->ch_senders_.PopFront())) {
+        sc->sc_thread_->CaseDone(sc, EPIPE);
+    }
+}
+
+bool
+Channel::Closed(void) const {
+    return this->ch_closed_;
+}
+
+size_t
+Channel::Size(void) const {
+    return this->ch_len_;
+}
+
+size_t
+Channel::Capacity(void) const {
+    return this->ch_cap_;
+}
+
+bool
+Channel::TryCase(SelectCase *sc) {
+    ASSERT(sc->sc_chan_ == this);
+
+    return (sc->sc_send_) ? this->TrySend(sc) : this->TryRecv(sc);
+}
+
+bool
+Channel::TrySend(SelectCase *sc) {
+    SelectCase *rc;
+
+    if (this->ch_closed_) {
+        sc->sc_error_ = EPIPE;
+        return true;
+    }
+
+    // Straight to a blocked receiver, which runs next (we're only ever
+    // called by the sending thread itself); the buffer must be empty if
+    // there is one
+    if ((rc = this->ch_receivers_.PopFront())) {
+        ASSERT(this->ch_len_ == 0);
+
+        Channel::Store(rc, sc->sc_value_);
+        rc->sc_thread_->CaseDone(rc, 0);
+        g_current_thread->HandOff(rc->sc_thread_);
+        return true;
+    }
+
+    if (this->ch_len_ < this->ch_cap_) {
+        this->ch_buf_->Set(
+            (this->ch_head_ + this->ch_len_) % this->ch_cap_,
+            sc->sc_value_
+        );
+        this->ch_len_++;
+        return true;
+    }
+
+    return false;
+}
+
+bool
+Channel::TryRecv(SelectCase *sc) {
+    SelectCase *wc;
+
+    if (this->ch_len_ > 0) {
+        Channel::Store(sc, this->ch_buf_->Get(this->ch_head_));
+        this->ch_buf_->Set(this->ch_head_, v8::Undefined());
+        this->ch_head_ = (this->ch_head_ + 1) % this->ch_cap_;
+        this->ch_len_--;
+
+        // We've made room for the first blocked sender
+        if ((wc = this->ch_senders_.PopFront())) {
+            this->ch_buf_->Set(
+                (this->ch_head_ + this->ch_len_) % this->ch_cap_,
+                wc->sc_value_
+            );
+            this->ch_len_++;
+            wc->sc_thread_->CaseDone(wc, 0);
+        }
+
+        return true;
+    }
+
+    // Unbuffered, or a sender got in first while we were full
+    if ((wc = this->ch_senders_.PopFront())) {
+        Channel::Store(sc, wc->sc_value_);
+        wc->sc_thread_->CaseDone(wc, 0);
+        return true;
+    }
+
+    if (this->ch_closed_) {
+        Channel::Store(sc, v8::Undefined());
+        sc->sc_error_ = EPIPE;
+        return true;
+    }
+
+    return false;
+}
+
+// The receiving case's handle may belong to the HandleScope of another,
+// blocked thread, and we can't make handles in that. Its cell stays put
+// while the thread is blocked, though, and the GC visits it like any other,
+// so we can just overwrite what it points to.
+void
+Channel::Store(SelectCase *sc, v8::Handle<v8::Value> val) {
+    ASSERT(!sc->sc_send_);
+    ASSERT(!sc->sc_value_.IsEmpty());
+
+    *reinterpret_cast<v8::internal::Object**>(*sc->sc_value_) =
+        *reinterpret_cast<v8::internal::Object**>(*val);
+}
+
+v8::Handle<v8::Object>
+Channel::Wrap(void) {
+    v8::HandleScope scope;
+
+    ASSERT(this->ch_obj_.IsEmpty());
+
+    v8::Local<v8::Object> obj =
+        g_channelTmpl->InstanceTemplate()->NewInstance();
+    obj->SetInternalField(0, v8::External::New(this));
+
+    this->ch_obj_ = v8::Persistent<v8::Object>::New(obj);
+    this->ch_obj_.MakeWeak(this, Channel::WeakCB);
+
+    return scope.Close(obj);
+}
+
+Channel *
+Channel::Unwrap(v8::Handle<v8::Value> val) {
+    if (!g_channelTmpl->HasInstance(val)) {
+        return NULL;
+    }
+
+    v8::Handle<v8::Object> obj = v8::Handle<v8::Object>::Cast(val);
+    return (Channel*) v8::External::Unwrap(obj->GetInternalField(0));
+}
+
+// Our wrapper is garbage; nobody can send or receive on us any more
+void
+Channel::WeakCB(v8::Persistent<v8::Value> obj, void *arg) {
+    Channel *self = (Channel*) arg;
+
+    ASSERT(self->ch_obj_ == obj);
+
+    self->ch_obj_.Dispose();
+    self->ch_obj_.Clear();
+    delete self;
+}
+
+// sleep()
+//
+// sleep(<ms>)
+//
+// Suspends the calling coroutine for at least the given number of
+// milliseconds; other coroutines keep running.
+static v8::Handle<v8::Value>
+Sleep(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    double ms = 0;
+
+    V8_ARG_VALUE(ms, args, 0, Number);
+
+    g_current_thread->Sleep(ms / 1000.0);
+    return v8::Undefined();
+}
+
+// schedclass()
+//
+// <old class> = schedclass([<class>])
+//
+// Returns the calling coroutine's scheduling class (SCHED_CRITICAL,
+// SCHED_NORMAL or SCHED_BULK), first setting it to the given class if
+// there is one. Coroutines spawned by this one (e.g. by accept()) start out
+// in the same class.
+static v8::Handle<v8::Value>
+SchedClass(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int old_cls = g_current_thread->GetSchedClass();
+    int cls = old_cls;
+
+    if (args.Length() > 0) {
+        V8_ARG_VALUE(cls, args, 0, Int32);
+
+        if (cls < 0 || cls >= kSchedClasses) {
+            return v8::ThrowException(v8::Exception::RangeError(
+                FormatString("Invalid scheduling class: %d", cls)
+            ));
+        }
+    }
+
+    g_current_thread->SetSchedClass(cls);
+    return scope.Close(v8::Integer::New(old_cls));
+}
+
+// channel()
+//
+// <channel> = channel([<capacity>])
+//
+// Returns a new channel that buffers up to the given number of values (0 by
+// default). On an unbuffered channel, every send waits for a receiver.
+static v8::Handle<v8::Value>
+ChannelFunc(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int capacity = 0;
+
+    if (args.Length() > 0) {
+        V8_ARG_VALUE(capacity, args, 0, Int32);
+
+        if (capacity < 0) {
+            return v8::ThrowException(v8::Exception::RangeError(
+                FormatString("Invalid channel capacity: %d", capacity)
+            ));
+        }
+    }
+
+    Channel *ch = new Channel(capacity);
+    return scope.Close(ch->Wrap());
+}
+
+// Get the channel that a Channel.prototype method was called on, or throw
+#define CHANNEL_THIS(ch, args) \
+    do { \
+        if (!((ch) = Channel::Unwrap((args).This()))) { \
+            return v8::ThrowException(v8::Exception::TypeError( \
+                v8::String::New("Receiver is not a Channel") \
+            )); \
+        } \
+    } while (0)
+
+// Get an optional timeout, in milliseconds, from the given argument
+#define TIMEOUT_ARG(timeout, args, index) \
+    do { \
+        if ((args).Length() > (index)) { \
+            double ms = 0; \
+            V8_ARG_VALUE(ms, args, index, Number); \
+            (timeout) = ms / 1000.0; \
+        } \
+    } while (0)
+
+// Channel.prototype.send()
+//
+// <err> = channel.send(<value>[, <timeout>])
+//
+// Sends a value, blocking the calling coroutine until a receiver takes it or
+// there is room in the channel's buffer. Returns 0, or -1 with errno set to
+// EPIPE if the channel is closed (or is closed while we wait), or ETIMEDOUT
+// if the timeout (in milliseconds) expired first. undefined can't be sent,
+// as it's what receivers get from a closed channel.
+//
+// A value sent to a blocked receiver is handed straight to it, and the
+// receiver runs next, while the sender goes to the back of the run queue.
+static v8::Handle<v8::Value>
+ChannelSend(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Channel *ch;
+    ev_tstamp timeout = -1;
+    SelectCase sc;
+
+    CHANNEL_THIS(ch, args);
+    V8_ARG_EXISTS(args, 0);
+    TIMEOUT_ARG(timeout, args, 1);
+
+    if (args[0]->IsUndefined()) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Cannot send undefined")
+        ));
+    }
+
+    sc.sc_chan_ = ch;
+    sc.sc_send_ = true;
+    sc.sc_value_ = args[0];
+
+    if (g_current_thread->Select(&sc, 1, timeout) < 0) {
+        return scope.Close(v8::Integer::New(-1));
+    }
+
+    if (sc.sc_error_) {
+        errno = sc.sc_error_;
+        return scope.Close(v8::Integer::New(-1));
+    }
+
+    return scope.Close(v8::Integer::New(0));
+}
+
+// Channel.prototype.recv()
+//
+// <value> = channel.recv([<timeout>])
+//
+// Receives a value, blocking the calling coroutine until there is one.
+// Returns undefined with errno set to EPIPE once the channel is closed and
+// its buffer drained, or ETIMEDOUT if the timeout (in milliseconds) expired
+// first.
+static v8::Handle<v8::Value>
+ChannelRecv(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Channel *ch;
+    ev_tstamp timeout = -1;
+    SelectCase sc;
+
+    CHANNEL_THIS(ch, args);
+    TIMEOUT_ARG(timeout, args, 0);
+
+    sc.sc_chan_ = ch;
+    sc.sc_send_ = false;
+    sc.sc_value_ = v8::Local<v8::Value>::New(v8::Undefined());
+
+    if (g_current_thread->Select(&sc, 1, timeout) < 0) {
+        return v8::Undefined();
+    }
+
+    if (sc.sc_error_) {
+        errno = sc.sc_error_;
+    }
+
+    return scope.Close(sc.sc_value_);
+}
+
+// Channel.prototype.close()
+//
+// channel.close()
+//
+// Closes the channel. Later sends fail with EPIPE, as do those blocked now;
+// receivers get what is left in the buffer, then undefined.
+static v8::Handle<v8::Value>
+ChannelClose(const v8::Arguments &args) {
+    Channel *ch;
+
+    CHANNEL_THIS(ch, args);
+
+    ch->Close();
+    return v8::Undefined();
+}
+
+// Channel.prototype.size()
+//
+// <size> = channel.size()
+//
+// Returns the number of values in the channel's buffer.
+static v8::Handle<v8::Value>
+ChannelSize(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Channel *ch;
+
+    CHANNEL_THIS(ch, args);
+
+    return scope.Close(v8::Integer::New(ch->Size()));
+}
+
+// Channel.prototype.capacity()
+//
+// <capacity> = channel.capacity()
+//
+// Returns the size of the channel's buffer.
+static v8::Handle<v8::Value>
+ChannelCapacity(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Channel *ch;
+
+    CHANNEL_THIS(ch, args);
+
+    return scope.Close(v8::Integer::New(ch->Capacity()));
+}
+
+// Channel.prototype.closed()
+//
+// <closed> = channel.closed()
+//
+// Returns whether the channel has been closed.
+static v8::Handle<v8::Value>
+ChannelIsClosed(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Channel *ch;
+
+    CHANNEL_THIS(ch, args);
+
+    return scope.Close(v8::Boolean::New(ch->Closed()));
+}
+
+// Fill in a SelectCase from one of the objects passed to select(); returns
+// false if it isn't a valid case
+static bool
+ParseSelectCase(v8::Handle<v8::Value> val, SelectCase *sc) {
+    v8::HandleScope scope;
+
+    if (!val->IsObject()) {
+        return false;
+    }
+
+    v8::Local<v8::Object> obj = val->ToObject();
+    v8::Local<v8::Value> v;
+
+    sc->sc_chan_ = NULL;
+    sc->sc_fd_ = -1;
+
+    if (obj->Has(v8::String::NewSymbol("recv"))) {
+        v = obj->Get(v8::String::NewSymbol("recv"));
+        sc->sc_chan_ = Channel::Unwrap(v);
+        sc->sc_send_ = false;
+    } else if (obj->Has(v8::String::NewSymbol("send"))) {
+        v = obj->Get(v8::String::NewSymbol("send"));
+        sc->sc_chan_ = Channel::Unwrap(v);
+        sc->sc_send_ = true;
+
+        if (obj->Get(v8::String::NewSymbol("value"))->IsUndefined()) {
+            return false;
+        }
+    } else if (obj->Has(v8::String::NewSymbol("read"))) {
+        v = obj->Get(v8::String::NewSymbol("read"));
+        sc->sc_fd_ = v->Int32Value();
+        sc->sc_events_ = EV_READ;
+    } else if (obj->Has(v8::String::NewSymbol("write"))) {
+        v = obj->Get(v8::String::NewSymbol("write"));
+        sc->sc_fd_ = v->Int32Value();
+        sc->sc_events_ = EV_WRITE;
+    }
+
+    return sc->sc_chan_ || (sc->sc_fd_ >= 0 && v->IsInt32());
+}
+
+// select()
+//
+// <index> = select(<cases>[, <timeout>])
+//
+// Blocks the calling coroutine until one of the given cases can go ahead,
+// carries it out, and returns its index. Each case is an object:
+//
+//   { recv: <channel> }                 receive a value, which is stored
+//                                       as the case's 'value'
+//   { send: <channel>, value: <value> } send the value
+//   { read: <fd> }                      wait for the fd to be readable
+//   { write: <fd> }                     wait for the fd to be writable
+//
+// errno is set to 0, or to EPIPE if the case's channel was closed (see
+// Channel.prototype.send() and recv()), or EBADF if its fd is invalid or
+// is closed while we wait. Returns -1 with errno set to ETIMEDOUT if the
+// timeout (in milliseconds) expired first. If several cases are ready at
+// once, which one goes ahead varies from call to call.
+static v8::Handle<v8::Value>
+SelectFunc(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    v8::Local<v8::Array> arr;
+    ev_tstamp timeout = -1;
+    SelectCase stack_cases[kSelectStack];
+    SelectCase *cases = stack_cases;
+
+    V8_ARG_EXISTS(args, 0);
+    V8_ARG_TYPE(args, 0, Array);
+    arr = v8::Local<v8::Array>::Cast(args[0]);
+    TIMEOUT_ARG(timeout, args, 1);
+
+    size_t len = arr->Length();
+    if (len == 0) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Nothing to select")
+        ));
+    }
+
+    if (len > kSelectStack) {
+        cases = new SelectCase[len];
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        v8::Local<v8::Value> val = arr->Get(i);
+
+        if (!ParseSelectCase(val, &cases[i])) {
+            if (cases != stack_cases) {
+                delete[] cases;
+            }
+
+            return v8::ThrowException(v8::Exception::TypeError(FormatString(
+                "Element %lu is not a valid select case", (unsigned long) i
+            )));
+        }
+
+        if (cases[i].sc_chan_) {
+            cases[i].sc_value_ = (cases[i].sc_send_) ?
+                val->ToObject()->Get(v8::String::NewSymbol("value")) :
+                v8::Local<v8::Value>::New(v8::Undefined());
+        }
+    }
+
+    int idx = g_current_thread->Select(cases, len, timeout);
+
+    if (idx >= 0) {
+        SelectCase *sc = &cases[idx];
+
+        if (sc->sc_chan_ && !sc->sc_send_) {
+            arr->Get(idx)->ToObject()->Set(
+                v8::String::NewSymbol("value"), sc->sc_value_
+            );
+        }
+
+        errno = sc->sc_error_;
+    }
+
+    if (cases != stack_cases) {
+        delete[] cases;
+    }
+
+    return scope.Close(v8::Integer::New(idx));
+}
+
+// schedstats()
+//
+// <stats> = schedstats()
+//
+// Returns a snapshot of scheduler counters:
+//
+//   pool   CallbackThread pool size, hit/miss/retire counts and watermarks
+//   runq   the scheduling policy, current and maximum run queue length,
+//          and for each scheduling class (indexed by SCHED_CRITICAL etc.)
+//          the number of coroutines run, the total and maximum time (usec)
+//          they waited in the run queue, and a histogram of those waits in
+//          which bucket i counts those of less than 2^i usec
+//   tick   number of scheduler ticks run, how many ran out of budget, total
+//          threads run, total and maximum tick duration (i.e. how long the
+//          event loop went without polling), and the budget itself
+//   timers number of Sleep() and YieldIO() timeouts currently armed
+//   stack  the calling coroutine's stack size and high-water mark, the
+//          default stack size, and the number, maximum and average of the
+//          high-water marks sampled as coroutines finish running their code
+//   cpu    total preemptions and terminations, the slice and hard limit
+//          (ms), and the CPU time (ms) that the calling coroutine has used
+//          since it last blocked
+//   lazy   accepted connections waiting for their first bytes without a
+//          coroutine (see CallWhenReadable()), and the total that got a
+//          coroutine because bytes arrived or because they timed out
+static v8::Handle<v8::Value>
+SchedStats(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    v8::Local<v8::Object> stats = v8::Object::New();
+    v8::Local<v8::Object> pool = v8::Object::New();
+
+    SET_NUMBER(pool, "size", g_poolStats.tps_size_);
+    SET_NUMBER(pool, "hits", g_poolStats.tps_hits_);
+    SET_NUMBER(pool, "misses", g_poolStats.tps_misses_);
+    SET_NUMBER(pool, "retired", g_poolStats.tps_retired_);
+    SET_NUMBER(pool, "low", g_poolLowWatermark);
+    SET_NUMBER(pool, "high", g_poolHighWatermark);
+    stats->Set(v8::String::NewSymbol("pool"), pool);
+
+    v8::Local<v8::Object> runq = v8::Object::New();
+
+    runq->Set(
+        v8::String::NewSymbol("policy"),
+        v8::String::New(g_schedPolicy->Name())
+    );
+    SET_NUMBER(runq, "length", g_schedPolicy->Size());
+    SET_NUMBER(runq, "max", g_tickStats.ts_runq_max_);
+
+    v8::Local<v8::Array> classes = v8::Array::New(kSchedClasses);
+
+    for (int i = 0; i < kSchedClasses; i++) {
+        const SchedClassStats *scs = &g_schedClassStats[i];
+        v8::Local<v8::Object> cls = v8::Object::New();
+        v8::Local<v8::Array> hist = v8::Array::New(kSchedWaitBuckets);
+
+        for (size_t b = 0; b < kSchedWaitBuckets; b++) {
+            hist->Set(b, v8::Number::New((double) scs->scs_wait_hist_[b]));
+        }
+
+        SET_NUMBER(cls, "runs", scs->scs_runs_);
+        SET_NUMBER(cls, "waitUsec", scs->scs_wait_usec_);
+        SET_NUMBER(cls, "waitUsecMax", scs->scs_wait_usec_max_);
+        cls->Set(v8::String::NewSymbol("waitHist"), hist);
+        classes->Set(i, cls);
+    }
+
+    runq->Set(v8::String::NewSymbol("classes"), classes);
+    stats->Set(v8::String::NewSymbol("runq"), runq);
+
+    v8::Local<v8::Object> tick = v8::Object::New();
+
+    SET_NUMBER(tick, "count", g_tickStats.ts_ticks_);
+    SET_NUMBER(tick, "exhausted", g_tickStats.ts_exhausted_);
+    SET_NUMBER(tick, "threads", g_tickStats.ts_threads_);
+    SET_NUMBER(tick, "usec", g_tickStats.ts_usec_);
+    SET_NUMBER(tick, "usecMax", g_tickStats.ts_usec_max_);
+    SET_NUMBER(tick, "budgetThreads", g_tickBudgetThreads);
+    SET_NUMBER(tick, "budgetUsec", g_tickBudgetUsec);
+    stats->Set(v8::String::NewSymbol("tick"), tick);
+
+    v8::Local<v8::Object> timers = v8::Object::New();
+
+    SET_NUMBER(timers, "armed", g_timerWheel.Size());
+    stats->Set(v8::String::NewSymbol("timers"), timers);
+
+    v8::Local<v8::Object> stack = v8::Object::New();
+
+    SET_NUMBER(stack, "size", g_current_thread->stack_size());
+    SET_NUMBER(stack, "used", g_current_thread->StackHighWater());
+    SET_NUMBER(stack, "defaultSize", v8::internal::Thread::GetDefaultStackSize());
+    SET_NUMBER(stack, "sampled", g_stackStats.ss_sampled_);
+    SET_NUMBER(stack, "usedMax", g_stackStats.ss_used_max_);
+    SET_NUMBER(
+        stack, "usedAvg",
+        (g_stackStats.ss_sampled_) ?
+            g_stackStats.ss_used_total_ / g_stackStats.ss_sampled_ : 0
+    );
+    stats->Set(v8::String::NewSymbol("stack"), stack);
+
+    v8::Local<v8::Object> cpu = v8::Object::New();
+
+    SET_NUMBER(cpu, "preempted", g_cpuStats.cs_preempted_);
+    SET_NUMBER(cpu, "terminated", g_cpuStats.cs_terminated_);
+    SET_NUMBER(cpu, "slice", g_cpuSliceUsec / 1000.0);
+    SET_NUMBER(cpu, "limit", g_cpuLimitUsec / 1000.0);
+    SET_NUMBER(cpu, "used", g_current_thread->CpuUsed() / 1000.0);
+    stats->Set(v8::String::NewSymbol("cpu"), cpu);
+
+    v8::Local<v8::Object> lazy = v8::Object::New();
+
+    SET_NUMBER(lazy, "pending", g_lazyStats.lcs_pending_);
+    SET_NUMBER(lazy, "ready", g_lazyStats.lcs_ready_);
+    SET_NUMBER(lazy, "timedOut", g_lazyStats.lcs_timedout_);
+    stats->Set(v8::String::NewSymbol("lazy"), lazy);
+
+    return scope.Close(stats);
+}
+
+// Set scheduler functions on the given target object
+void
+InitSched(v8::Handle<v8::Object> target) {
+    ev_idle_init(&g_tickIdle, TickIdleCB);
+    ev_timer_init(&g_timerDriver, TimerDriverCB, 0, 0);
+    g_timerEpoch = ev_time();
+
+    // Not SET_CONST(), as our names for these aren't JavaScript's
+    static const struct {
+        const char *name;
+        int cls;
+    } classes[] = {
+        { "SCHED_CRITICAL", kSchedClassCritical },
+        { "SCHED_NORMAL", kSchedClassNormal },
+        { "SCHED_BULK", kSchedClassBulk }
+    };
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        target->Set(
+            v8::String::NewSymbol(classes[i].name),
+            v8::Integer::New(classes[i].cls),
+            (v8::PropertyAttribute) (v8::ReadOnly | v8::DontDelete)
+        );
+    }
+
+    SET_FUNC(target, "sleep", Sleep);
+    SET_FUNC(target, "schedclass", SchedClass);
+    SET_FUNC(target, "schedstats", SchedStats);
+    SET_FUNC(target, "channel", ChannelFunc);
+    SET_FUNC(target, "select", SelectFunc);
+
+    g_channelTmpl = v8::Persistent<v8::FunctionTemplate>::New(
+        v8::FunctionTemplate::New()
+    );
+    g_channelTmpl->SetClassName(v8::String::NewSymbol("Channel"));
+    g_channelTmpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    static const struct {
+        const char *name;
+        v8::InvocationCallback func;
+    } methods[] = {
+        { "send", ChannelSend },
+        { "recv", ChannelRecv },
+        { "close", ChannelClose },
+        { "size", ChannelSize },
+        { "capacity", ChannelCapacity },
+        { "closed", ChannelIsClosed }
+    };
+
+    v8::Local<v8::ObjectTemplate> proto = g_channelTmpl->PrototypeTemplate();
+
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        proto->Set(
+            v8::String::NewSymbol(methods[i].name),
+            v8::FunctionTemplate::New(methods[i].func)
+        );
+    }
 }
@@ -2,14 +2,123 @@
 #define __corona_sched_h__
 
 #include <ev.h>
+#include "queue.h"
+#include "timerwheel.h"
 #include "v8-util.h"
 
+struct FdWatcher;
+class CallbackLimit;
+class Channel;
+class CoronaThread;
+class Future;
+class Task;
+struct LazyCallback;
+
+/**
+ * One of the alternatives that CoronaThread::Select() waits on: sending a
+ * value to a channel, receiving one from it, or an fd becoming readable or
+ * writable.
+ *
+ * Cases live on the selecting thread's stack, and are linked straight onto
+ * the channels' wait queues while it is blocked, so neither blocking nor
+ * handing over a value allocates anything.
+ */
+struct SelectCase {
+    /**
+     * Watcher for fd cases; see SelectIOCB(). This must be the first
+     * member, as the callback casts back from it.
+     */
+    struct ev_io sc_io_;
+
+    /**
+     * The channel, or NULL for an fd case, and whether we are sending to
+     * it or receiving from it.
+     */
+    Channel *sc_chan_;
+    bool sc_send_;
+
+    /**
+     * For sends, the value to send. For receives, a handle of the caller's
+     * own (e.g. from v8::Local::New(), never a shared one like
+     * v8::Undefined()) that the received value is stored into, possibly by
+     * another thread; see Channel::Store().
+     */
+    v8::Handle<v8::Value> sc_value_;
+
+    /**
+     * For fd cases, the fd and the event (EV_READ or EV_WRITE).
+     */
+    int sc_fd_;
+    int sc_events_;
+
+    /**
+     * Set once the case has gone ahead: 0, or EPIPE if the channel was
+     * closed (in which case a receive gets undefined), or EBADF if the fd
+     * was closed (see UnwatchFd()) or found to be invalid.
+     */
+    int sc_error_;
+
+    /**
+     * Linkage for the channel's wait queue (or for fd cases, the fd's; see
+     * UnwatchFd()), and our place in the select.
+     */
+    QueueLink<SelectCase> sc_link_;
+    CoronaThread *sc_thread_;
+    size_t sc_index_;
+};
+
+typedef Queue<SelectCase, &SelectCase::sc_link_> SelectCaseQueue;
+
+/**
+ * One of the fds that CoronaThread::Poll() waits on.
+ *
+ * Like SelectCase, these are supplied by the caller, usually on its stack,
+ * so that polling doesn't allocate.
+ */
+struct PollFd {
+    /**
+     * Watcher for the fd; see PollIOCB(). This must be the first member, as
+     * the callback casts back from it.
+     */
+    struct ev_io pf_io_;
+
+    /**
+     * Filled in by the caller: the fd, and the events (EV_READ and/or
+     * EV_WRITE) to wait for.
+     */
+    int pf_fd_;
+    int pf_events_;
+
+    /**
+     * Set by Poll(): the events that the fd is ready for, or EV_ERROR if
+     * it was closed (see UnwatchFd()) or found to be invalid, or 0 if it
+     * isn't ready.
+     */
+    int pf_revents_;
+
+    /**
+     * Linkage for the fd's queue of pollers, which UnwatchFd() fails, and
+     * the polling thread.
+     */
+    QueueLink<PollFd> pf_link_;
+    CoronaThread *pf_thread_;
+};
+
+typedef Queue<PollFd, &PollFd::pf_link_> PollFdQueue;
+
 /**
  * Base class for all Corona V8 threads.
  */
 class CoronaThread : public v8::internal::Thread {
     public:
-        CoronaThread(void);
+        /**
+         * Create a thread with a stack of the given size, or of the default
+         * size (see SetDefaultStackSize()) if that is 0.
+         *
+         * JavaScript running on the thread gets a RangeError once it comes
+         * within kStackReserve bytes of the end of the stack.
+         */
+        CoronaThread(size_t stack_size = 0);
 
         /**
          * Subclasses should implement Run2() rather than overriding this.
@@ -17,37 +126,212 @@ class CoronaThread : public v8::internal::Thread {
         void Run(void);
 
         /**
-         * Yield until we see some activity on the given fd.
+         * Yield until the given fd is readable (EV_READ) or writable
+         * (EV_WRITE).
+         *
+         * Readers and writers of an fd wait independently, so one thread
+         * can wait to read while another waits to write. Each readiness
+         * event wakes a single waiter, in the order that they started
+         * waiting.
+         *
+         * If 'timeout' is non-negative, give up after that many seconds.
+         *
+         * Returns 0 once the fd is ready, or -1 with errno set to EBADF if
+         * the fd was closed (see UnwatchFd()) or found to be invalid while
+         * we were waiting, or ETIMEDOUT if the timeout expired first.
+         *
+         * The fd's watcher is left armed once we wake up so that waiting on
+         * it again is cheap.
+         */
+        int YieldIO(int fd, int events, ev_tstamp timeout = -1);
+
+        /**
+         * Yield for the given number of seconds.
+         */
+        void Sleep(ev_tstamp secs);
+
+        /**
+         * Yield until all of the given futures are done, or if 'all' is
+         * false, until any of them is. We wait as the futures' waiter (see
+         * Future::fu_waiter_), so they must not be waited on by any other
+         * thread; no threads other than ours are involved.
+         *
+         * If 'timeout' is non-negative, give up after that many seconds.
+         *
+         * Returns 0 once the futures are done, or -1 with errno set to
+         * ETIMEDOUT if the timeout expired first.
+         */
+        int WaitFutures(Future **futs, size_t nfuts, bool all,
+                        ev_tstamp timeout = -1);
+
+        /**
+         * Carry out one of the given cases, yielding until one of them can
+         * go ahead if none can straight away. Cases that are ready at once
+         * are tried starting from a different one each time, so that none
+         * of them is starved. A send that hands its value straight to a
+         * blocked receiver runs the receiver next, and sends us to the back
+         * of the run queue (unless the receiver is in a different
+         * scheduling class, or this tick is over).
+         *
+         * If 'timeout' is non-negative, give up after that many seconds.
+         *
+         * Returns the index of the case that went ahead (see
+         * SelectCase::sc_error_ for how it went), or -1 with errno set to
+         * ETIMEDOUT if the timeout expired first.
+         */
+        int Select(SelectCase *cases, size_t ncases, ev_tstamp timeout = -1);
+
+        /**
+         * Yield until at least one of the given fds is ready, and report
+         * every one that is (see PollFd::pf_revents_). All of the fds are
+         * watched at once and we're woken a single time, however many of
+         * them become ready in the same trip around the event loop.
+         *
+         * An fd that is closed (see UnwatchFd()) while we wait on it counts
+         * as ready, with EV_ERROR.
+         *
+         * If 'timeout' is non-negative, give up after that many seconds.
+         *
+         * Returns the number of fds that are ready, or -1 with errno set to
+         * ETIMEDOUT if the timeout expired first.
          */
-        void YieldIO(int fd, int events);
+        int Poll(PollFd *fds, size_t nfds, ev_tstamp timeout = -1);
 
         /**
          * Mark this thread as runnable (but don't run it).
          */
         void Schedule(void);
 
-    protected:
         /**
-         * Storage for different libev watchers.
+         * Ask this thread to stop running its code.
          *
-         * We keep a reference to ourself in this structure so that we can
-         * cast back to get it from our callbacks.
+         * Whatever the thread is blocked in (YieldIO(), Sleep() or
+         * WaitFutures()) fails with ECANCELED, and V8 is asked to terminate
+         * its JavaScript as soon as it is running again; termination can't
+         * be caught, so the thread unwinds straight back to Run2(). A thread
+         * that is runnable is terminated once it runs, and one that has been
+         * preempted, on the next tick of the CPU timer (see SetCpuQuota()).
+         * Cancelling a thread twice is harmless.
          */
-        struct ct_ev {
-            union {
-                struct ev_io ct_io_;
-            } ct_u_;
+        void Cancel(void);
+        bool Cancelled(void) const;
 
-            CoronaThread *ct_self_;
-        } ct_ev_;
+        /**
+         * Get or set this thread's scheduling class (kSchedClassNormal by
+         * default); see kSchedClassCritical. A new class takes effect the
+         * next time that the thread becomes runnable.
+         */
+        int GetSchedClass(void) const;
+        void SetSchedClass(int cls);
+
+        /**
+         * Get or set whether calls that would block this thread should
+         * return a Future instead (false by default); see Future.
+         */
+        bool GetFutureMode(void) const;
+        void SetFutureMode(bool future_mode);
+
+        /**
+         * CPU time, in microseconds, used since this thread last blocked in
+         * YieldIO() or Sleep() (or started a run of Run2()), however many
+         * times it has been preempted since. This is only tracked while a
+         * CPU quota is set (see SetCpuQuota()), and is 0 otherwise.
+         */
+        uint64_t CpuUsed(void);
 
         /**
-         * The libev structure currently in use.
+         * Linkage for the scheduler's run and zombie queues.
          *
-         * Valid values are like such as the EV_PREPARE, EV_IO and everything
-         * like such as.
+         * A thread is only ever on one of these (or the thread pool, or an
+         * fd's wait queue) at once, so they share this. Being linked also
+         * serves as the "already runnable" flag that keeps a thread from
+         * being scheduled twice.
+         */
+        QueueLink<CoronaThread> ct_runq_link_;
+
+        /**
+         * When we last became runnable, for measuring how long each
+         * scheduling class waits in the run queue.
+         */
+        ev_tstamp ct_runnable_since_;
+
+    protected:
+        /**
+         * The event (EV_READ or EV_WRITE) we're blocked in YieldIO() waiting
+         * for, or 0 if we're not, and the watcher whose queue we're on.
+         */
+        int ct_wait_events_;
+        struct FdWatcher *ct_wait_fdw_;
+
+        /**
+         * Set by whoever wakes us from YieldIO() if the wait failed; this
+         * is only copied to errno once we're running again, as other
+         * threads may clobber it in the meantime.
+         */
+        int ct_wait_error_;
+
+        /**
+         * The futures we're blocked in WaitFutures() on, and how many more
+         * of them need to finish before we wake up.
+         */
+        Future **ct_wait_futures_;
+        size_t ct_wait_nfutures_;
+        size_t ct_wait_needed_;
+
+        /**
+         * The cases we're blocked in Select() on, and the index of the one
+         * that went ahead, once one has.
+         */
+        SelectCase *ct_wait_cases_;
+        size_t ct_wait_ncases_;
+        int ct_wait_fired_;
+
+        /**
+         * The fds we're blocked in Poll() on, and how many of them are
+         * ready so far.
          */
-        uint32_t ct_ev_type_;
+        PollFd *ct_wait_pollfds_;
+        size_t ct_wait_npollfds_;
+        size_t ct_wait_nready_;
+
+        /**
+         * Timer for Sleep() and YieldIO() timeouts.
+         *
+         * This is armed on the scheduler's timer wheel rather than as an
+         * ev_timer of its own, so arming and cancelling it are O(1) no
+         * matter how many threads are waiting. It is part of the thread so
+         * that a timed wait doesn't allocate. We keep a reference to ourself
+         * in this structure so that we can cast back to get it from our
+         * callback.
+         */
+        struct ct_timer {
+            WheelTimer ct_w_;
+            CoronaThread *ct_self_;
+        } ct_timer_;
+
+        /**
+         * CPU time (in microseconds) that we had used since we last blocked
+         * (or started a run of Run2()) as of the start of our current
+         * slice, and whether we have asked V8 to terminate us for running
+         * over the hard limit; see SetCpuQuota().
+         */
+        uint64_t ct_cpu_usec_;
+        bool ct_cpu_terminated_;
+
+        /**
+         * Our scheduling class.
+         */
+        int ct_sched_class_;
+
+        /**
+         * Do blocking calls return futures?
+         */
+        bool ct_future_mode_;
+
+        /**
+         * Has Cancel() been called since our current work was handed to us?
+         */
+        bool ct_cancelled_;
 
         /**
          * Subclasses implement this for their logic.
@@ -58,29 +342,565 @@ class CoronaThread : public v8::internal::Thread {
          */
         virtual void Run2(void) = 0;
 
+        /**
+         * Called once Run2() has returned to give the thread a chance to be
+         * re-used.
+         *
+         * Returning true means that the thread has been given new work and
+         * that Run2() should be invoked again. Returning false retires the
+         * thread. The default implementation always retires.
+         */
+        virtual bool Recycle(void);
+
+        /**
+         * Switch to the next runnable thread, or the main thread if there
+         * are none, without arranging to be woken up again.
+         *
+         * Must not be called with the V8 lock held.
+         */
+        void Switch(void);
+
     private:
         void Yield(void);
-        static void ReadyCB(struct ev_loop *el, void *evp, int revents);
+        void HandOff(CoronaThread *next);
+        bool Blocked(void) const;
+        void Interrupt(int err);
+        void StartTimer(ev_tstamp secs);
+        void StartCpuSlice(void);
+        void EndCpuSlice(void);
+        void FutureDone(void);
+        void DetachFutures(void);
+        void CaseDone(SelectCase *sc, int err);
+        void DetachCases(void);
+        void PollFdReady(PollFd *pf, int revents);
+        void DetachPollFds(void);
+        void Wake(int err);
+        static void IOReadyCB(struct ev_loop *el, struct ev_io *w,
+                              int revents);
+        static void TimeoutCB(WheelTimer *wt);
+        static void SelectIOCB(struct ev_loop *el, struct ev_io *w,
+                               int revents);
+        static void PollIOCB(struct ev_loop *el, struct ev_io *w,
+                             int revents);
+        static void CpuTimerCB(int sig);
+        static void PreemptCB(void);
+        static void FailIOWaiters(struct FdWatcher *fdw, int err);
+
+        friend void UnwatchFd(int fd);
+        friend void SetCpuQuota(ev_tstamp slice, ev_tstamp limit);
+        friend class Future;
+        friend class Channel;
 };
 
 /**
  * Thread for invoking callbacks in their own control flow.
+ *
+ * These are pooled: once a callback returns, its thread (stack, coroutine
+ * context and handle slots) is parked in the pool and handed to the next
+ * callback rather than being freed.
  */
 class CallbackThread : public CoronaThread {
     public:
-        CallbackThread(v8::Function *cb, uint8_t argc,
-                       v8::Handle<v8::Value> argv[]);
+        /**
+         * Get a thread that will invoke the given callback, recycling one
+         * from the pool if possible. The thread is not scheduled.
+         *
+         * If a task is given, the callback's return value or exception is
+         * handed to it once the callback is done (see Task::Finish());
+         * otherwise it is dropped.
+         */
+        static CallbackThread *Get(v8::Handle<v8::Function> cb, uint8_t argc,
+                                   v8::Handle<v8::Value> argv[],
+                                   size_t stack_size = 0,
+                                   Task *task = NULL);
+
         ~CallbackThread(void);
         void Run2(void);
 
+        /**
+         * Hold a slot of the given limit until our callback returns. The
+         * slot must already have been taken; see CallbackLimit::Acquire().
+         */
+        void SetLimit(CallbackLimit *cl);
+
+    protected:
+        bool Recycle(void);
+
     private:
+        CallbackThread(size_t stack_size);
+
+        // Take references to the given callback and arguments
+        void Reset(v8::Handle<v8::Function> cb, uint8_t argc,
+                   v8::Handle<v8::Value> argv[]);
+
+        // Drop references taken by Reset()
+        void Clear(void);
+
+        // Get a thread, from the pool if possible, without any work
+        static CallbackThread *Acquire(size_t stack_size);
+
+        // Hand a lazy callback to a thread; see CallWhenReadable()
+        static void StartLazy(LazyCallback *lc);
+        static void LazyReadyCB(struct ev_loop *el, struct ev_io *w,
+                                int revents);
+        static void LazyTimeoutCB(WheelTimer *wt);
+
         v8::Persistent<v8::Function> cb_;
         uint8_t argc_;
+        uint8_t argv_cap_;
         v8::Persistent<v8::Value> *argv_;
+        Task *task_;
+        CallbackLimit *limit_;
+
+        // A lazy callback to run in place of cb_, which we take over (and
+        // free) once we're running; see CallWhenReadable()
+        LazyCallback *lazy_;
+
+        friend void FillThreadPool(void);
+        friend void CallWhenReadable(v8::Handle<v8::Function> cb, int fd,
+                                     ev_tstamp timeout, CallbackLimit *cl);
 };
 
 /**
- * Pop the next runnable thread to run off of the runq.
+ * Invoke cb(fd) on a CallbackThread once the given fd is readable, or once
+ * 'timeout' seconds have passed if that is non-negative.
+ *
+ * Until then, the fd costs a record of a couple of hundred bytes (a
+ * watcher, a timer and a reference to the callback) rather than a thread
+ * and its stack. This is for accepted connections that may sit idle or go
+ * away without sending anything: health checks, port scans and idle
+ * keep-alives. The thread is taken from the pool, and is in the caller's
+ * scheduling class.
+ *
+ * If a limit is given, its slot (which must already have been taken) is
+ * held from now until the callback returns.
+ */
+void CallWhenReadable(v8::Handle<v8::Function> cb, int fd,
+                      ev_tstamp timeout = -1, CallbackLimit *cl = NULL);
+
+/**
+ * Counters for CallWhenReadable().
+ *
+ * The number of callbacks still waiting for their fd, and how many have
+ * been started because their fd became readable or because they timed
+ * out.
+ */
+struct LazyCallbackStats {
+    size_t lcs_pending_;
+    size_t lcs_ready_;
+    size_t lcs_timedout_;
+};
+
+/**
+ * Get the current CallWhenReadable() counters.
+ */
+const LazyCallbackStats &GetLazyCallbackStats(void);
+
+/**
+ * A cap on the number of callbacks that may be running at once, e.g. those
+ * handling connections from one accept loop.
+ *
+ * Whoever starts the callbacks takes a slot for each with Acquire(), which
+ * blocks while they are all taken, and hands it to the callback's thread
+ * (see CallbackThread::SetLimit()), which gives it back once the callback
+ * has returned. Only the thread that created the limit may Acquire() from
+ * it. It calls Close() rather than deleting the limit, which lives on until
+ * the last slot is given back.
+ */
+class CallbackLimit {
+    public:
+        CallbackLimit(size_t max);
+
+        /**
+         * Take a slot, blocking the calling thread until one is free. Only
+         * one thread may be blocked here at once.
+         *
+         * If 'timeout' is non-negative, give up after that many seconds.
+         *
+         * Returns 0, or -1 with errno set to ETIMEDOUT if the timeout
+         * expired first (or ECANCELED if the thread was cancelled).
+         */
+        int Acquire(ev_tstamp timeout = -1);
+
+        /**
+         * Give back a slot, waking anyone blocked in Acquire().
+         */
+        void Release(void);
+
+        /**
+         * Give up our creator's reference; we are deleted once every slot
+         * has been given back.
+         */
+        void Close(void);
+
+        /**
+         * The number of slots taken, and the most that may be.
+         */
+        size_t Running(void) const;
+        size_t Max(void) const;
+
+    private:
+        ~CallbackLimit(void);
+
+        size_t cl_max_;
+        size_t cl_running_;
+        bool cl_closed_;
+
+        // Completed by Release() for whoever is blocked in Acquire()
+        Future *cl_waiter_;
+};
+
+/**
+ * A bounded FIFO of JavaScript values for threads to talk to each other
+ * through; see CoronaThread::Select() for sending and receiving.
+ *
+ * A value sent while a receiver is blocked goes straight to it, never
+ * touching the buffer, and a receiver that makes room in a full buffer
+ * takes a blocked sender's value along with it, waking the sender. A
+ * channel with a capacity of 0 is unbuffered: every send waits for a
+ * receiver. The buffer is allocated once, when the channel is created.
+ *
+ * Once closed, sends fail and receives drain what is left in the buffer,
+ * then fail; threads blocked on the channel are woken with EPIPE.
+ */
+class Channel {
+    public:
+        Channel(size_t capacity);
+        ~Channel(void);
+
+        /**
+         * Close the channel; see above.
+         */
+        void Close(void);
+        bool Closed(void) const;
+
+        /**
+         * The number of values buffered, and the most there can be.
+         */
+        size_t Size(void) const;
+        size_t Capacity(void) const;
+
+        /**
+         * Create the JavaScript object representing this channel, which
+         * owns it from then on.
+         */
+        v8::Handle<v8::Object> Wrap(void);
+
+        /**
+         * Get the channel represented by the given JavaScript value, or
+         * NULL if it isn't a channel.
+         */
+        static Channel *Unwrap(v8::Handle<v8::Value> val);
+
+    private:
+        // Carry out the given case if it can go ahead without blocking
+        bool TryCase(SelectCase *sc);
+        bool TrySend(SelectCase *sc);
+        bool TryRecv(SelectCase *sc);
+
+        // Store a value in a receiving case's handle
+        static void Store(SelectCase *sc, v8::Handle<v8::Value> val);
+
+        static void WeakCB(v8::Persistent<v8::Value> obj, void *arg);
+
+        // Ring buffer of ch_cap_ values (or none, if unbuffered), starting
+        // at ch_head_
+        v8::Persistent<v8::Array> ch_buf_;
+        size_t ch_cap_;
+        size_t ch_head_;
+        size_t ch_len_;
+        bool ch_closed_;
+
+        // Cases blocked on sending to and receiving from us; at most one of
+        // these is non-empty at a time, except in a select that both sends
+        // and receives on us
+        SelectCaseQueue ch_senders_;
+        SelectCaseQueue ch_receivers_;
+
+        v8::Persistent<v8::Object> ch_obj_;
+
+        friend class CoronaThread;
+};
+
+/**
+ * Scheduling classes.
+ *
+ * Under the priority policy (see NewSchedPolicy()), runnable threads of a
+ * class only run once there are no runnable threads of the classes before
+ * it, so admin, health-check and other latency-critical work isn't stuck
+ * behind bulk work. Other policies ignore the class, but queue latency is
+ * measured per class whatever the policy.
+ */
+static const int kSchedClassCritical = 0;
+static const int kSchedClassNormal = 1;
+static const int kSchedClassBulk = 2;
+static const int kSchedClasses = 3;
+
+/**
+ * Counters for a scheduling class.
+ *
+ * The number of times that threads of the class have been taken off of the
+ * run queue to be run, and how long they had been waiting there: the total
+ * and maximum in microseconds, and a histogram whose bucket i counts waits
+ * of less than 2^i microseconds (and at least 2^(i - 1)); the last bucket
+ * also counts anything longer.
+ */
+static const size_t kSchedWaitBuckets = 20;
+
+struct SchedClassStats {
+    size_t scs_runs_;
+    size_t scs_wait_usec_;
+    size_t scs_wait_usec_max_;
+    size_t scs_wait_hist_[kSchedWaitBuckets];
+};
+
+/**
+ * Get the current counters for the given scheduling class.
+ */
+const SchedClassStats &GetSchedClassStats(int cls);
+
+/**
+ * Counters for the CallbackThread pool.
+ */
+struct ThreadPoolStats {
+    size_t tps_size_;
+    size_t tps_hits_;
+    size_t tps_misses_;
+    size_t tps_retired_;
+};
+
+/**
+ * Default thread pool watermarks.
+ */
+static const size_t kThreadPoolDefaultLow = 8;
+static const size_t kThreadPoolDefaultHigh = 256;
+
+/**
+ * Set the pool watermarks.
+ *
+ * The pool is topped back up to 'low' idle threads from the event loop, so
+ * bursts of new callbacks can be served without allocation. Threads
+ * finishing their callback while 'high' threads are already idle are
+ * retired rather than pooled.
+ */
+void SetThreadPoolWatermarks(size_t low, size_t high);
+
+/**
+ * Allocate idle threads until the pool reaches its low watermark.
+ *
+ * Must be called from the main thread.
+ */
+void FillThreadPool(void);
+
+/**
+ * Get the current thread pool counters.
+ */
+const ThreadPoolStats &GetThreadPoolStats(void);
+
+/**
+ * Counters for scheduler ticks.
+ *
+ * A tick is one trip from the event loop through the runnable threads and
+ * back again. Durations are in microseconds.
+ */
+struct TickStats {
+    size_t ts_ticks_;
+    size_t ts_exhausted_;
+    size_t ts_threads_;
+    size_t ts_usec_;
+    size_t ts_usec_max_;
+    size_t ts_runq_max_;
+};
+
+/**
+ * Default tick budget.
+ */
+static const size_t kTickBudgetDefaultThreads = 64;
+static const size_t kTickBudgetDefaultUsec = 0;
+
+/**
+ * Set the per-tick budget.
+ *
+ * Once 'threads' threads have been run or 'usec' microseconds have passed
+ * since the start of a tick, control returns to the event loop, which polls
+ * for I/O without blocking before starting the next tick. A value of 0
+ * means no limit. Larger budgets favour throughput; smaller ones keep I/O
+ * latency down when the run queue is busy.
+ */
+void SetTickBudget(size_t threads, size_t usec);
+
+/**
+ * Run a tick's worth of runnable threads.
+ *
+ * Must be called from the main thread.
+ */
+void RunTick(void);
+
+/**
+ * Get the current tick counters.
+ */
+const TickStats &GetTickStats(void);
+
+/**
+ * Stack sizes, in bytes.
+ *
+ * kStackReserve is left below the limit at which V8 throws a RangeError for
+ * its own C++ frames (runtime calls, building the error, and so on). Stacks
+ * smaller than kStackSizeMin would leave too little for JavaScript.
+ */
+static const size_t kStackReserve = 32 * 1024;
+static const size_t kStackSizeMin = 64 * 1024;
+
+/**
+ * Set the stack size for threads created without an explicit size.
+ *
+ * Only threads with the default stack size are pooled.
+ */
+void SetDefaultStackSize(size_t bytes);
+
+/**
+ * Counters for stack usage.
+ *
+ * Each time a thread finishes running its code, we sample how much of its
+ * stack it has ever used (its high-water mark, found by looking for the
+ * deepest part of the stack that has been written to). These are the number
+ * of samples, their total and their maximum, in bytes.
+ */
+struct StackStats {
+    size_t ss_sampled_;
+    size_t ss_used_total_;
+    size_t ss_used_max_;
+};
+
+/**
+ * Get the current stack usage counters.
+ */
+const StackStats &GetStackStats(void);
+
+/**
+ * Counters for CPU quotas.
+ *
+ * The number of times that threads have been preempted for using up their
+ * slice, and terminated for running over the hard limit.
+ */
+struct CpuStats {
+    size_t cs_preempted_;
+    size_t cs_terminated_;
+};
+
+/**
+ * Limit how long a thread may run JavaScript without giving up the CPU.
+ *
+ * A thread that runs for 'slice' seconds of CPU time without yielding is
+ * preempted at its next safe point (a function call or loop back edge) and
+ * goes to the back of the run queue once the event loop has polled, so a
+ * busy loop can't keep other threads' I/O waiting for longer than about a
+ * slice. A thread that uses 'limit' seconds of CPU time without blocking in
+ * YieldIO() or Sleep() is terminated as by v8::V8::TerminateExecution();
+ * this can't be caught by JavaScript. Long-lived threads that block as they
+ * should (e.g. accept loops) are never terminated, however much CPU they
+ * use in all. A value of 0 (the default for both) means no limit.
+ *
+ * CPU time is checked by a SIGVTALRM interval timer, which costs nothing
+ * while the process is idle. Otherwise a quota costs a getrusage(2) each
+ * time a thread takes or gives up the V8 lock, and a trip through V8's
+ * stack guard for each millisecond of CPU time: the signal handler leaves
+ * the decision to the thread once it reaches a safe point.
+ */
+void SetCpuQuota(ev_tstamp slice, ev_tstamp limit);
+
+/**
+ * Get the current CPU quota counters.
+ */
+const CpuStats &GetCpuStats(void);
+
+/**
+ * Set scheduler-related functions on the given target object.
+ */
+void InitSched(v8::Handle<v8::Object> target);
+
+/**
+ * Intrusive queue of threads, as used by the scheduler.
+ */
+typedef Queue<CoronaThread, &CoronaThread::ct_runq_link_> CoronaThreadQueue;
+
+/**
+ * Scheduling policy: decides the order in which runnable threads run.
+ *
+ * Threads are linked into a policy's queues through ct_runq_link_, so
+ * pushing and popping must not allocate, and pushing a thread that is
+ * already queued must leave it where it is and return false.
+ */
+class SchedPolicy {
+    public:
+        virtual ~SchedPolicy(void) {}
+
+        /**
+         * The policy's name, as given to NewSchedPolicy().
+         */
+        virtual const char *Name(void) const = 0;
+
+        /**
+         * Add a runnable thread; returns false if it was already queued.
+         */
+        virtual bool Push(CoronaThread *ct) = 0;
+
+        /**
+         * Remove and return the next thread to run, or NULL if there are
+         * none.
+         */
+        virtual CoronaThread *Pop(void) = 0;
+
+        /**
+         * Take the given thread off of the queue, so that it can be run out
+         * of turn; returns false if it wasn't queued.
+         */
+        virtual bool Remove(CoronaThread *ct) = 0;
+
+        /**
+         * The number of runnable threads.
+         */
+        virtual size_t Size(void) const = 0;
+};
+
+/**
+ * Create one of the built-in scheduling policies by name, or return NULL
+ * if there is none of that name:
+ *
+ *   fifo       threads run in the order that they became runnable (the
+ *              default)
+ *   lifo       the most recently woken thread runs first, while its stack
+ *              and data are likely still in cache; threads can starve while
+ *              others keep being woken
+ *   priority   FIFO within each scheduling class, and classes in order (see
+ *              kSchedClassCritical); lower classes can starve while higher
+ *              ones have work
+ */
+SchedPolicy *NewSchedPolicy(const char *name);
+
+/**
+ * Make the given policy decide what runs next, moving any runnable threads
+ * over to it. The policy is not owned by the scheduler and must outlive its
+ * use.
+ */
+void SetSchedPolicy(SchedPolicy *policy);
+
+/**
+ * Forget about the given fd.
+ *
+ * This must be called before closing an fd that may have been passed to
+ * YieldIO(), Select() or Poll() (see CoronaThread), since its watcher would
+ * otherwise outlive it (and be mistaken for a watcher on whatever fd
+ * re-uses the number). Any threads waiting on the fd are woken: their
+ * YieldIO() fails with EBADF, their Select() goes ahead with the fd's case,
+ * with SelectCase::sc_error_ set to EBADF, and their Poll() reports the fd
+ * as ready with EV_ERROR.
+ */
+void UnwatchFd(int fd);
+
+/**
+ * Pop the next runnable thread to run off of the runq, as chosen by the
+ * scheduling policy (see SetSchedPolicy()).
  *
  * This method is destructive. As a side-effect, it also walks the list of
  * zombie threads and deletes them. Note that this means that if the the
@@ -91,6 +911,8 @@ CoronaThread *PopRunnableThread(void);
 
 /**
  * Mark the given thread as runnable.
+ *
+ * Scheduling a thread that is already runnable has no effect.
  */
 void ScheduleRunnableThread(CoronaThread *ct);
 
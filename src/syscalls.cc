@@ -1,15 +1,21 @@
 #include <errno.h>
 #include <stddef.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <ctype.h>
+#include "buffer.h"
+#include "bufpool.h"
 #include "corona.h"
+#include "future.h"
 #include "sched.h"
 #include "v8-util.h"
 
@@ -215,63 +221,1140 @@ InitFcntl(const v8::Handle<v8::Object> target) {
     SET_CONST(target, O_ASYNC);
 }
 
+// Set poll-related constants in the target namespace
+static void
+InitPoll(const v8::Handle<v8::Object> target) {
+    SET_CONST(target, POLLIN);
+    SET_CONST(target, POLLOUT);
+    SET_CONST(target, POLLNVAL);
+}
+
 // Set networking-related constants in the target namespace
 static void
 InitNet(const v8::Handle<v8::Object> target) {
     struct protoent *pent;
     char buf[128];
 
-    // AF_*
-    SET_CONST(target, AF_UNIX);
-    SET_CONST(target, AF_INET);
+    // AF_*
+    SET_CONST(target, AF_UNIX);
+    SET_CONST(target, AF_INET);
+
+    // SOCK_*
+    SET_CONST(target, SOCK_STREAM);
+    SET_CONST(target, SOCK_DGRAM);
+
+    // PROTO_*
+    for (pent = getprotoent(); pent != NULL; pent = getprotoent()) {
+        sprintf(buf, "PROTO_%s", ToUpper(pent->p_name));
+        target->Set(
+            v8::String::NewSymbol(buf),
+            v8::Integer::New(pent->p_proto),
+            (v8::PropertyAttribute) (v8::ReadOnly | v8::DontDelete)
+        );
+    }
+    endprotoent();
+
+    // SO_*
+    SET_CONST(target, SO_DEBUG);
+    SET_CONST(target, SO_REUSEADDR);
+    SET_CONST(target, SO_REUSEPORT);
+    SET_CONST(target, SO_KEEPALIVE);
+    SET_CONST(target, SO_BROADCAST);
+    SET_CONST(target, SO_SNDBUF);
+    SET_CONST(target, SO_RCVBUF);
+    SET_CONST(target, SO_NOSIGPIPE);
+
+    // SOL_*
+    SET_CONST(target, SOL_SOCKET);
+
+    // MSG_*
+    SET_CONST(target, MSG_PEEK);
+    SET_CONST(target, MSG_OOB);
+    SET_CONST(target, MSG_WAITALL);
+    SET_CONST(target, MSG_DONTWAIT);
+}
+
+// Readv()s with more buffers than this copy them to the heap
+static const size_t kReadvStack = 16;
+
+// Get an optional timeout (in milliseconds) at the given index of a
+// function's arguments, as seconds; -1 if there isn't one
+#define TIMEOUT_ARG(timeout, args, index) \
+    do { \
+        if ((args).Length() > (index)) { \
+            double ms = 0; \
+            V8_ARG_VALUE(ms, args, index, Number); \
+            (timeout) = ms / 1000.0; \
+        } \
+    } while (0)
+
+// Get what to read into from the given index of a function's arguments:
+// either a Buffer, or the length of a string to read
+#define READ_DST_ARG(dst, len, args, index) \
+    do { \
+        V8_ARG_EXISTS(args, index); \
+        if (((dst) = Buffer::Unwrap((args)[(index)]))) { \
+            (len) = (dst)->Length(); \
+        } else { \
+            V8_ARG_VALUE(len, args, index, Uint32); \
+        } \
+        if ((len) == 0) { \
+            return v8::ThrowException(v8::Exception::RangeError( \
+                FormatString("Nothing to read into at index %d", (index)) \
+            )); \
+        } \
+    } while (0)
+
+// The most bytes of a UTF-8 character that a read can end partway through
+static const size_t kReadCarryMax = 3;
+
+// The start of a UTF-8 character that the last string read from each fd
+// ended partway through, which is decoded along with the next bytes read
+// rather than on its own; see SetReadCarry()
+struct ReadCarry {
+    char rc_buf_[kReadCarryMax];
+    size_t rc_len_;
+};
+
+static ReadCarry *g_readCarry = NULL;
+static int g_readCarryLen = 0;
+
+// Get the length of the longest prefix of the given bytes that doesn't end
+// partway through a UTF-8 character. Bytes that aren't valid UTF-8 are
+// left for V8 to deal with.
+static size_t
+Utf8Complete(const char *buf, size_t len) {
+    size_t i = len;
+
+    // Find the lead byte of the last character
+    while (i > 0 && len - i < kReadCarryMax &&
+           (buf[i - 1] & 0xc0) == 0x80) {
+        i--;
+    }
+
+    if (i == 0) {
+        return len;
+    }
+
+    unsigned char c = buf[i - 1];
+    size_t need = (c >= 0xf8) ? 1 :
+        (c >= 0xf0) ? 4 : (c >= 0xe0) ? 3 : (c >= 0xc0) ? 2 : 1;
+
+    return (len - (i - 1) < need) ? i - 1 : len;
+}
+
+// How many bytes are carried over for the next string read from the fd
+static size_t
+ReadCarryLength(int fd) {
+    return (fd < g_readCarryLen) ? g_readCarry[fd].rc_len_ : 0;
+}
+
+// Set the bytes (at most kReadCarryMax of them) carried over for the next
+// string read from the given fd
+static void
+SetReadCarry(int fd, const char *buf, size_t len) {
+    ASSERT(fd >= 0 && len <= kReadCarryMax);
+
+    if (fd >= g_readCarryLen) {
+        if (len == 0) {
+            return;
+        }
+
+        int carry_len = (g_readCarryLen > 0) ? g_readCarryLen : 64;
+        while (carry_len <= fd) {
+            carry_len <<= 1;
+        }
+
+        ReadCarry *carry = new ReadCarry[carry_len];
+        memset(carry, 0, carry_len * sizeof(*carry));
+        if (g_readCarry) {
+            memcpy(carry, g_readCarry, g_readCarryLen * sizeof(*carry));
+            delete[] g_readCarry;
+        }
+
+        g_readCarry = carry;
+        g_readCarryLen = carry_len;
+    }
+
+    if (len > 0) {
+        memmove(g_readCarry[fd].rc_buf_, buf, len);
+    }
+
+    g_readCarry[fd].rc_len_ = len;
+}
+
+// Copy up to 'len' of the bytes carried over for the given fd into 'buf',
+// keeping any that don't fit; returns how many were copied
+static size_t
+TakeReadCarry(int fd, char *buf, size_t len) {
+    size_t carried = ReadCarryLength(fd);
+
+    if (len > carried) {
+        len = carried;
+    }
+
+    if (len > 0) {
+        ReadCarry *rc = &g_readCarry[fd];
+
+        memcpy(buf, rc->rc_buf_, len);
+        SetReadCarry(fd, rc->rc_buf_ + len, carried - len);
+    }
+
+    return len;
+}
+
+// Bytes written to an fd that it couldn't take yet; see Write().
+//
+// These are flushed from the event loop by our watcher (which is only
+// started while there is something to flush), so they go out whether or
+// not anyone is waiting for them. The watcher must be the first member, as
+// WriteQueueCB() casts back from it.
+struct WriteQueue {
+    struct ev_io wq_io_;
+    char *wq_buf_;
+    size_t wq_cap_;
+    size_t wq_off_;
+    size_t wq_len_;
+
+    // The error that a flush failed with, for the next write() to report
+    int wq_error_;
+};
+
+// Write queues by fd, created as needed; see GetWriteQueue()
+static WriteQueue **g_writeQueues = NULL;
+static int g_writeQueuesLen = 0;
+
+// How many bytes may be left in a write queue once write() returns; see
+// WriteHighWater()
+static size_t g_writeHighWater = 0;
+
+// Buffers bigger than this are freed once their queue empties, rather than
+// being kept for next time
+static const size_t kWriteQueueKeep = 16384;
+
+// Get the write queue for the given fd, creating it if necessary
+static WriteQueue *
+GetWriteQueue(int fd) {
+    ASSERT(fd >= 0);
+
+    if (fd >= g_writeQueuesLen) {
+        int len = (g_writeQueuesLen > 0) ? g_writeQueuesLen : 64;
+        while (len <= fd) {
+            len <<= 1;
+        }
+
+        WriteQueue **wqs = new WriteQueue*[len];
+        memset(wqs, 0, len * sizeof(*wqs));
+        if (g_writeQueues) {
+            memcpy(wqs, g_writeQueues, g_writeQueuesLen * sizeof(*wqs));
+            delete[] g_writeQueues;
+        }
+
+        g_writeQueues = wqs;
+        g_writeQueuesLen = len;
+    }
+
+    if (!g_writeQueues[fd]) {
+        g_writeQueues[fd] = new WriteQueue();
+    }
+
+    return g_writeQueues[fd];
+}
+
+// Get the write queue for the given fd, or NULL if it has never had one
+static WriteQueue *
+FindWriteQueue(int fd) {
+    return (fd < g_writeQueuesLen) ? g_writeQueues[fd] : NULL;
+}
+
+// Throw away whatever is queued, and stop flushing it
+static void
+ClearWriteQueue(WriteQueue *wq) {
+    ev_io_stop(g_loop, &wq->wq_io_);
+
+    if (wq->wq_cap_ > kWriteQueueKeep) {
+        delete[] wq->wq_buf_;
+        wq->wq_buf_ = NULL;
+        wq->wq_cap_ = 0;
+    }
+
+    wq->wq_off_ = 0;
+    wq->wq_len_ = 0;
+}
+
+// Write as much of the queue as the fd will take. On failure, the queue is
+// cleared and the error kept for the next write() to report.
+static void
+FlushWriteQueue(WriteQueue *wq) {
+    while (wq->wq_len_ > 0) {
+        ssize_t nbytes = write(
+            wq->wq_io_.fd, wq->wq_buf_ + wq->wq_off_, wq->wq_len_
+        );
+
+        if (nbytes < 0) {
+            if (errno == EAGAIN) {
+                return;
+            }
+
+            wq->wq_error_ = errno;
+            break;
+        }
+
+        wq->wq_off_ += nbytes;
+        wq->wq_len_ -= nbytes;
+    }
+
+    ClearWriteQueue(wq);
+}
+
+static void
+WriteQueueCB(struct ev_loop *el, struct ev_io *w, int revents) {
+    FlushWriteQueue((WriteQueue*) w);
+}
+
+// Add bytes to the end of the queue for the given fd, and start flushing it
+static void
+AppendWriteQueue(WriteQueue *wq, int fd, const char *buf, size_t len) {
+    // Move what's left down to the front before growing
+    if (wq->wq_off_ > 0) {
+        memmove(wq->wq_buf_, wq->wq_buf_ + wq->wq_off_, wq->wq_len_);
+        wq->wq_off_ = 0;
+    }
+
+    if (wq->wq_len_ + len > wq->wq_cap_) {
+        size_t cap = (wq->wq_cap_ > 0) ? wq->wq_cap_ : 4096;
+        while (cap < wq->wq_len_ + len) {
+            cap <<= 1;
+        }
+
+        char *qbuf = new char[cap];
+        if (wq->wq_buf_) {
+            memcpy(qbuf, wq->wq_buf_, wq->wq_len_);
+            delete[] wq->wq_buf_;
+        }
+
+        wq->wq_buf_ = qbuf;
+        wq->wq_cap_ = cap;
+    }
+
+    memcpy(wq->wq_buf_ + wq->wq_len_, buf, len);
+    wq->wq_len_ += len;
+
+    if (!ev_is_active(&wq->wq_io_)) {
+        ev_io_init(&wq->wq_io_, WriteQueueCB, fd, EV_WRITE);
+        ev_io_start(g_loop, &wq->wq_io_);
+    }
+}
+
+// Report and clear an error from flushing the given queue in the
+// background, if there was one; returns -1 with errno set if so
+static int
+TakeWriteQueueError(WriteQueue *wq) {
+    if (!wq || !wq->wq_error_) {
+        return 0;
+    }
+
+    errno = wq->wq_error_;
+    wq->wq_error_ = 0;
+    return -1;
+}
+
+// Yield until no more than 'high_water' bytes are queued for the given fd.
+// Returns 0, or -1 with errno set if the queue couldn't be flushed or the
+// timeout expired first (in which case the bytes stay queued).
+static int
+WaitWriteQueue(WriteQueue *wq, size_t high_water, ev_tstamp timeout) {
+    while (wq->wq_len_ > high_water) {
+        if (g_current_thread->YieldIO(wq->wq_io_.fd, EV_WRITE, timeout) < 0) {
+            return -1;
+        }
+
+        FlushWriteQueue(wq);
+    }
+
+    return TakeWriteQueueError(wq);
+}
+
+// Write the given bytes to an fd, queuing whatever it won't take yet, and
+// yield until no more than the high-water mark is left queued; see Write()
+static int
+WriteAll(int fd, const char *buf, size_t len, ev_tstamp timeout) {
+    WriteQueue *wq = FindWriteQueue(fd);
+    size_t off = 0;
+
+    if (TakeWriteQueueError(wq) < 0) {
+        return -1;
+    }
+
+    // Anything already queued has to go first
+    if (!wq || wq->wq_len_ == 0) {
+        while (off < len) {
+            ssize_t nbytes = write(fd, buf + off, len - off);
+
+            if (nbytes < 0) {
+                if (errno == EAGAIN) {
+                    break;
+                }
+
+                return -1;
+            }
+
+            off += nbytes;
+        }
+
+        if (off == len) {
+            return 0;
+        }
+
+        wq = GetWriteQueue(fd);
+    }
+
+    AppendWriteQueue(wq, fd, buf + off, len - off);
+    return WaitWriteQueue(wq, g_writeHighWater, timeout);
+}
+
+// write(2)
+//
+// <nbytes> = write(<fd>, <string> | <buffer>[, <timeout>])
+//
+// Writes all of the given string (encoded as UTF-8) or Buffer, yielding
+// while the fd can't take any more rather than failing with EAGAIN or
+// returning a short count. Returns the number of bytes written, or -1 on
+// error, with errno set to ETIMEDOUT if the timeout (in milliseconds)
+// expired first.
+//
+// Whatever the fd doesn't take straight away is copied once into a queue for
+// the fd, which is flushed from the event loop as the fd becomes writable.
+// By default we yield until the queue is empty. With a high-water mark (see
+// writehighwater()), we return once no more than that is left queued, so
+// that a producer can get ahead of a slow reader by that much but no more.
+// Bytes still queued when a write times out stay queued. An error that
+// flushing the queue hits after write() has returned fails the next write()
+// (or drain()) on the fd, and close() throws away anything still queued.
+static v8::Handle<v8::Value>
+Write(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int32_t fd = -1;
+    Buffer *src = NULL;
+    ev_tstamp timeout = -1;
+    int err;
+
+    V8_ARG_VALUE_FD(fd, args, 0);
+    V8_ARG_EXISTS(args, 1);
+    TIMEOUT_ARG(timeout, args, 2);
+
+    if ((src = Buffer::Unwrap(args[1]))) {
+        err = WriteAll(fd, src->Data(), src->Length(), timeout);
+
+        return scope.Close(
+            v8::Integer::New((err < 0) ? -1 : (int32_t) src->Length())
+        );
+    }
+
+    V8_ARG_TYPE(args, 1, String);
+    v8::String::Utf8Value str(args[1]);
+
+    err = WriteAll(fd, *str, str.length(), timeout);
+    return scope.Close(v8::Integer::New((err < 0) ? -1 : str.length()));
+}
+
+// send(2)
+//
+// <nbytes> = send(<fd>, <string> | <buffer>, <flags>[, <timeout>])
+//
+// As write(), with the given MSG_* flags, except that nothing is queued: we
+// yield until all of the bytes have been sent (after anything that write()
+// queued). With MSG_DONTWAIT, sends what the fd will take without yielding
+// and returns how much that was, or -1 with errno set to EAGAIN if nothing.
+static v8::Handle<v8::Value>
+Send(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int32_t fd = -1;
+    int32_t flags = 0;
+    ev_tstamp timeout = -1;
+    Buffer *src = NULL;
+    WriteQueue *wq;
+
+    V8_ARG_VALUE_FD(fd, args, 0);
+    V8_ARG_EXISTS(args, 1);
+    V8_ARG_VALUE(flags, args, 2, Int32);
+    TIMEOUT_ARG(timeout, args, 3);
+
+    if (!(src = Buffer::Unwrap(args[1]))) {
+        V8_ARG_TYPE(args, 1, String);
+    }
+
+    v8::String::Utf8Value str(
+        (src) ? v8::Handle<v8::Value>(v8::String::Empty()) : args[1]
+    );
+    const char *buf = (src) ? src->Data() : *str;
+    size_t len = (src) ? src->Length() : str.length();
+    size_t off = 0;
+
+    // Don't jump the queue
+    if ((wq = FindWriteQueue(fd)) &&
+        WaitWriteQueue(wq, 0, timeout) < 0) {
+        return scope.Close(v8::Integer::New(-1));
+    }
+
+    while (off < len) {
+        ssize_t nbytes = send(fd, buf + off, len - off, flags);
+
+        if (nbytes >= 0) {
+            off += nbytes;
+            continue;
+        }
+
+        if (errno != EAGAIN) {
+            return scope.Close(v8::Integer::New(-1));
+        }
+
+        if (flags & MSG_DONTWAIT) {
+            break;
+        }
+
+        if (g_current_thread->YieldIO(fd, EV_WRITE, timeout) < 0) {
+            return scope.Close(v8::Integer::New(-1));
+        }
+    }
+
+    if (off == 0 && len > 0) {
+        return scope.Close(v8::Integer::New(-1));
+    }
+
+    return scope.Close(v8::Integer::New(off));
+}
+
+// drain()
+//
+// <err> = drain(<fd>[, <timeout>])
+//
+// Yields until nothing is left queued for the given fd by write() (see
+// writehighwater()). Returns 0, or -1 with errno set if flushing the queue
+// failed or the timeout (in milliseconds) expired first.
+static v8::Handle<v8::Value>
+Drain(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int32_t fd = -1;
+    ev_tstamp timeout = -1;
+    WriteQueue *wq;
+
+    V8_ARG_VALUE_FD(fd, args, 0);
+    TIMEOUT_ARG(timeout, args, 1);
+
+    if (!(wq = FindWriteQueue(fd))) {
+        return scope.Close(v8::Integer::New(0));
+    }
+
+    return scope.Close(v8::Integer::New(WaitWriteQueue(wq, 0, timeout)));
+}
+
+// writehighwater()
+//
+// <old bytes> = writehighwater([<bytes>])
+//
+// Returns how many bytes may be left queued for an fd once write() returns,
+// first setting it if a value is given. This is 0 (write() returns once
+// everything has been written) by default.
+static v8::Handle<v8::Value>
+WriteHighWater(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    size_t old_high_water = g_writeHighWater;
+
+    if (args.Length() > 0) {
+        uint32_t high_water = 0;
+
+        V8_ARG_VALUE(high_water, args, 0, Uint32);
+        g_writeHighWater = high_water;
+    }
+
+    return scope.Close(v8::Number::New((double) old_high_water));
+}
+
+// The syscalls that ReadInto() can make
+typedef ssize_t (*ReadOp)(int fd, char *buf, size_t len, int flags);
+
+static ssize_t
+ReadOpRead(int fd, char *buf, size_t len, int flags) {
+    return read(fd, buf, len);
+}
+
+static ssize_t
+ReadOpRecv(int fd, char *buf, size_t len, int flags) {
+    return recv(fd, buf, len, flags);
+}
+
+// Read up to 'len' bytes from 'fd' with the given syscall, yielding until
+// there is something to read, into 'dst' if given. Returns the number of
+// bytes read into 'dst', or, without one, a string of them; -1 on error.
+//
+// Without 'dst', we read into a buffer from the pool (so at most the
+// largest size class's worth), which we only hold while trying to read: it
+// goes back before we yield, so a coroutine waiting for data holds no
+// buffer. The string stops short of a character that the read ended
+// partway through, whose bytes are carried over to the front of the next
+// string read from the fd (see SetReadCarry()). A read into 'dst' gets any
+// such bytes first, without reading anything else.
+//
+// With MSG_PEEK, nothing is carried over in either direction, as the
+// bytes peeked at will be read again.
+static v8::Handle<v8::Value>
+ReadInto(ReadOp op, int fd, Buffer *dst, size_t len, int flags,
+         ev_tstamp timeout) {
+    bool carry = !(flags & MSG_PEEK);
+    int cls = -1;
+    char *buf = NULL;
+    size_t carried = 0;
+    ssize_t nbytes;
+
+    if (dst) {
+        buf = dst->Data();
+
+        if (carry && (carried = TakeReadCarry(fd, buf, len)) > 0) {
+            return v8::Integer::New(carried);
+        }
+    } else if (len > kBufPoolSizes[kBufPoolClasses - 1] - kReadCarryMax) {
+        len = kBufPoolSizes[kBufPoolClasses - 1] - kReadCarryMax;
+    }
+
+    while (true) {
+        if (!dst) {
+            carried = (carry) ? ReadCarryLength(fd) : 0;
+            cls = BufPoolClass(len + carried);
+            buf = BufPoolGet(cls);
+            TakeReadCarry(fd, buf, carried);
+        }
+
+        // Try first; if data is already buffered, there's no need to wait
+        nbytes = op(fd, buf + carried, len, flags);
+
+        if (nbytes > 0 && !dst && carry &&
+            Utf8Complete(buf, carried + nbytes) == 0) {
+            // Still not a whole character; see if there's more
+            SetReadCarry(fd, buf, carried + nbytes);
+            BufPoolPut(cls, buf);
+            continue;
+        }
+
+        if (nbytes >= 0 || errno != EAGAIN || (flags & MSG_DONTWAIT)) {
+            break;
+        }
+
+        if (!dst) {
+            if (carry) {
+                SetReadCarry(fd, buf, carried);
+            }
+
+            BufPoolPut(cls, buf);
+        }
+
+        if (g_current_thread->YieldIO(fd, EV_READ, timeout) < 0) {
+            return v8::Integer::New(-1);
+        }
+    }
+
+    if (dst) {
+        return v8::Integer::New(nbytes);
+    }
+
+    v8::Handle<v8::Value> ret;
+
+    if (nbytes < 0) {
+        if (carry) {
+            SetReadCarry(fd, buf, carried);
+        }
+
+        ret = v8::Integer::New(-1);
+    } else {
+        // At EOF, what's carried over is all there is
+        size_t end = carried + nbytes;
+        size_t complete =
+            (nbytes > 0 && carry) ? Utf8Complete(buf, end) : end;
+
+        if (carry) {
+            SetReadCarry(fd, buf + complete, end - complete);
+        }
+
+        ret = v8::String::New(buf, complete);
+    }
+
+    BufPoolPut(cls, buf);
+    return ret;
+}
+
+// read(2)
+//
+// <data> = read(<fd>, <maxbytes> | <buffer>[, <timeout>])
+//
+// Returns up to the given number of bytes (decoded as UTF-8, as write()
+// encodes them), as soon as there are any. If none are buffered, the
+// calling coroutine yields until some arrive rather than failing with
+// EAGAIN. Returns an empty string at EOF, or -1 on error, with errno set to
+// ETIMEDOUT if the timeout (in milliseconds) expired first. At most 64 KB
+// is read at once (see bufpoolstats()).
+//
+// A character that a read ends partway through is left for the next read
+// from the fd, which returns it whole (and so may return up to 3 bytes
+// more than asked for). Bytes that aren't valid UTF-8 don't survive being
+// decoded, so binary data should be read into a Buffer.
+//
+// Given a Buffer instead of a length, reads into it and returns the number
+// of bytes read (0 at EOF), without decoding anything.
+//
+// The fd should be non-blocking (as those from accept() are); reading from
+// a blocking fd blocks every coroutine.
+static v8::Handle<v8::Value>
+Read(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int32_t fd = -1;
+    size_t len = 0;
+    Buffer *dst = NULL;
+    ev_tstamp timeout = -1;
+
+    V8_ARG_VALUE_FD(fd, args, 0);
+    READ_DST_ARG(dst, len, args, 1);
+    TIMEOUT_ARG(timeout, args, 2);
+
+    return scope.Close(ReadInto(ReadOpRead, fd, dst, len, 0, timeout));
+}
+
+// recv(2)
+//
+// <data> = recv(<fd>, <maxbytes> | <buffer>, <flags>[, <timeout>])
+//
+// As read(), with the given MSG_* flags. With MSG_DONTWAIT, fails with
+// EAGAIN rather than yielding if there is nothing to read.
+static v8::Handle<v8::Value>
+Recv(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int32_t fd = -1;
+    size_t len = 0;
+    Buffer *dst = NULL;
+    int32_t flags = 0;
+    ev_tstamp timeout = -1;
+
+    V8_ARG_VALUE_FD(fd, args, 0);
+    READ_DST_ARG(dst, len, args, 1);
+    V8_ARG_VALUE(flags, args, 2, Int32);
+    TIMEOUT_ARG(timeout, args, 3);
+
+    return scope.Close(ReadInto(ReadOpRecv, fd, dst, len, flags, timeout));
+}
+
+// readv(2)
+//
+// <data> = readv(<fd>, <sizes> | <buffers>[, <timeout>])
+//
+// As read(), but scattering what is read across buffers of the given sizes
+// in a single call. Returns an array with a string for each buffer that got
+// any bytes (so an empty array at EOF), or -1 on error. A character split
+// between two buffers is all in the second one's string.
+//
+// Given an array of Buffers instead, reads into those and returns the total
+// number of bytes read.
+static v8::Handle<v8::Value>
+Readv(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int32_t fd = -1;
+    v8::Local<v8::Array> arr;
+    ev_tstamp timeout = -1;
+    struct iovec stack_iov[kReadvStack];
+    struct iovec *iov = stack_iov;
+    bool buffers = false;
+    size_t total = 0;
+    char *buf = NULL;
+    ssize_t nbytes;
+
+    V8_ARG_VALUE_FD(fd, args, 0);
+    V8_ARG_EXISTS(args, 1);
+    V8_ARG_TYPE(args, 1, Array);
+    arr = v8::Local<v8::Array>::Cast(args[1]);
+    TIMEOUT_ARG(timeout, args, 2);
+
+    size_t niov = arr->Length();
+    if (niov == 0 || niov > IOV_MAX) {
+        return v8::ThrowException(v8::Exception::RangeError(FormatString(
+            "Between 1 and %d buffers are needed", IOV_MAX
+        )));
+    }
+
+    if (niov > kReadvStack) {
+        iov = new struct iovec[niov];
+    }
+
+    buffers = (Buffer::Unwrap(arr->Get(0)) != NULL);
+
+    v8::Handle<v8::Value> exc;
+
+    for (size_t i = 0; i < niov && exc.IsEmpty(); i++) {
+        v8::Local<v8::Value> val = arr->Get(i);
+
+        if (buffers) {
+            Buffer *dst = Buffer::Unwrap(val);
+
+            if (!dst) {
+                exc = v8::Exception::TypeError(FormatString(
+                    "Element %lu is not a Buffer", (unsigned long) i
+                ));
+                break;
+            }
+
+            iov[i].iov_base = dst->Data();
+            iov[i].iov_len = dst->Length();
+        } else if (!val->IsUint32() || val->Uint32Value() == 0) {
+            exc = v8::Exception::RangeError(FormatString(
+                "Size %lu is not a positive integer", (unsigned long) i
+            ));
+        } else {
+            iov[i].iov_len = val->Uint32Value();
+            total += iov[i].iov_len;
+        }
+    }
+
+    if (!exc.IsEmpty()) {
+        if (iov != stack_iov) {
+            delete[] iov;
+        }
+
+        return v8::ThrowException(exc);
+    }
+
+    // As with ReadInto(), we only hold a buffer for strings while trying
+    // to read, taking it from the pool if it's small enough, and start
+    // with whatever the last string read from the fd carried over
+    int cls = -1;
+    bool pooled = false;
+    size_t carried = 0;
+
+    while (true) {
+        if (!buffers) {
+            carried = ReadCarryLength(fd);
+            cls = BufPoolClass(total + carried);
+            pooled = (total + carried <= kBufPoolSizes[cls]);
+            buf = (pooled) ? BufPoolGet(cls) : new char[total + carried];
+            TakeReadCarry(fd, buf, carried);
+
+            // One allocation, carved up between the buffers
+            char *p = buf + carried;
+            for (size_t i = 0; i < niov; i++) {
+                iov[i].iov_base = p;
+                p += iov[i].iov_len;
+            }
+        }
+
+        nbytes = readv(fd, iov, niov);
+
+        // Unless we're still short of a whole character, that is; see if
+        // there's more
+        bool partial = !buffers && nbytes > 0 &&
+            Utf8Complete(buf, carried + nbytes) == 0;
+
+        if (!partial && (nbytes >= 0 || errno != EAGAIN)) {
+            break;
+        }
+
+        if (!buffers) {
+            SetReadCarry(fd, buf, (partial) ? carried + nbytes : carried);
+
+            if (pooled) {
+                BufPoolPut(cls, buf);
+            } else {
+                delete[] buf;
+            }
+
+            buf = NULL;
+        }
+
+        if (!partial &&
+            g_current_thread->YieldIO(fd, EV_READ, timeout) < 0) {
+            break;
+        }
+    }
+
+    v8::Handle<v8::Value> ret;
+
+    if (nbytes < 0 || buffers) {
+        if (buf) {
+            SetReadCarry(fd, buf, carried);
+        }
+
+        ret = v8::Integer::New(nbytes);
+    } else {
+        v8::Local<v8::Array> strs = v8::Array::New();
+        size_t end = carried + nbytes;
+        size_t complete = (nbytes > 0) ? Utf8Complete(buf, end) : end;
+        size_t start = 0;
+
+        // Each buffer's string ends before any character that runs over
+        // into the next buffer, which gets all of it instead; the first
+        // also gets the bytes carried over
+        for (size_t i = 0; i < niov && start < complete; i++) {
+            size_t stop = (char*) iov[i].iov_base + iov[i].iov_len - buf;
+
+            if (stop >= complete) {
+                stop = complete;
+            } else {
+                stop = start + Utf8Complete(buf + start, stop - start);
+            }
+
+            strs->Set(i, v8::String::New(buf + start, stop - start));
+            start = stop;
+        }
+
+        SetReadCarry(fd, buf + complete, end - complete);
+        ret = strs;
+    }
+
+    if (buf && pooled) {
+        BufPoolPut(cls, buf);
+    } else {
+        delete[] buf;
+    }
+
+    if (iov != stack_iov) {
+        delete[] iov;
+    }
+
+    return scope.Close(ret);
+}
+
+// Scratch space for Writev(): iovecs, and the bytes of strings encoded for
+// them. These are kept from one call to the next, except by a call that
+// has to yield, which takes them over (as another call may need scratch
+// space in the meantime) and frees them once it's done.
+static struct iovec *g_writevIov = NULL;
+static size_t g_writevIovCap = 0;
+static char *g_writevBuf = NULL;
+static size_t g_writevBufCap = 0;
+
+// Scratch space bigger than this is freed after use rather than kept
+static const size_t kWritevKeep = 262144;
+
+// Strings longer than this are measured before being encoded, rather than
+// assuming the worst case of 3 bytes of UTF-8 for each character
+static const int kWritevMeasure = 65536;
+
+// Make sure that the given scratch array has room for 'len' elements
+template <typename T> static void
+GrowScratch(T **arr, size_t *cap, size_t len) {
+    if (len <= *cap) {
+        return;
+    }
+
+    delete[] *arr;
+    *arr = new T[len];
+    *cap = len;
+}
+
+// Hand scratch space back once we're done with it, for the next Writev().
+// It's freed instead if it's too big to keep, or if someone else has had
+// to make their own while we had it.
+template <typename T> static void
+PutScratch(T **arr, size_t *cap, T *mine, size_t mine_cap) {
+    bool keep = (mine_cap * sizeof(T) <= kWritevKeep);
+
+    if (*arr == mine) {
+        if (!keep) {
+            delete[] mine;
+            *arr = NULL;
+            *cap = 0;
+        }
+    } else if (!*arr && keep) {
+        *arr = mine;
+        *cap = mine_cap;
+    } else {
+        delete[] mine;
+    }
+}
+
+// Write the given iovecs, yielding until all of them are written. The
+// iovecs are advanced past what has been written as we go, so that nothing
+// is copied again.
+static int
+WritevAll(int fd, struct iovec *iov, size_t niov, ev_tstamp timeout) {
+    while (niov > 0) {
+        ssize_t nbytes = writev(
+            fd, iov, (niov < IOV_MAX) ? niov : IOV_MAX
+        );
 
-    // SOCK_*
-    SET_CONST(target, SOCK_STREAM);
-    SET_CONST(target, SOCK_DGRAM);
+        if (nbytes < 0) {
+            if (errno != EAGAIN ||
+                g_current_thread->YieldIO(fd, EV_WRITE, timeout) < 0) {
+                return -1;
+            }
 
-    // PROTO_*
-    for (pent = getprotoent(); pent != NULL; pent = getprotoent()) {
-        sprintf(buf, "PROTO_%s", ToUpper(pent->p_name));
-        target->Set(
-            v8::String::NewSymbol(buf),
-            v8::Integer::New(pent->p_proto),
-            (v8::PropertyAttribute) (v8::ReadOnly | v8::DontDelete)
-        );
-    }
-    endprotoent();
+            continue;
+        }
 
-    // SO_*
-    SET_CONST(target, SO_DEBUG);
-    SET_CONST(target, SO_REUSEADDR);
-    SET_CONST(target, SO_REUSEPORT);
-    SET_CONST(target, SO_KEEPALIVE);
-    SET_CONST(target, SO_BROADCAST);
-    SET_CONST(target, SO_SNDBUF);
-    SET_CONST(target, SO_RCVBUF);
-    SET_CONST(target, SO_NOSIGPIPE);
+        // Skip what was written, leaving the rest of a partial iovec
+        while (niov > 0 && (size_t) nbytes >= iov->iov_len) {
+            nbytes -= iov->iov_len;
+            iov++;
+            niov--;
+        }
 
-    // SOL_*
-    SET_CONST(target, SOL_SOCKET);
+        if (niov > 0) {
+            iov->iov_base = (char*) iov->iov_base + nbytes;
+            iov->iov_len -= nbytes;
+        }
+    }
+
+    return 0;
 }
 
-// write(2)
+// writev(2)
+//
+// <nbytes> = writev(<fd>, <data>[, <timeout>])
 //
-// <nbytes> = write(<fd>, <string>)
+// Writes all of the given array of strings (encoded as UTF-8) and Buffers,
+// in order, as with write(), but without joining them first: Buffers are
+// written from where they are, and strings are encoded straight into
+// scratch space kept for this. We yield until everything has been written
+// (after anything that write() has queued for the fd), carrying on from
+// where each partial write left off. Returns the number of bytes written,
+// or -1 on error, with errno set to ETIMEDOUT if the timeout (in
+// milliseconds) expired first.
 static v8::Handle<v8::Value>
-Write(const v8::Arguments &args) {
+Writev(const v8::Arguments &args) {
     v8::HandleScope scope;
 
     int32_t fd = -1;
-    char *buf = NULL;
+    v8::Local<v8::Array> arr;
+    ev_tstamp timeout = -1;
     size_t buf_len = 0;
-    int err = -1;
+    WriteQueue *wq;
 
     V8_ARG_VALUE_FD(fd, args, 0);
-    V8_ARG_VALUE_UTF8(buf, args, 1);
-    buf_len = args[1]->ToString()->Utf8Length();
+    V8_ARG_EXISTS(args, 1);
+    V8_ARG_TYPE(args, 1, Array);
+    arr = v8::Local<v8::Array>::Cast(args[1]);
+    TIMEOUT_ARG(timeout, args, 2);
 
-    err = write(fd, buf, buf_len);
-    return scope.Close(v8::Integer::New(err));
+    size_t niov = arr->Length();
+
+    // How much room the strings need
+    for (size_t i = 0; i < niov; i++) {
+        v8::Local<v8::Value> val = arr->Get(i);
+
+        if (val->IsString()) {
+            v8::Local<v8::String> str = val->ToString();
+
+            // Plus 1, as WriteUtf8() NUL-terminates if there's room
+            buf_len += ((str->Length() > kWritevMeasure) ?
+                str->Utf8Length() : 3 * str->Length()) + 1;
+        } else if (!Buffer::Unwrap(val)) {
+            return v8::ThrowException(v8::Exception::TypeError(FormatString(
+                "Element %lu is not a string or a Buffer", (unsigned long) i
+            )));
+        }
+    }
+
+    // An error from flushing what write() queued earlier fails this write
+    wq = FindWriteQueue(fd);
+    if (TakeWriteQueueError(wq) < 0) {
+        return scope.Close(v8::Integer::New(-1));
+    }
+
+    GrowScratch(&g_writevIov, &g_writevIovCap, niov);
+    GrowScratch(&g_writevBuf, &g_writevBufCap, buf_len);
+
+    struct iovec *iov = g_writevIov;
+    size_t iov_cap = g_writevIovCap;
+    char *buf = g_writevBuf;
+    size_t buf_cap = g_writevBufCap;
+    size_t total = 0;
+    size_t off = 0;
+
+    for (size_t i = 0; i < niov; i++) {
+        v8::Local<v8::Value> val = arr->Get(i);
+        Buffer *src;
+
+        if ((src = Buffer::Unwrap(val))) {
+            iov[i].iov_base = src->Data();
+            iov[i].iov_len = src->Length();
+        } else {
+            // Less the NUL, which there's always room for
+            int nbytes = val->ToString()->WriteUtf8(
+                buf + off, buf_len - off
+            ) - 1;
+
+            iov[i].iov_base = buf + off;
+            iov[i].iov_len = nbytes;
+            off += nbytes;
+        }
+
+        total += iov[i].iov_len;
+    }
+
+    // Try straight away, and only take the scratch space over if we have
+    // to wait
+    ssize_t nbytes = -1;
+    bool queued = wq && wq->wq_len_ > 0;
+
+    if (!queued) {
+        nbytes = writev(fd, iov, (niov < IOV_MAX) ? niov : IOV_MAX);
+    }
+
+    if ((size_t) nbytes == total ||
+        (!queued && nbytes < 0 && errno != EAGAIN)) {
+        int saved_errno = errno;
+
+        PutScratch(&g_writevIov, &g_writevIovCap, iov, iov_cap);
+        PutScratch(&g_writevBuf, &g_writevBufCap, buf, buf_cap);
+
+        errno = saved_errno;
+        return scope.Close(
+            (nbytes < 0) ?
+                v8::Number::New(-1) : v8::Number::New((double) total)
+        );
+    }
+
+    g_writevIov = NULL;
+    g_writevIovCap = 0;
+    g_writevBuf = NULL;
+    g_writevBufCap = 0;
+
+    struct iovec *left = iov;
+    size_t nleft = niov;
+    int err = 0;
+
+    // Skip what was written, leaving the rest of a partial iovec
+    while (nbytes > 0 && (size_t) nbytes >= left->iov_len) {
+        nbytes -= left->iov_len;
+        left++;
+        nleft--;
+    }
+
+    if (nbytes > 0) {
+        left->iov_base = (char*) left->iov_base + nbytes;
+        left->iov_len -= nbytes;
+    }
+
+    // Don't jump the queue
+    if (queued) {
+        err = WaitWriteQueue(wq, 0, timeout);
+    }
+
+    if (err == 0) {
+        err = WritevAll(fd, left, nleft, timeout);
+    }
+
+    int saved_errno = errno;
+
+    PutScratch(&g_writevIov, &g_writevIovCap, iov, iov_cap);
+    PutScratch(&g_writevBuf, &g_writevBufCap, buf, buf_cap);
+
+    errno = saved_errno;
+    return scope.Close(
+        (err < 0) ? v8::Number::New(-1) : v8::Number::New((double) total)
+    );
 }
 
 // socket(2)
@@ -294,21 +1377,19 @@ Socket(const v8::Arguments &args) {
     return scope.Close(v8::Integer::New(fd));
 }
 
-// bind(2)
-//
-// <err> = bind(<fd>, <port>[, <address>])
-// <err> = bind(<fd>, <path>)
+// Fill in 'ss' with the socket address given by the arguments starting at
+// index 1: either a port and an optional address, or a path. A number
+// after the port is not an address, so that callers can take more
+// arguments after it; '*next' is set to the index of the first argument
+// after the socket address. Returns an exception if the arguments are bad,
+// or an empty handle otherwise.
 static v8::Handle<v8::Value>
-Bind(const v8::Arguments &args) {
-    v8::HandleScope scope;
-
-    int fd = -1;
-    int err = -1;
-    struct sockaddr *addr = NULL;
-    struct sockaddr_in addr_in;
-    struct sockaddr_un addr_un;
+SockAddrFromArgs(const v8::Arguments &args, struct sockaddr_storage *ss,
+                 int *next) {
+    struct sockaddr_in *addr_in = (struct sockaddr_in*) ss;
+    struct sockaddr_un *addr_un = (struct sockaddr_un*) ss;
 
-    V8_ARG_VALUE_FD(fd, args, 0);
+    *next = 2;
 
     V8_ARG_EXISTS(args, 1);
     if (args[1]->IsNumber()) {
@@ -321,12 +1402,12 @@ Bind(const v8::Arguments &args) {
             )));
         }
 
-        bzero(&addr_in, sizeof(addr_in));
-        addr_in.sin_len = sizeof(addr_in);
-        addr_in.sin_family = AF_INET;
-        addr_in.sin_port = htons(port);
+        bzero(addr_in, sizeof(*addr_in));
+        addr_in->sin_len = sizeof(*addr_in);
+        addr_in->sin_family = AF_INET;
+        addr_in->sin_port = htons(port);
 
-        if (args.Length() >= 3) {
+        if (args.Length() >= 3 && !args[2]->IsNumber()) {
             char *addr_str = NULL;
 
             if (!args[2]->IsString()) {
@@ -338,37 +1419,159 @@ Bind(const v8::Arguments &args) {
             }
 
             V8_ARG_VALUE_UTF8(addr_str, args, 2);
-            if (!inet_aton(addr_str, &addr_in.sin_addr)) {
+            if (!inet_aton(addr_str, &addr_in->sin_addr)) {
                 return v8::ThrowException(v8::Exception::TypeError(FormatString(
                     "Invalid address argument specified: %s", addr_str
                 )));
             }
+
+            *next = 3;
         } else {
-            addr_in.sin_addr.s_addr = INADDR_ANY;
+            addr_in->sin_addr.s_addr = INADDR_ANY;
         }
-
-        addr = (struct sockaddr*) &addr_in;
     } else if (args[1]->IsString()) {
         char *path;
 
         V8_ARG_VALUE_UTF8(path, args, 1);
 
-        bzero(&addr_un, sizeof(addr_un));
-        addr_un.sun_len = offsetof(struct sockaddr_un, sun_path) + strlen(path);
-        addr_un.sun_family = AF_UNIX;
-        strcpy(addr_un.sun_path, path);
+        if (strlen(path) >= sizeof(addr_un->sun_path)) {
+            return v8::ThrowException(v8::Exception::TypeError(FormatString(
+                "Path argument is too long: %s", path
+            )));
+        }
 
-        addr = (struct sockaddr*) &addr_un;
+        bzero(addr_un, sizeof(*addr_un));
+        addr_un->sun_len =
+            offsetof(struct sockaddr_un, sun_path) + strlen(path);
+        addr_un->sun_family = AF_UNIX;
+        strcpy(addr_un->sun_path, path);
     } else {
         return v8::ThrowException(v8::Exception::TypeError(v8::String::New(
             "Argument at index 1 must be either a port or a path"
         )));
     }
 
+    return v8::Handle<v8::Value>();
+}
+
+// bind(2)
+//
+// <err> = bind(<fd>, <port>[, <address>])
+// <err> = bind(<fd>, <path>)
+static v8::Handle<v8::Value>
+Bind(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int fd = -1;
+    int err = -1;
+    struct sockaddr_storage ss;
+    struct sockaddr *addr = (struct sockaddr*) &ss;
+
+    V8_ARG_VALUE_FD(fd, args, 0);
+
+    int next;
+
+    v8::Handle<v8::Value> exc = SockAddrFromArgs(args, &ss, &next);
+    if (!exc.IsEmpty()) {
+        return exc;
+    }
+
     err = bind(fd, addr, addr->sa_len);
     return scope.Close(v8::Integer::New(err));
 }
 
+// connect(2) in future mode
+class ConnectFuture : public Future {
+    public:
+        ConnectFuture(int fd, ev_tstamp timeout) :
+            fd_(fd), timeout_(timeout) {}
+
+        void Start(const struct sockaddr *addr) {
+            if (connect(this->fd_, addr, addr->sa_len) == 0) {
+                this->Complete(0, 0);
+            } else if (errno == EINPROGRESS) {
+                this->WatchFd(this->fd_, EV_WRITE, this->timeout_);
+            } else {
+                this->Complete(-1, errno);
+            }
+        }
+
+    protected:
+        void Ready(void) {
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+
+            if (getsockopt(this->fd_, SOL_SOCKET, SO_ERROR, &err,
+                           &err_len) < 0) {
+                err = errno;
+            }
+
+            this->Complete((err) ? -1 : 0, err);
+        }
+
+    private:
+        int fd_;
+        ev_tstamp timeout_;
+};
+
+// connect(2)
+//
+// <err> = connect(<fd>, <port>[, <address>][, <timeout>])
+// <err> = connect(<fd>, <path>[, <timeout>])
+//
+// The socket should be non-blocking. If the connection can't be completed
+// immediately, the calling coroutine waits for it, or in future mode (see
+// futuremode()) gets a Future for the result instead.
+//
+// If a timeout (in milliseconds) is provided, waiting for the connection
+// fails with ETIMEDOUT once it has taken that long. The connection attempt
+// is left as it is; close the socket to abandon it.
+static v8::Handle<v8::Value>
+Connect(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int fd = -1;
+    int err = -1;
+    struct sockaddr_storage ss;
+    struct sockaddr *addr = (struct sockaddr*) &ss;
+    ev_tstamp timeout = -1;
+    int next;
+
+    V8_ARG_VALUE_FD(fd, args, 0);
+
+    v8::Handle<v8::Value> exc = SockAddrFromArgs(args, &ss, &next);
+    if (!exc.IsEmpty()) {
+        return exc;
+    }
+
+    TIMEOUT_ARG(timeout, args, next);
+
+    if (FutureMode()) {
+        ConnectFuture *fut = new ConnectFuture(fd, timeout);
+        v8::Handle<v8::Object> obj = fut->Wrap();
+
+        fut->Start(addr);
+        return scope.Close(obj);
+    }
+
+    err = connect(fd, addr, addr->sa_len);
+    if (err < 0 && errno == EINPROGRESS) {
+        socklen_t err_len = sizeof(err);
+
+        if (g_current_thread->YieldIO(fd, EV_WRITE, timeout) < 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0) {
+            return scope.Close(v8::Integer::New(-1));
+        }
+
+        if (err) {
+            errno = err;
+            err = -1;
+        }
+    }
+
+    return scope.Close(v8::Integer::New(err));
+}
+
 // listen(2)
 //
 // <err> = listen(<fd>, <backlog>)
@@ -422,16 +1625,111 @@ Fcntl(const v8::Arguments &args) {
     return scope.Close(v8::Integer::New(err));
 }
 
+// Connections that accept() takes per wakeup by default; see Accept()
+static const size_t kAcceptBatch = 16;
+
+// accept(2) a connection that is already non-blocking and close-on-exec,
+// with accept4(2) if we have it
+static int
+AcceptConnection(int fd, struct sockaddr *addr, socklen_t *addr_len) {
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+    return accept4(fd, addr, addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int newfd = accept(fd, addr, addr_len);
+
+    if (newfd >= 0 &&
+        (fcntl(newfd, F_SETFL, O_NONBLOCK) < 0 ||
+         fcntl(newfd, F_SETFD, FD_CLOEXEC) < 0)) {
+        int err = errno;
+
+        close(newfd);
+        errno = err;
+        return -1;
+    }
+
+    return newfd;
+#endif
+}
+
+// accept(2) in future mode
+class AcceptFuture : public Future {
+    public:
+        AcceptFuture(int fd, ev_tstamp timeout) :
+            fd_(fd), timeout_(timeout) {}
+
+        ~AcceptFuture(void) {
+            // Nobody took the connection, so nobody else will close it
+            if (this->Done() && !this->fu_claimed_ && this->Result() >= 0) {
+                close(this->Result());
+            }
+        }
+
+        void Start(void) {
+            if (!this->TryAccept()) {
+                this->WatchFd(this->fd_, EV_READ, this->timeout_);
+            }
+        }
+
+    protected:
+        void Ready(void) {
+            // Someone else may have beaten us to the connection; if so, our
+            // watcher is still armed
+            this->TryAccept();
+        }
+
+    private:
+        // Complete with an accepted connection or an error, unless we'd
+        // block; returns false if we'd block
+        bool TryAccept(void) {
+            int newfd = AcceptConnection(this->fd_, NULL, NULL);
+
+            if (newfd < 0 && errno == EAGAIN) {
+                return false;
+            }
+
+            this->Complete(newfd, (newfd < 0) ? errno : 0);
+            return true;
+        }
+
+        int fd_;
+        ev_tstamp timeout_;
+};
 
 // accept(2)
 //
-// <addr> = accept(<fd>, [<cb>])
+// <addr> = accept(<fd>, [<cb>], [<timeout>], [<options>])
 //
 // If a callback is provided, it will be invoked in a new coroutine whenever
 // a valid file descriptor is read from the socket. If no callback value is
 // provided, file descriptors are returned from the accept() call itself.
 // In either case, if the accept system call encounters a non-transient
-// error, the a negative value is returned.
+// error, the a negative value is returned. This includes the socket being
+// closed by another coroutine while we wait, which fails with EBADF.
+//
+// New file descriptors are already non-blocking and close-on-exec.
+//
+// If a timeout (in milliseconds) is provided, waiting for a new connection
+// fails with ETIMEDOUT once it has gone that long without one.
+//
+// Without a callback, a coroutine in future mode (see futuremode()) gets a
+// Future for the new file descriptor rather than waiting for it. The file
+// descriptor is closed if the Future is garbage collected without anyone
+// having asked for it.
+//
+// With a callback and options of {lazy: true}, connections don't get a
+// coroutine until they have bytes to read: until then each is just an fd
+// watcher, so connections that sit idle (or never send anything) cost no
+// stack. Options of {lazy: <ms>} also start the coroutine once the
+// connection has been idle for that long, so the callback can time it out.
+// See sys.schedstats().lazy.
+//
+// A callback loop takes at most {batch: <n>} connections (16 by default)
+// each time the socket is readable before letting other coroutines run, so
+// that a burst of connections doesn't starve those already established.
+// With {max: <n>}, at most that many callbacks run at once (counting lazy
+// ones from when they are accepted). Once there are that many, the loop
+// stops watching the socket until one of them returns, and new connections
+// wait in the kernel's listen backlog.
 static v8::Handle<v8::Value>
 Accept(const v8::Arguments &args) {
     v8::HandleScope scope;
@@ -441,10 +1739,54 @@ Accept(const v8::Arguments &args) {
     struct sockaddr_in addr_in;
     socklen_t addr_len = sizeof(addr_in);
     v8::Local<v8::Function> cb;
+    ev_tstamp timeout = -1;
+    int timeout_idx = 1;
+    bool lazy = false;
+    ev_tstamp lazy_timeout = -1;
+    size_t batch = kAcceptBatch;
+    size_t max = 0;
+    int argc = args.Length();
 
     V8_ARG_VALUE_FD(fd, args, 0);
 
-    if (args.Length() > 1) {
+    if (argc > 2 && args[argc - 1]->IsObject() &&
+        !args[argc - 1]->IsFunction()) {
+        v8::Local<v8::Object> opts = args[argc - 1]->ToObject();
+        v8::Local<v8::Value> val = opts->Get(v8::String::NewSymbol("lazy"));
+
+        if (val->IsNumber()) {
+            lazy = true;
+            lazy_timeout = val->NumberValue() / 1000.0;
+        } else {
+            lazy = val->BooleanValue();
+        }
+
+        val = opts->Get(v8::String::NewSymbol("batch"));
+        if (!val->IsUndefined()) {
+            if (!val->IsUint32() || val->Uint32Value() == 0) {
+                return v8::ThrowException(v8::Exception::RangeError(
+                    v8::String::New("Batch must be a positive integer")
+                ));
+            }
+
+            batch = val->Uint32Value();
+        }
+
+        val = opts->Get(v8::String::NewSymbol("max"));
+        if (!val->IsUndefined()) {
+            if (!val->IsUint32()) {
+                return v8::ThrowException(v8::Exception::RangeError(
+                    v8::String::New("Max must be a non-negative integer")
+                ));
+            }
+
+            max = val->Uint32Value();
+        }
+
+        argc--;
+    }
+
+    if (argc > 1 && !args[1]->IsNumber()) {
         if (!args[1]->IsFunction()) {
             return v8::ThrowException(v8::Exception::TypeError(
                 v8::String::New("Argument at index 1 should be a function")
@@ -452,29 +1794,210 @@ Accept(const v8::Arguments &args) {
         }
 
         cb = v8::Local<v8::Function>::Cast(args[1]);
+        timeout_idx = 2;
     }
 
-    while (true) {
-        newfd = accept(fd, (struct sockaddr*) &addr_in, &addr_len);
-        if (newfd >= 0 || errno != EAGAIN) {
-            if (cb.IsEmpty() || newfd < 0) {
+    if (argc > timeout_idx) {
+        if (!args[timeout_idx]->IsNumber()) {
+            return v8::ThrowException(v8::Exception::TypeError(FormatString(
+                "Argument at index %d should be a timeout", timeout_idx
+            )));
+        }
+
+        timeout = args[timeout_idx]->NumberValue() / 1000.0;
+    }
+
+    if (lazy && cb.IsEmpty()) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Lazy accept requires a callback")
+        ));
+    }
+
+    if (cb.IsEmpty() && FutureMode()) {
+        AcceptFuture *fut = new AcceptFuture(fd, timeout);
+        v8::Handle<v8::Object> obj = fut->Wrap();
+
+        fut->Start();
+        return scope.Close(obj);
+    }
+
+    if (cb.IsEmpty()) {
+        while (true) {
+            newfd = AcceptConnection(
+                fd, (struct sockaddr*) &addr_in, &addr_len
+            );
+            if (newfd >= 0 || errno != EAGAIN) {
                 return scope.Close(v8::Integer::New(newfd));
             }
 
-            v8::Handle<v8::Value> argv[] = {
-                v8::Integer::New(newfd)
-            };
-            CallbackThread *cb_thread = new CallbackThread(*cb, 1, argv);
-            cb_thread->Schedule();
+            if (g_current_thread->YieldIO(fd, EV_READ, timeout) < 0) {
+                return scope.Close(v8::Integer::New(-1));
+            }
+        }
+    }
+
+    // Lives on until the last of our callbacks is done with it
+    CallbackLimit *limit = (max > 0) ? new CallbackLimit(max) : NULL;
+
+    while (true) {
+        for (size_t i = 0; i < batch; i++) {
+            // Without a slot we don't accept, and aren't watching the
+            // socket while we wait for one
+            if (limit && limit->Acquire() < 0) {
+                newfd = -1;
+                break;
+            }
+
+            newfd = AcceptConnection(
+                fd, (struct sockaddr*) &addr_in, &addr_len
+            );
+            if (newfd < 0) {
+                if (limit) {
+                    limit->Release();
+                }
+
+                break;
+            }
+
+            if (lazy) {
+                CallWhenReadable(cb, newfd, lazy_timeout, limit);
+            } else {
+                v8::Handle<v8::Value> argv[] = {
+                    v8::Integer::New(newfd)
+                };
+                CallbackThread *cb_thread = CallbackThread::Get(cb, 1, argv);
+
+                if (limit) {
+                    cb_thread->SetLimit(limit);
+                }
+
+                cb_thread->Schedule();
+            }
+        }
+
+        if ((newfd < 0 && errno != EAGAIN) ||
+            g_current_thread->YieldIO(fd, EV_READ, timeout) < 0) {
+            break;
+        }
+    }
+
+    if (limit) {
+        int err = errno;
+
+        limit->Close();
+        errno = err;
+    }
+
+    return scope.Close(v8::Integer::New(-1));
+}
+
+// Polls with more fds than this copy them to the heap; see Poll()
+static const size_t kPollStack = 32;
+
+// poll(2)
+//
+// <nready> = poll(<fds>[, <timeout>])
+//
+// Blocks the calling coroutine until at least one of the given fds is
+// ready. Each element of the array is an object with the fd as its 'fd' and
+// POLLIN and/or POLLOUT as its 'events'; once we wake up, each element's
+// 'revents' is set to what its fd is ready for (POLLNVAL if it's invalid),
+// or 0. Returns the number of fds that are ready, or 0 if the timeout (in
+// milliseconds) expired first.
+//
+// All of the fds are watched at once and the coroutine wakes up once with
+// all of those that are ready, so one coroutine can serve many sockets.
+// An fd that another coroutine closes while we poll it is reported as
+// POLLNVAL.
+static v8::Handle<v8::Value>
+Poll(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    v8::Local<v8::Array> arr;
+    ev_tstamp timeout = -1;
+    PollFd stack_fds[kPollStack];
+    PollFd *fds = stack_fds;
+    int nready;
+
+    V8_ARG_EXISTS(args, 0);
+    V8_ARG_TYPE(args, 0, Array);
+    arr = v8::Local<v8::Array>::Cast(args[0]);
+    TIMEOUT_ARG(timeout, args, 1);
+
+    size_t len = arr->Length();
+    if (len == 0) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Nothing to poll")
+        ));
+    }
+
+    if (len > kPollStack) {
+        fds = new PollFd[len];
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        v8::Local<v8::Value> val = arr->Get(i);
+        v8::Local<v8::Value> fd;
+        int events = 0;
+
+        if (val->IsObject()) {
+            v8::Local<v8::Object> obj = val->ToObject();
+
+            fd = obj->Get(v8::String::NewSymbol("fd"));
+            events = obj->Get(v8::String::NewSymbol("events"))->Int32Value();
+        }
+
+        if (fd.IsEmpty() || !fd->IsInt32() || fd->Int32Value() < 0 ||
+            !(events & (POLLIN | POLLOUT))) {
+            if (fds != stack_fds) {
+                delete[] fds;
+            }
+
+            return v8::ThrowException(v8::Exception::TypeError(FormatString(
+                "Element %lu is not a valid fd and events", (unsigned long) i
+            )));
+        }
+
+        fds[i].pf_fd_ = fd->Int32Value();
+        fds[i].pf_events_ =
+            ((events & POLLIN) ? EV_READ : 0) |
+            ((events & POLLOUT) ? EV_WRITE : 0);
+    }
+
+    nready = g_current_thread->Poll(fds, len, timeout);
+
+    if (nready < 0 && errno == ETIMEDOUT) {
+        nready = 0;
+    }
+
+    if (nready >= 0) {
+        for (size_t i = 0; i < len; i++) {
+            int revents = fds[i].pf_revents_;
+
+            arr->Get(i)->ToObject()->Set(
+                v8::String::NewSymbol("revents"),
+                v8::Integer::New(
+                    (revents & EV_ERROR) ? POLLNVAL :
+                        ((revents & EV_READ) ? POLLIN : 0) |
+                        ((revents & EV_WRITE) ? POLLOUT : 0)
+                )
+            );
         }
+    }
 
-        g_current_thread->YieldIO(fd, EV_READ);
+    if (fds != stack_fds) {
+        delete[] fds;
     }
+
+    return scope.Close(v8::Integer::New(nready));
 }
 
 // close(2)
 //
 // <err> = close(<fd>)
+//
+// Anything that write() has left queued for the fd is thrown away; use
+// drain() first to wait for it to go out.
 static v8::Handle<v8::Value>
 Close(const v8::Arguments &args) {
     v8::HandleScope scope;
@@ -484,6 +2007,14 @@ Close(const v8::Arguments &args) {
 
     V8_ARG_VALUE_FD(fd, args, 0);
 
+    WriteQueue *wq = FindWriteQueue(fd);
+    if (wq) {
+        ClearWriteQueue(wq);
+        wq->wq_error_ = 0;
+    }
+
+    SetReadCarry(fd, NULL, 0);
+    UnwatchFd(fd);
     err = close(fd);
     return scope.Close(v8::Integer::New(err));
 }
@@ -517,13 +2048,23 @@ void InitSyscalls(const v8::Handle<v8::Object> target) {
     InitErrno(target);
     InitFcntl(target);
     InitNet(target);
+    InitPoll(target);
 
     SET_FUNC(target, "write", Write);
+    SET_FUNC(target, "drain", Drain);
+    SET_FUNC(target, "writehighwater", WriteHighWater);
+    SET_FUNC(target, "read", Read);
+    SET_FUNC(target, "recv", Recv);
+    SET_FUNC(target, "send", Send);
+    SET_FUNC(target, "writev", Writev);
+    SET_FUNC(target, "readv", Readv);
     SET_FUNC(target, "socket", Socket);
     SET_FUNC(target, "bind", Bind);
+    SET_FUNC(target, "connect", Connect);
     SET_FUNC(target, "listen", Listen);
     SET_FUNC(target, "fcntl", Fcntl);
     SET_FUNC(target, "accept", Accept);
+    SET_FUNC(target, "poll", Poll);
     SET_FUNC(target, "close", Close);
     SET_FUNC(target, "setsockopt", Setsockopt);
 }
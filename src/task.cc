@@ -0,0 +1,539 @@
+#include <errno.h>
+#include <stdint.h>
+#include "corona.h"
+#include "sched.h"
+#include "task.h"
+#include "v8-util.h"
+
+// Templates for the JavaScript objects wrapping tasks and nurseries
+static v8::Persistent<v8::FunctionTemplate> g_taskTmpl;
+static v8::Persistent<v8::FunctionTemplate> g_nurseryTmpl;
+
+// Internal fields of nursery objects: the array of tasks spawned in the
+// nursery, and whether it still accepts new ones
+static const int kNurseryTasks = 0;
+static const int kNurseryOpen = 1;
+
+// Nurseries with more unfinished tasks than this wait on a heap copy of
+// the list; see NurseryFunc()
+static const size_t kNurseryWaitStack = 32;
+
+// How often a nursery checks on tasks that it can't wait on itself, as
+// they're being joined by somebody else
+static const ev_tstamp kNurseryPollInterval = 0.01;
+
+Task::Task(void) :
+    tk_thread_(NULL),
+    tk_threw_(false) {
+}
+
+Task::~Task(void) {
+    // Our thread would be holding on to our wrapper
+    ASSERT(this->tk_self_.IsEmpty());
+
+    if (!this->tk_value_.IsEmpty()) {
+        this->tk_value_.Dispose();
+        this->tk_value_.Clear();
+    }
+}
+
+v8::Handle<v8::Object>
+Task::Start(v8::Handle<v8::Function> fn, uint8_t argc,
+            v8::Handle<v8::Value> argv[], size_t stack_size, int cls) {
+    v8::HandleScope scope;
+
+    ASSERT(this->tk_thread_ == NULL);
+
+    v8::Handle<v8::Object> obj = this->Wrap(g_taskTmpl);
+
+    // Stay alive until our thread is done with us; see Finish()
+    this->tk_self_ = v8::Persistent<v8::Object>::New(obj);
+
+    this->tk_thread_ = CallbackThread::Get(fn, argc, argv, stack_size, this);
+    this->tk_thread_->SetSchedClass(cls);
+    this->tk_thread_->Schedule();
+
+    return scope.Close(obj);
+}
+
+void
+Task::Finish(v8::Handle<v8::Value> ret, v8::TryCatch &try_catch) {
+    ASSERT(this->tk_thread_ != NULL);
+    ASSERT(this->tk_value_.IsEmpty());
+
+    this->tk_thread_ = NULL;
+
+    if (!ret.IsEmpty()) {
+        this->tk_value_ = v8::Persistent<v8::Value>::New(ret);
+        this->Complete(0, 0);
+    } else if (try_catch.HasCaught() && try_catch.CanContinue()) {
+        this->tk_value_ = v8::Persistent<v8::Value>::New(
+            try_catch.Exception()
+        );
+        this->tk_threw_ = true;
+        this->Complete(-1, 0);
+    } else {
+        this->Complete(-1, ECANCELED);
+    }
+
+    // From here on, we're garbage along with our wrapper
+    this->tk_self_.Dispose();
+    this->tk_self_.Clear();
+}
+
+void
+Task::Cancel(void) {
+    if (this->tk_thread_) {
+        this->tk_thread_->Cancel();
+    }
+}
+
+Task *
+Task::Unwrap(v8::Handle<v8::Value> val) {
+    if (!g_taskTmpl->HasInstance(val)) {
+        return NULL;
+    }
+
+    return static_cast<Task*>(Future::Unwrap(val));
+}
+
+v8::Handle<v8::Value>
+Task::Value(void) const {
+    ASSERT(this->Done());
+
+    return this->tk_value_;
+}
+
+bool
+Task::Threw(void) const {
+    ASSERT(this->Done());
+
+    return this->tk_threw_;
+}
+
+// We never call WatchFd(); our thread completes us
+void
+Task::Ready(void) {
+    UNREACHABLE();
+}
+
+// Start a task running the function in 'args' (after an options object,
+// if there is one) with the arguments that follow it; see Spawn(). Returns
+// an empty handle if an exception was thrown.
+static v8::Handle<v8::Object>
+SpawnTask(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    int idx = 0;
+    size_t stack_size = 0;
+    int cls = g_current_thread->GetSchedClass();
+
+    if (args.Length() > 0 && args[0]->IsObject() && !args[0]->IsFunction()) {
+        v8::Local<v8::Object> opts = args[0]->ToObject();
+        v8::Local<v8::Value> val;
+
+        val = opts->Get(v8::String::NewSymbol("stack"));
+        if (!val->IsUndefined()) {
+            double kb = val->NumberValue();
+
+            if (!(kb * 1024 >= kStackSizeMin)) {
+                v8::ThrowException(v8::Exception::RangeError(
+                    FormatString("Invalid stack size: %g KB", kb)
+                ));
+                return v8::Handle<v8::Object>();
+            }
+
+            stack_size = (size_t) kb * 1024;
+        }
+
+        val = opts->Get(v8::String::NewSymbol("schedclass"));
+        if (!val->IsUndefined()) {
+            cls = val->Int32Value();
+
+            if (cls < 0 || cls >= kSchedClasses) {
+                v8::ThrowException(v8::Exception::RangeError(
+                    FormatString("Invalid scheduling class: %d", cls)
+                ));
+                return v8::Handle<v8::Object>();
+            }
+        }
+
+        idx = 1;
+    }
+
+    if (args.Length() <= idx || !args[idx]->IsFunction()) {
+        v8::ThrowException(v8::Exception::TypeError(
+            FormatString("Argument at index %d is not a Function", idx)
+        ));
+        return v8::Handle<v8::Object>();
+    }
+
+    v8::Local<v8::Function> fn = v8::Local<v8::Function>::Cast(args[idx]);
+    int argc = args.Length() - idx - 1;
+    v8::Handle<v8::Value> argv[UINT8_MAX];
+
+    if (argc > UINT8_MAX) {
+        v8::ThrowException(v8::Exception::RangeError(
+            FormatString("Too many arguments: %d", argc)
+        ));
+        return v8::Handle<v8::Object>();
+    }
+
+    for (int i = 0; i < argc; i++) {
+        argv[i] = args[idx + 1 + i];
+    }
+
+    Task *task = new Task();
+    return scope.Close(task->Start(fn, argc, argv, stack_size, cls));
+}
+
+// spawn()
+//
+// <task> = spawn([<options>, ]<fn>[, <arg>...])
+//
+// Runs fn(<arg>...) in a new coroutine, which is taken from the same pool
+// as those of accept() callbacks, and returns a Task for it right away.
+// The options object may give the coroutine's stack size in KB ('stack';
+// see the -s option) and its scheduling class ('schedclass'; by default,
+// that of the calling coroutine). Coroutines with other than the default
+// stack size aren't pooled.
+//
+// A Task is also a Future, so it can be waited on with waitAll() and
+// waitAny() alongside others.
+static v8::Handle<v8::Value>
+Spawn(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    v8::Handle<v8::Object> task = SpawnTask(args);
+    if (task.IsEmpty()) {
+        return v8::Undefined();
+    }
+
+    return scope.Close(task);
+}
+
+// Task.prototype.join()
+//
+// <value> = task.join([<timeout>])
+//
+// Blocks the calling coroutine until the task is done, and returns what
+// its function returned, or throws what it threw. If the task was
+// cancelled, throws an Error with errno set to ECANCELED; if the timeout
+// (in milliseconds) expires first, throws an Error with errno set to
+// ETIMEDOUT, and the task carries on.
+static v8::Handle<v8::Value>
+TaskJoin(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    Task *task = Task::Unwrap(args.This());
+    Future *fut = task;
+    ev_tstamp timeout = -1;
+
+    if (!task) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Receiver is not a Task")
+        ));
+    }
+
+    if (args.Length() > 0) {
+        double ms = 0;
+
+        V8_ARG_VALUE(ms, args, 0, Number);
+        timeout = ms / 1000.0;
+    }
+
+    if (task->fu_waiter_ && task->fu_waiter_ != g_current_thread) {
+        return v8::ThrowException(v8::Exception::Error(
+            v8::String::New("Task is already being waited on")
+        ));
+    }
+
+    if (g_current_thread->WaitFutures(&fut, 1, true, timeout) < 0) {
+        // If we've been cancelled ourselves, we're about to be terminated
+        // anyway
+        if (errno == ECANCELED) {
+            return v8::Undefined();
+        }
+
+        return v8::ThrowException(v8::Exception::Error(
+            v8::String::New("Timed out waiting for task")
+        ));
+    }
+
+    task->Result();
+
+    if (task->Error() == ECANCELED) {
+        errno = ECANCELED;
+        return v8::ThrowException(v8::Exception::Error(
+            v8::String::New("Task was cancelled")
+        ));
+    }
+
+    if (task->Threw()) {
+        return v8::ThrowException(task->Value());
+    }
+
+    return scope.Close(task->Value());
+}
+
+// Task.prototype.cancel()
+//
+// task.cancel()
+//
+// Cancels the task if it isn't done yet: whatever its coroutine is blocked
+// in fails with ECANCELED, and its function is then terminated at the next
+// opportunity, without running any catch or finally blocks. Joining the
+// task throws an Error with errno set to ECANCELED, unless it managed to
+// finish first.
+static v8::Handle<v8::Value>
+TaskCancel(const v8::Arguments &args) {
+    Task *task = Task::Unwrap(args.This());
+
+    if (!task) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Receiver is not a Task")
+        ));
+    }
+
+    task->Cancel();
+    return v8::Undefined();
+}
+
+// Cancel all unfinished tasks in the given nursery
+static void
+CancelNursery(v8::Handle<v8::Object> nursery) {
+    v8::HandleScope scope;
+
+    v8::Local<v8::Array> tasks = v8::Local<v8::Array>::Cast(
+        nursery->GetInternalField(kNurseryTasks)
+    );
+
+    for (uint32_t i = 0; i < tasks->Length(); i++) {
+        Task::Unwrap(tasks->Get(i))->Cancel();
+    }
+}
+
+// nursery()
+//
+// <value> = nursery(<fn>)
+//
+// Calls fn(<nursery>), whose spawn() method starts tasks just like
+// sys.spawn(), and returns what fn returns once all of those tasks are
+// done. Tasks may be spawned in the nursery (e.g. by its other tasks)
+// until then.
+//
+// If fn throws, or once it has returned, any of the tasks throws, the rest
+// are cancelled and that exception is thrown once they're done. Likewise,
+// if the calling coroutine is cancelled, so are all of the tasks in the
+// nursery; no task outlives its nursery.
+static v8::Handle<v8::Value>
+NurseryFunc(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    v8::Local<v8::Function> fn;
+
+    V8_ARG_VALUE_FUNCTION(fn, args, 0);
+
+    v8::Local<v8::Object> nursery =
+        g_nurseryTmpl->InstanceTemplate()->NewInstance();
+    v8::Local<v8::Array> tasks = v8::Array::New();
+
+    nursery->SetInternalField(kNurseryTasks, tasks);
+    nursery->SetInternalField(kNurseryOpen, v8::True());
+
+    v8::Local<v8::Value> ret;
+    v8::Local<v8::Value> exc;
+    bool terminated = false;
+
+    {
+        v8::TryCatch try_catch;
+        v8::Handle<v8::Value> argv[] = { nursery };
+
+        ret = fn->Call(v8::Context::GetCurrent()->Global(), 1, argv);
+
+        if (ret.IsEmpty()) {
+            if (try_catch.CanContinue()) {
+                exc = try_catch.Exception();
+            } else {
+                // V8 re-raises this once we return
+                terminated = true;
+            }
+        }
+    }
+
+    if (ret.IsEmpty()) {
+        CancelNursery(nursery);
+    }
+
+    Future *stack_futs[kNurseryWaitStack];
+    Future **futs = stack_futs;
+    size_t futs_cap = kNurseryWaitStack;
+
+    for (;;) {
+        size_t nfuts = 0;
+        size_t pending = 0;
+
+        // Tasks may have been added while we were waiting
+        tasks = v8::Local<v8::Array>::Cast(
+            nursery->GetInternalField(kNurseryTasks)
+        );
+
+        if (tasks->Length() > futs_cap) {
+            if (futs != stack_futs) {
+                delete[] futs;
+            }
+
+            futs_cap = tasks->Length() * 2;
+            futs = new Future*[futs_cap];
+        }
+
+        for (uint32_t i = 0; i < tasks->Length(); i++) {
+            Task *task = Task::Unwrap(tasks->Get(i));
+
+            if (task->Done()) {
+                // The first failure brings down the whole nursery
+                if (task->Threw() && exc.IsEmpty() && !terminated) {
+                    exc = v8::Local<v8::Value>::New(task->Value());
+                    CancelNursery(nursery);
+                }
+
+                continue;
+            }
+
+            pending++;
+
+            // Somebody else is joining this one, and a future only has
+            // one waiter; we'll see it done on a later pass
+            if (task->fu_waiter_ && task->fu_waiter_ != g_current_thread) {
+                continue;
+            }
+
+            futs[nfuts++] = task;
+        }
+
+        if (pending == 0) {
+            break;
+        }
+
+        if (nfuts == 0) {
+            g_current_thread->Sleep(kNurseryPollInterval);
+        } else if (g_current_thread->WaitFutures(futs, nfuts, false) < 0) {
+            // We've been cancelled, so our tasks are too; keep waiting
+            CancelNursery(nursery);
+            terminated = true;
+        }
+    }
+
+    if (futs != stack_futs) {
+        delete[] futs;
+    }
+
+    nursery->SetInternalField(kNurseryOpen, v8::False());
+
+    if (terminated) {
+        return v8::Undefined();
+    }
+
+    if (!exc.IsEmpty()) {
+        return v8::ThrowException(exc);
+    }
+
+    return scope.Close(ret);
+}
+
+// Nursery.prototype.spawn()
+//
+// <task> = nursery.spawn([<options>, ]<fn>[, <arg>...])
+//
+// As spawn(), but the task belongs to the nursery; see nursery().
+static v8::Handle<v8::Value>
+NurserySpawn(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    if (!g_nurseryTmpl->HasInstance(args.This())) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Receiver is not a Nursery")
+        ));
+    }
+
+    v8::Local<v8::Object> nursery = args.This();
+
+    if (!nursery->GetInternalField(kNurseryOpen)->BooleanValue()) {
+        return v8::ThrowException(v8::Exception::Error(
+            v8::String::New("Nursery is closed")
+        ));
+    }
+
+    v8::Handle<v8::Object> task = SpawnTask(args);
+    if (task.IsEmpty()) {
+        return v8::Undefined();
+    }
+
+    v8::Local<v8::Array> tasks = v8::Local<v8::Array>::Cast(
+        nursery->GetInternalField(kNurseryTasks)
+    );
+    tasks->Set(tasks->Length(), task);
+
+    return scope.Close(task);
+}
+
+// Nursery.prototype.cancel()
+//
+// nursery.cancel()
+//
+// Cancels all of the unfinished tasks in the nursery; see Task.cancel().
+static v8::Handle<v8::Value>
+NurseryCancel(const v8::Arguments &args) {
+    v8::HandleScope scope;
+
+    if (!g_nurseryTmpl->HasInstance(args.This())) {
+        return v8::ThrowException(v8::Exception::TypeError(
+            v8::String::New("Receiver is not a Nursery")
+        ));
+    }
+
+    CancelNursery(args.This());
+    return v8::Undefined();
+}
+
+// Set task functions on the given target object
+void
+InitTasks(v8::Handle<v8::Object> target) {
+    v8::HandleScope scope;
+
+    g_taskTmpl = v8::Persistent<v8::FunctionTemplate>::New(
+        v8::FunctionTemplate::New()
+    );
+    g_taskTmpl->SetClassName(v8::String::NewSymbol("Task"));
+    g_taskTmpl->Inherit(FutureTemplate());
+    g_taskTmpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    v8::Local<v8::ObjectTemplate> proto = g_taskTmpl->PrototypeTemplate();
+    proto->Set(
+        v8::String::NewSymbol("join"),
+        v8::FunctionTemplate::New(TaskJoin)
+    );
+    proto->Set(
+        v8::String::NewSymbol("cancel"),
+        v8::FunctionTemplate::New(TaskCancel)
+    );
+
+    g_nurseryTmpl = v8::Persistent<v8::FunctionTemplate>::New(
+        v8::FunctionTemplate::New()
+    );
+    g_nurseryTmpl->SetClassName(v8::String::NewSymbol("Nursery"));
+    g_nurseryTmpl->InstanceTemplate()->SetInternalFieldCount(2);
+
+    proto = g_nurseryTmpl->PrototypeTemplate();
+    proto->Set(
+        v8::String::NewSymbol("spawn"),
+        v8::FunctionTemplate::New(NurserySpawn)
+    );
+    proto->Set(
+        v8::String::NewSymbol("cancel"),
+        v8::FunctionTemplate::New(NurseryCancel)
+    );
+
+    SET_FUNC(target, "spawn", Spawn);
+    SET_FUNC(target, "nursery", NurseryFunc);
+}
@@ -0,0 +1,79 @@
+#ifndef __corona_task_h__
+#define __corona_task_h__
+
+#include <v8.h>
+#include "future.h"
+
+class CallbackThread;
+
+/**
+ * A coroutine started by sys.spawn(), as seen by whoever started it.
+ *
+ * Tasks are futures that are done once the coroutine's function has
+ * returned, so they can be waited on alongside other futures (see
+ * CoronaThread::WaitFutures()). Unlike other futures, the result is a
+ * JavaScript value: whatever the function returned or threw.
+ *
+ * The coroutine comes from the CallbackThread pool, and hands us its
+ * result once it is done (see CallbackThread::Get()). Until then our
+ * wrapper is kept alive, so a task that nobody holds on to still runs to
+ * completion.
+ */
+class Task : public Future {
+    public:
+        Task(void);
+        ~Task(void);
+
+        /**
+         * Start running the given function with the given arguments on a
+         * thread with the given stack size (or the default, if 0) and
+         * scheduling class, and return our wrapper.
+         */
+        v8::Handle<v8::Object> Start(v8::Handle<v8::Function> fn,
+                                     uint8_t argc,
+                                     v8::Handle<v8::Value> argv[],
+                                     size_t stack_size, int cls);
+
+        /**
+         * Called by our thread once the function has returned 'ret', or
+         * thrown (in which case 'ret' is empty and 'try_catch' holds the
+         * exception, or has been terminated; see CoronaThread::Cancel()).
+         */
+        void Finish(v8::Handle<v8::Value> ret, v8::TryCatch &try_catch);
+
+        /**
+         * Cancel our thread, if it is still running.
+         */
+        void Cancel(void);
+
+        /**
+         * Get the task represented by the given JavaScript value, or NULL
+         * if it isn't a task.
+         */
+        static Task *Unwrap(v8::Handle<v8::Value> val);
+
+        /**
+         * The function's return value or exception, once we are Done();
+         * which one it is is given by Threw(). Neither is set if the
+         * function was terminated rather than returning or throwing, in
+         * which case Error() is ECANCELED.
+         */
+        v8::Handle<v8::Value> Value(void) const;
+        bool Threw(void) const;
+
+    protected:
+        void Ready(void);
+
+    private:
+        CallbackThread *tk_thread_;
+        v8::Persistent<v8::Object> tk_self_;
+        v8::Persistent<v8::Value> tk_value_;
+        bool tk_threw_;
+};
+
+/**
+ * Set task-related functions on the given target object.
+ */
+void InitTasks(v8::Handle<v8::Object> target);
+
+#endif /* __corona_task_h__ */
@@ -0,0 +1,245 @@
+#ifndef __corona_timerwheel_h__
+#define __corona_timerwheel_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "queue.h"
+
+/**
+ * A timer that can be armed on a TimerWheel.
+ *
+ * Like QueueLink, this is embedded in the object being timed out; arming,
+ * re-arming and cancelling never allocate.
+ */
+struct WheelTimer {
+    WheelTimer(void) : wt_expiry_(0), wt_cb_(NULL) {}
+
+    /**
+     * Is this timer armed on a wheel?
+     */
+    bool Armed(void) const {
+        return wt_link_.ql_queue_ != NULL;
+    }
+
+    QueueLink<WheelTimer> wt_link_;
+
+    /**
+     * The tick at which the timer fires.
+     */
+    uint64_t wt_expiry_;
+
+    /**
+     * Invoked when the timer fires. The timer is no longer armed by then,
+     * so the callback is free to re-arm it.
+     */
+    void (*wt_cb_)(WheelTimer *wt);
+};
+
+/**
+ * Hierarchical timing wheel.
+ *
+ * Time is measured in integral ticks that only ever move forwards. There are
+ * kLevels wheels of kSlots slots each; level 0 has a slot per tick, level 1
+ * a slot per kSlots ticks, and so on. A timer lives in the lowest level
+ * whose span covers the time until it is due, and is moved down a level
+ * ("cascaded") when the level below it wraps around to its slot.
+ *
+ * Adding, re-arming and removing timers are O(1). Advance() costs the
+ * timers that fire or cascade, plus a bounded scan for the next occupied
+ * slot each time it finds one; each timer cascades at most kLevels - 1
+ * times.
+ *
+ * Timers never fire early. Timers due beyond the span of the top level are
+ * parked in its last slot and cascade again until they are due.
+ */
+class TimerWheel {
+    public:
+        static const int kSlotBits = 8;
+        static const size_t kSlots = 1 << kSlotBits;
+        static const int kLevels = 4;
+
+        /**
+         * Returned by NextExpiry() when no timers are armed.
+         */
+        static const uint64_t kNever = ~((uint64_t) 0);
+
+        TimerWheel(uint64_t now = 0) : now_(now), size_(0) {}
+
+        /**
+         * The current tick.
+         */
+        uint64_t Now(void) const {
+            return now_;
+        }
+
+        /**
+         * The number of armed timers.
+         */
+        size_t Size(void) const {
+            return size_;
+        }
+
+        /**
+         * Arm a timer to fire at the given tick, re-arming it if it was
+         * already armed. Timers that are already due fire on the next tick.
+         */
+        void Add(WheelTimer *wt, uint64_t expiry) {
+            expiry = (expiry > now_) ? expiry : now_ + 1;
+
+            if (wt->Armed()) {
+                // Re-arming usually pushes the expiry out by a little; if
+                // that leaves the timer in the same slot, leave it be
+                if (&SlotFor(expiry) == wt->wt_link_.ql_queue_) {
+                    wt->wt_expiry_ = expiry;
+                    return;
+                }
+
+                Remove(wt);
+            }
+
+            wt->wt_expiry_ = expiry;
+            SlotFor(expiry).PushBack(wt);
+            size_++;
+        }
+
+        /**
+         * Disarm a timer; returns false if it was not armed.
+         */
+        bool Remove(WheelTimer *wt) {
+            if (!TimerQueue::Unlink(wt)) {
+                return false;
+            }
+
+            size_--;
+            return true;
+        }
+
+        /**
+         * Move time forwards to the given tick, firing every timer that
+         * comes due along the way, in order of expiry.
+         *
+         * Stretches of time with nothing to fire or cascade are skipped,
+         * so this costs nothing extra after a long idle period.
+         */
+        void Advance(uint64_t now) {
+            while (now_ < now) {
+                uint64_t next = NextExpiry();
+
+                if (next > now) {
+                    now_ = now;
+                    break;
+                }
+
+                now_ = next;
+
+                // Pull timers down from the levels above as the ones below
+                // wrap around
+                for (int l = 1; l < kLevels; l++) {
+                    if ((now_ & Mask(l - 1)) != 0) {
+                        break;
+                    }
+
+                    Cascade(l);
+                }
+
+                TimerQueue &slot = slots_[0][now_ & (kSlots - 1)];
+                WheelTimer *wt;
+
+                while ((wt = slot.PopFront())) {
+                    size_--;
+                    wt->wt_cb_(wt);
+                }
+            }
+        }
+
+        /**
+         * The tick at which Advance() next has something to do, or kNever if
+         * no timers are armed.
+         *
+         * This is exact for timers due within the current turn of level 0.
+         * Otherwise, it is the tick at which the next timers cascade down
+         * from the levels above, which is never later than their expiry.
+         * This costs at most kSlots probes per level.
+         */
+        uint64_t NextExpiry(void) const {
+            uint64_t next = kNever;
+
+            if (size_ == 0) {
+                return next;
+            }
+
+            for (int l = 0; l < kLevels; l++) {
+                int shift = kSlotBits * l;
+                uint64_t cur = now_ >> shift;
+
+                // Levels above us can't have anything sooner
+                if (((cur + 1) << shift) >= next) {
+                    break;
+                }
+
+                // The slot we're in at this level was emptied when we
+                // entered it, so anything there now belongs to its next turn
+                for (uint64_t i = cur + 1; i <= cur + kSlots; i++) {
+                    if ((i << shift) >= next) {
+                        break;
+                    }
+
+                    if (!slots_[l][i & (kSlots - 1)].Empty()) {
+                        next = i << shift;
+                        break;
+                    }
+                }
+            }
+
+            return next;
+        }
+
+    private:
+        typedef Queue<WheelTimer, &WheelTimer::wt_link_> TimerQueue;
+
+        // Mask of the tick bits covered by levels 0 through 'l'
+        static uint64_t Mask(int l) {
+            return (((uint64_t) 1) << (kSlotBits * (l + 1))) - 1;
+        }
+
+        // The slot in which a timer due at the given tick belongs
+        TimerQueue &SlotFor(uint64_t expiry) {
+            uint64_t delta = expiry - now_;
+            int l = 0;
+
+            while (l < kLevels - 1 && delta > Mask(l)) {
+                l++;
+            }
+
+            size_t slot;
+            if (delta > Mask(kLevels - 1)) {
+                // Beyond our span; park in the slot furthest from now
+                slot = ((now_ >> (kSlotBits * l)) - 1) & (kSlots - 1);
+            } else {
+                slot = (expiry >> (kSlotBits * l)) & (kSlots - 1);
+            }
+
+            return slots_[l][slot];
+        }
+
+        // Re-place the timers in the current slot of level 'l'
+        void Cascade(int l) {
+            TimerQueue &slot =
+                slots_[l][(now_ >> (kSlotBits * l)) & (kSlots - 1)];
+            WheelTimer *wt;
+
+            while ((wt = slot.PopFront())) {
+                SlotFor(wt->wt_expiry_).PushBack(wt);
+            }
+        }
+
+        uint64_t now_;
+        size_t size_;
+        TimerQueue slots_[kLevels][kSlots];
+
+        // Not copyable; timers point back at our slots
+        TimerWheel(const TimerWheel &);
+        TimerWheel &operator=(const TimerWheel &);
+};
+
+#endif /* __corona_timerwheel_h__ */
@@ -86,6 +86,13 @@ namespace v8 {
         (v8::PropertyAttribute) (v8::ReadOnly | v8::DontDelete) \
     )
 
+// Set a numerical property on the given target
+#define SET_NUMBER(target, name, val) \
+    (target)->Set( \
+        v8::String::NewSymbol(name), \
+        v8::Number::New((double) (val)) \
+    )
+
 // Set a constant function property on the given target
 #define SET_FUNC(target, name, func) \
     (target)->Set( \
@@ -0,0 +1,15 @@
+// Tasks that outlive the script that spawned them. The script's coroutine
+// finishes first and is reaped like any other; the tasks must still run to
+// completion, and we must exit cleanly once they have. Run with
+// 'build/corona test/outlive.js'.
+var done = 0;
+
+for (var i = 0; i < 10; i++) {
+    sys.spawn(function() {
+        sys.sleep(50);
+        done++;
+        if (done == 10) {
+            console.log('ok');
+        }
+    });
+}
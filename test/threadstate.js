@@ -0,0 +1,67 @@
+// Each switch between coroutines archives V8's state for the one leaving
+// and restores it for the one arriving: handle scopes, the entered
+// context, and the chain of try blocks (JavaScript ones and the C++
+// TryCatch that runs each task). COROUTINES coroutines each run ROUNDS
+// rounds. In each round one yields inside nested try blocks (sometimes
+// straight to another coroutine, and sometimes out to the event loop until
+// a timer wakes it), spawns a task
+// that enters the context, throws and leaves, and allocates enough for the
+// garbage collector to run while the rest are parked. Each checks that its
+// own objects and exceptions come back to it intact. Run with
+// 'build/corona test/threadstate.js', ideally against a DEBUG build of V8.
+var COROUTINES = 500;
+var ROUNDS = 20;
+
+function check(ok, what) {
+    if (!ok) {
+        throw new Error(what);
+    }
+}
+
+function round(id, r) {
+    var mine = {id: id, round: r, list: []};
+    var caught = null;
+    var finished = false;
+
+    for (var i = 0; i < 50; i++) {
+        mine.list.push('coroutine ' + id + ' item ' + i);
+    }
+
+    try {
+        try {
+            sys.sleep((r % 2) ? 0 : 1 + id % 3);
+
+            // join() rethrows what the task threw
+            sys.spawn(function() {
+                sys.sleep(0);
+                throw new Error(id + '/' + r);
+            }).join();
+        } finally {
+            finished = true;
+        }
+    } catch (e) {
+        caught = e;
+    }
+
+    check(finished, 'finally block skipped in ' + id);
+    check(caught && caught.message == id + '/' + r,
+          id + ' caught ' + caught + ' in round ' + r);
+    check(mine.id == id && mine.round == r && mine.list.length == 50,
+          'objects of ' + id + ' changed');
+    for (var i = 0; i < 50; i++) {
+        check(mine.list[i] == 'coroutine ' + id + ' item ' + i,
+              'item ' + i + ' of ' + id + ' changed');
+    }
+}
+
+sys.nursery(function(n) {
+    for (var id = 0; id < COROUTINES; id++) {
+        n.spawn(function(id) {
+            for (var r = 0; r < ROUNDS; r++) {
+                round(id, r);
+            }
+        }, id);
+    }
+});
+
+console.log('ok');
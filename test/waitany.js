@@ -0,0 +1,42 @@
+// waitAny() on a list that includes a future that is already done returns
+// straight away, and mustn't leave the others thinking that the caller is
+// still waiting for them. Both the caller and other coroutines must be able
+// to wait for them afterwards. Run with 'build/corona test/waitany.js'.
+function check(ok, what) {
+    if (!ok) {
+        throw new Error(what);
+    }
+}
+
+function later(ms, value) {
+    return sys.spawn(function() {
+        sys.sleep(ms);
+        return value;
+    });
+}
+
+var done = sys.spawn(function() {
+    return 'done';
+});
+check(done.join() === 'done', 'join() of a finished task');
+
+// Another coroutine waits for it
+var pending = later(50, 'pending');
+check(sys.waitAny([pending, done]) === 1, 'waitAny() picked a pending task');
+
+var waiter = sys.spawn(function() {
+    return pending.join();
+});
+check(waiter.join() === 'pending', 'another coroutine waiting');
+
+// We wait for it ourselves, with both join() and waitAny()
+pending = later(50, 'pending');
+check(sys.waitAny([done, pending]) === 0, 'waitAny() picked a pending task');
+check(sys.waitAny([pending], 1000) === 0, 'waitAny() of the pending task');
+check(pending.join() === 'pending', 'joining the pending task');
+
+pending = later(50, 'pending');
+check(sys.waitAny([pending, done]) === 1, 'waitAny() picked a pending task');
+check(pending.join() === 'pending', 'joining the pending task');
+
+console.log('ok');